@@ -13,11 +13,12 @@
 
 #include "bitmap.h"
 #include "NNUtils.h"
+#include "model.h"
 #include "typedefs.h"
 
 using namespace std;
 
-void saveImageSamples(const Matrix& samples,
+void saveImageSamples(const Tensor& samples,
                       int height, int width, int begin, int end,
                       string name , string path);
 
@@ -29,6 +30,7 @@ int main(){
     string train_data_path = "data/mnist_train.txt";
     string test_dataPath = "data/mnist_test.txt";
     string images_path = "images/classifier/";
+    string model_path = "classifier.model";
 
     //Hyperparameter initialization
     /////////////////////////////////////////////////////////////////////////
@@ -44,11 +46,12 @@ int main(){
         make_shared<LeakyRelu>(0.05),
         make_shared<Linear>(64, 32),
         make_shared<LeakyRelu>(0.05),
-        make_shared<Linear>(32, 10),
-        make_shared<SoftMax>()
+        make_shared<Linear>(32, 10)
     };
 
-    loss = make_shared<CrossEntropy>();
+    // Trained on the logits; getPrediction() and getAccuracy() only need
+    // their maximum, so no SoftMax layer is added
+    loss = make_shared<SoftmaxCrossEntropy>();
 
     optimizer =  make_shared<Adam>();
 
@@ -101,9 +104,9 @@ int main(){
     // Training
     /////////////////////////////////////////////////////////////////////////
 
-    Matrix X;    
-    Matrix Y;
-    Matrix Y_hat;
+    Tensor X;    
+    vector<int> labels;
+    Tensor Y_hat;
     cout << "\n\nTraining:\n" << endl;
     for(int epoch = 0; epoch < num_epochs; epoch++){
 
@@ -115,14 +118,11 @@ int main(){
         //Training
         for(int it = 0; it < num_batch_train; it++){
             // Load batch
-            loadBatch(train_data,batch_size,it,X,Y);
-            // Pass forward
-            Y_hat = nn.forward(X);
-            // Accuracy and loss update
-            training_accuracy += getAccuracy(Y_hat,Y)/num_batch_train;
-            training_loss += nn.loss->compute(Y_hat,Y)/num_batch_train;
-            // Pass backward
-            nn.backward(Y_hat,Y);
+            loadBatch(train_data,batch_size,it,X,labels);
+            // Pass forward, loss and pass backward
+            training_loss += nn.trainStep(X,labels)/num_batch_train;
+            // Accuracy update
+            training_accuracy += getAccuracy(nn.getOutput(),labels)/num_batch_train;
             // Gradient clipping
             gradientClipping(nn,5);
             // Update weights
@@ -131,15 +131,17 @@ int main(){
         }
 
         //Testing
+        nn.eval();
         for(int it = 0; it < num_batch_test; it++){
             // Load batch
-            loadBatch(test_data,batch_size,it,X,Y);
+            loadBatch(test_data,batch_size,it,X,labels);
             // Pass forward
             Y_hat = nn.forward(X);
             // Accuracy and loss update
-            test_accuracy += getAccuracy(Y_hat,Y)/num_batch_test;
-            test_loss += nn.loss->compute(Y_hat,Y)/num_batch_test;
+            test_accuracy += getAccuracy(Y_hat,labels)/num_batch_test;
+            test_loss += nn.loss->compute(Y_hat,labels)/num_batch_test;
         }
+        nn.train();
 
         cout << setprecision(4) << fixed  
              << "\tEpoch " << to_string(epoch) 
@@ -149,6 +151,11 @@ int main(){
              << "\tTest loss: " << test_loss << endl;
     }
     cout << "\nTraining done!\n" << endl;
+
+    // Served by bin/inference-server
+    cout << "Saving model to " << model_path << endl;
+    saveModel(nn, model_path);
+
     cout << "Saving image classification examples" << endl;
 
 
@@ -161,10 +168,11 @@ int main(){
     int width  = 28;
     int index = 0;
 
-    loadBatch(test_data,num_images,index,X,Y);
+    loadBatch(test_data,num_images,index,X,labels);
 
     //Pass forward
 
+    nn.eval();
     Y_hat = nn.forward(X);
     auto prediction = getPrediction(Y_hat);
     
@@ -178,17 +186,18 @@ int main(){
 
 
 
-void saveImageSamples(const Matrix& samples,
+void saveImageSamples(const Tensor& samples,
                       int height, int width, int begin, int end,
                       string name , string path) {
 
     auto image = reserveSpaceImage(height, width);
 
     for (int images = begin; images < end; images++) {
-        auto it_recon = T(samples)[images].begin();
+        Tensor sample = samples.colSlice(images, images + 1);
+        int it_recon = 0;
         for (int i = height - 1; i >= 0; i--) {
             for (int j = 0; j < width; j++) {
-                unsigned char value = (unsigned char)(int)((*it_recon) * 255);
+                unsigned char value = (unsigned char)(int)(sample(it_recon, 0) * 255);
                 image[i][j][0] = value;
                 image[i][j][1] = value;
                 image[i][j][2] = value;
@@ -12,16 +12,17 @@
 #include <random>
 
 #include "bitmap.h"
+#include "checkpoint.h"
 #include "NNUtils.h"
 #include "typedefs.h"
 
 using namespace std;
 
-void saveImageSamples(const Matrix& samples,
+void saveImageSamples(const Tensor& samples,
                       int height, int width, int begin, int end,
                       string name , string path );
 
-Matrix addNormalNoise(const Matrix& X, double mean, double std_dev, int it, int epoch);
+Tensor addNormalNoise(const Tensor& X, double mean, double std_dev, int it, int epoch);
 
 int main(){
     int seed= 123;
@@ -30,6 +31,7 @@ int main(){
 
     string train_data_path = "data/mnist_train.txt";
     string images_path = "images/denoising-vae/";
+    string checkpoint_path = "denoising-vae.checkpoint";
 
     //Hyperparameter initialization
     /////////////////////////////////////////////////////////////////////////
@@ -57,9 +59,11 @@ int main(){
     ConstantLearningRate lr_schedule(learn_rate);
 
     NeuralNetwork nn(layers, loss, optimizer);
+    nn.setSeed(seed);
     
     int batch_size = 20;
     int num_epochs = 200;
+    int checkpoint_interval = 500;  // Iterations
 
     cout << "Hyperparameters:\n"
          << "\n\tLearning rate:\t\t" << learn_rate
@@ -89,27 +93,33 @@ int main(){
     // Training
     /////////////////////////////////////////////////////////////////////////
       
-    Matrix Y;
-    Matrix Y_hat;
-    Matrix X;  
-    Matrix X_noise;
+    Tensor Y;
+    Tensor Y_hat;
+    Tensor X;  
+    Tensor X_noise;
+
+    // Resume from the last checkpoint, if any
+    TrainingProgress progress;
+    if (loadCheckpoint(checkpoint_path, nn, progress)) {
+        cout << "\nResuming from epoch " << progress.epoch
+             << ", iteration " << progress.iteration << endl;
+    }
+    CheckpointWriter checkpoints(checkpoint_path);
+
     cout << "\n\nTraining:\n" << endl;
-    for(int epoch = 0; epoch < num_epochs; epoch++){
+    for(int epoch = progress.epoch; epoch < num_epochs; epoch++){
 
-        double training_loss = 0;
+        bool resumed = epoch == progress.epoch && progress.iteration > 0;
+        double training_loss = resumed ? progress.values[0] : 0;
 
         //Training
-        for(int it = 0; it < num_batch_train; it++){
+        for(int it = resumed ? progress.iteration : 0; it < num_batch_train; it++){
             // Load batch
             loadBatch(train_data,batch_size,it,X,Y);
             // Add noise to the input data
             X_noise = addNormalNoise(X, 0.1307 , 0.3081, it, epoch);
-            // Pass forward
-            Y_hat = nn.forward(X_noise);
-            // Loss update
-            training_loss += nn.loss->compute(Y_hat,X)/num_batch_train;
-            // Pass backward
-            nn.backward(Y_hat,X);
+            // Pass forward, loss and pass backward
+            training_loss += nn.trainStep(X_noise,X)/num_batch_train;
             // Gradient clipping
             gradientClipping(nn,5);
             // Update weights
@@ -118,13 +128,27 @@ int main(){
 
             // Saving image samples
             if(it%50 == 0){
+                Y_hat = nn.getOutput();
                 saveImageSamples(Y_hat, height, width, 0, batch_size,
                                  "denoised", images_path);
                 saveImageSamples(X_noise, height, width, 0, batch_size,
                                  "noisy", images_path);
             }
+
+            // Checkpoint, written in the background
+            if((it + 1)%checkpoint_interval == 0 && it + 1 < num_batch_train){
+                progress.epoch = epoch;
+                progress.iteration = it + 1;
+                progress.values = {training_loss};
+                checkpoints.save(nn, progress);
+            }
         }
 
+        progress.epoch = epoch + 1;
+        progress.iteration = 0;
+        progress.values.clear();
+        checkpoints.save(nn, progress);
+
         cout << setprecision(4) << fixed  
              << "\tEpoch " << to_string(epoch) 
              << "\tTrain loss: " << training_loss << endl ;
@@ -135,32 +159,33 @@ int main(){
 }
 
 
-Matrix addNormalNoise(const Matrix& X, double mean, double std_dev, int it, int epoch) {
-    Matrix X_noise = X;
+Tensor addNormalNoise(const Tensor& X, double mean, double std_dev, int it, int epoch) {
+    Tensor X_noise = X.clone();
     std::default_random_engine generator(1234);
     std::normal_distribution<double> distribution(mean, std_dev);
-    for (int i = 0; i < X_noise.size(); i++) {
+    for (int i = 0; i < X_noise.rows(); i++) {
         generator.seed(generator() + it + epoch);
-        for (int j = 0; j < X_noise[0].size(); j++) {
-            X_noise[i][j] += distribution(generator);
-            X_noise[i][j] = std::min(X_noise[i][j], 1.0);
+        for (int j = 0; j < X_noise.cols(); j++) {
+            X_noise(i, j) += distribution(generator);
+            X_noise(i, j) = std::min<Scalar>(X_noise(i, j), 1);
         }
     }
     return X_noise;
 }
 
 
-void saveImageSamples(const Matrix& samples,
+void saveImageSamples(const Tensor& samples,
                       int height, int width, int begin, int end,
                       string name , string path) {
 
     auto image = reserveSpaceImage(height, width);
 
     for (int images = begin; images < end; images++) {
-        auto it_recon = T(samples)[images].begin();
+        Tensor sample = samples.colSlice(images, images + 1);
+        int it_recon = 0;
         for (int i = height - 1; i >= 0; i--) {
             for (int j = 0; j < width; j++) {
-                unsigned char value = (unsigned char)(int)((*it_recon) * 255);
+                unsigned char value = (unsigned char)(int)(sample(it_recon, 0) * 255);
                 image[i][j][0] = value;
                 image[i][j][1] = value;
                 image[i][j][2] = value;
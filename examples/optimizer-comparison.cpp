@@ -0,0 +1,183 @@
+/*
+ * File: examples/optimizer-comparison.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the comparison of optimizers and batch sizes on the MNIST Classifier.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <omp.h>
+
+#include "NNUtils.h"
+#include "typedefs.h"
+
+using namespace std;
+
+struct EpochResult {
+    double training_loss;
+    double test_accuracy;
+};
+
+// One training of the classifier
+struct Run {
+    string name;
+    shared_ptr<Optimizer> optimizer;
+    int batch_size;
+    // Called with the iteration, so warmups are counted in steps
+    shared_ptr<LearningRateScheduler> lr_schedule;
+};
+
+// The network of the classifier example, with the same initial weights for
+// the same seed
+NeuralNetwork buildClassifier(int seed, const shared_ptr<Optimizer>& optimizer);
+
+vector<EpochResult> train(NeuralNetwork& nn,
+                          const vector<vector<int>>& train_data,
+                          const vector<vector<int>>& test_data,
+                          int batch_size, int num_epochs,
+                          LearningRateScheduler& lr_schedule);
+
+// Bytes of optimizer state of the network
+size_t stateBytes(NeuralNetwork& nn);
+
+int main(){
+    int seed = 123;
+    omp_set_num_threads(8);
+
+    string train_data_path = "data/mnist_train.txt";
+    string test_dataPath = "data/mnist_test.txt";
+
+    int num_epochs = 10;
+
+
+    // Data loading
+    /////////////////////////////////////////////////////////////////////////
+
+    cout << "Loading datasets..." << flush;
+    vector<vector<int>> train_data = loadData(train_data_path.c_str());
+    vector<vector<int>> test_data = loadData(test_dataPath.c_str());
+    cout << "\tDone!" << endl;
+
+
+    // Optimizers
+    /////////////////////////////////////////////////////////////////////////
+
+    // Full precision and 8-bit Adam with the batches of the classifier
+    // example, and the layer-wise adaptive optimizers with batches large
+    // enough to keep every core busy, warming up over the first epoch
+    int large_batch = 1024;
+    int warmup = train_data.size() / large_batch;
+    vector<Run> runs = {
+        { "Adam", make_shared<Adam>(), 20, make_shared<ConstantLearningRate>(0.001) },
+        { "Adam8bit", make_shared<Adam8bit>(), 20, make_shared<ConstantLearningRate>(0.001) },
+        { "LAMB", make_shared<LAMB>(), large_batch,
+          make_shared<WarmupLR>(make_shared<ConstantLearningRate>(0.01), warmup) },
+        { "LARS", make_shared<LARS>(), large_batch,
+          make_shared<WarmupLR>(make_shared<ConstantLearningRate>(10), warmup) },
+    };
+
+
+    // Training
+    /////////////////////////////////////////////////////////////////////////
+
+    vector<vector<EpochResult>> results;
+    vector<size_t> state_bytes;
+    for (Run& run : runs) {
+        cout << "\nTraining with " << run.name << ", batch size "
+             << run.batch_size << "..." << flush;
+        NeuralNetwork nn = buildClassifier(seed, run.optimizer);
+        results.push_back(train(nn, train_data, test_data, run.batch_size,
+                                num_epochs, *run.lr_schedule));
+        state_bytes.push_back(stateBytes(nn));
+        cout << "\tDone!" << flush;
+    }
+
+    cout << "\n\nTrain loss / test accuracy:\n\n\tEpoch";
+    for (Run& run : runs) {
+        cout << "\t" << run.name << " (" << run.batch_size << ")";
+    }
+    cout << "\n";
+    for (int epoch = 0; epoch < num_epochs; epoch++) {
+        cout << "\t" << epoch;
+        for (size_t r = 0; r < runs.size(); r++) {
+            cout << setprecision(4) << fixed
+                 << "\t" << results[r][epoch].training_loss
+                 << " / " << results[r][epoch].test_accuracy;
+        }
+        cout << "\n";
+    }
+
+    cout << "\nOptimizer state:\n";
+    for (size_t r = 0; r < runs.size(); r++) {
+        cout << "\t" << runs[r].name << ":\t" << state_bytes[r] << " bytes\n";
+    }
+    cout << endl;
+
+    return 0;
+}
+
+
+NeuralNetwork buildClassifier(int seed, const shared_ptr<Optimizer>& optimizer) {
+    srand(seed);
+    vector<shared_ptr<Layer>> layers = {
+        make_shared<Linear>(784, 128),
+        make_shared<LeakyRelu>(0.05),
+        make_shared<Linear>(128, 64),
+        make_shared<LeakyRelu>(0.05),
+        make_shared<Linear>(64, 32),
+        make_shared<LeakyRelu>(0.05),
+        make_shared<Linear>(32, 10)
+    };
+    return NeuralNetwork(layers, make_shared<SoftmaxCrossEntropy>(), optimizer);
+}
+
+
+vector<EpochResult> train(NeuralNetwork& nn,
+                          const vector<vector<int>>& train_data,
+                          const vector<vector<int>>& test_data,
+                          int batch_size, int num_epochs,
+                          LearningRateScheduler& lr_schedule) {
+    int num_batch_train = train_data.size()/batch_size;
+    int num_batch_test = test_data.size()/batch_size;
+
+    vector<EpochResult> results;
+    int iteration = 0;
+    Tensor X;
+    vector<int> labels;
+    for(int epoch = 0; epoch < num_epochs; epoch++){
+        EpochResult result = { 0, 0 };
+
+        for(int it = 0; it < num_batch_train; it++){
+            loadBatch(train_data,batch_size,it,X,labels);
+            result.training_loss += nn.trainStep(X,labels)/num_batch_train;
+            gradientClipping(nn,5);
+            nn.update(lr_schedule.getLearningRate(iteration++), batch_size);
+        }
+
+        nn.eval();
+        for(int it = 0; it < num_batch_test; it++){
+            loadBatch(test_data,batch_size,it,X,labels);
+            result.test_accuracy += getAccuracy(nn.forward(X),labels)/num_batch_test;
+        }
+        nn.train();
+
+        results.push_back(result);
+    }
+    return results;
+}
+
+
+size_t stateBytes(NeuralNetwork& nn) {
+    size_t bytes = 0;
+    for (auto& layer : nn.layers) {
+        auto linear_layer = dynamic_pointer_cast<Linear>(layer);
+        if (linear_layer) {
+            for (const Tensor& tensor : nn.optimizer->getState(*linear_layer)) {
+                bytes += tensor.size() * sizeof(Scalar);
+            }
+        }
+    }
+    return bytes;
+}
@@ -18,7 +18,7 @@
 
 using namespace std;
 
-void saveImageSamples(const Matrix& samples,
+void saveImageSamples(const Tensor& samples,
                       int height, int width, int begin, int end,
                       string name , string path);
 
@@ -56,6 +56,7 @@ int main(){
     ConstantLearningRate lr_schedule(learn_rate);
 
     NeuralNetwork nn(layers, loss, optimizer);
+    nn.setSeed(seed);
 
     int batch_size = 20;
     int num_epochs = 20;
@@ -88,9 +89,9 @@ int main(){
     // Training
     /////////////////////////////////////////////////////////////////////////
 
-    Matrix X;    
-    Matrix Y;
-    Matrix Y_hat;
+    Tensor X;    
+    Tensor Y;
+    Tensor Y_hat;
     cout << "\n\nTraining:\n" << endl;
     for(int epoch = 0; epoch < num_epochs; epoch++){
 
@@ -100,13 +101,9 @@ int main(){
         for(int it = 0; it < num_batch_train; it++){
             // Load batch
             loadBatch(train_data,batch_size,it,X,Y);
-            Matrix X_d = X;
-            // Pass forward
-            Y_hat = nn.forward(X);
-            // Accuracy and loss update
-            training_loss += nn.loss->compute(Y_hat,X)/num_batch_train;
-            // Pass backward
-            nn.backward(Y_hat,X);
+            Tensor X_d = X;
+            // Pass forward, loss and pass backward
+            training_loss += nn.trainStep(X,X)/num_batch_train;
             // Gradient clipping
             gradientClipping(nn,5);
             // Update weights
@@ -115,6 +112,7 @@ int main(){
 
             // Saving image samples
             if(it%50 == 0){
+                Y_hat = nn.getOutput();
                 saveImageSamples(Y_hat, height, width, 0, batch_size,
                                  "reconstructed", images_path);
                 saveImageSamples(X, height, width, 0, batch_size,
@@ -132,17 +130,18 @@ int main(){
 }
 
 
-void saveImageSamples(const Matrix& samples,
+void saveImageSamples(const Tensor& samples,
                       int height, int width, int begin, int end,
                       string name , string path) {
 
     auto image = reserveSpaceImage(height, width);
 
     for (int images = begin; images < end; images++) {
-        auto it_recon = T(samples)[images].begin();
+        Tensor sample = samples.colSlice(images, images + 1);
+        int it_recon = 0;
         for (int i = height - 1; i >= 0; i--) {
             for (int j = 0; j < width; j++) {
-                unsigned char value = (unsigned char)(int)((*it_recon) * 255);
+                unsigned char value = (unsigned char)(int)(sample(it_recon, 0) * 255);
                 image[i][j][0] = value;
                 image[i][j][1] = value;
                 image[i][j][2] = value;
@@ -8,6 +8,8 @@
 #ifndef  lr_scheduleR_H
 #define lr_scheduleR_H
 
+#include <memory>
+
 class LearningRateScheduler {
 public:
     virtual double getLearningRate(int epoch) = 0;
@@ -57,4 +59,20 @@ private:
     int cycle_iteration;
 };
 
+
+// Ramps the learning rate of schedule up linearly over the first
+// warmup_length epochs or iterations, whichever the caller counts, from
+// 1 / warmup_length of it to all of it, and then follows schedule. Large
+// batches with LARS or LAMB need it to stay stable early on.
+class WarmupLR : public LearningRateScheduler {
+public:
+    WarmupLR(const std::shared_ptr<LearningRateScheduler>& schedule, int warmup_length);
+
+    double getLearningRate(int epoch) override;
+
+private:
+    std::shared_ptr<LearningRateScheduler> schedule;
+    int warmup_length;
+};
+
 #endif // lr_scheduleR_H
\ No newline at end of file
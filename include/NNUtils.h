@@ -17,6 +17,7 @@
 #include <memory>
 
 #include "typedefs.h"
+#include "tensor.h"
 #include "algebra.h"
 #include "losses.h"
 #include "layers.h"
@@ -27,6 +28,25 @@
 //Neural Network
 //////////////////////////////////////////////////////////////////////////////
 
+// Buffers of NeuralNetwork::predict(). Each thread running predict() needs a
+// context of its own, which is reused across calls.
+class InferenceContext {
+public:
+    InferenceContext() : buffers{ Tensor::growable(), Tensor::growable() } {}
+
+    // Output of the last predict() with this context, valid until the next one
+    Tensor getOutput() const { return output; }
+private:
+    friend class NeuralNetwork;
+
+    // Buffers the layers alternate between, which grow to the largest output
+    // they hold, so calls after the first allocate nothing unless the input
+    // gets wider
+    Tensor buffers[2];
+    Tensor output;
+};
+
+
 class NeuralNetwork {
 public:
 
@@ -36,31 +56,179 @@ public:
 
     shared_ptr<Optimizer> optimizer;
 
+    // Adjacent Linear and activation layers are run as Dense layers unless
+    // fuse is false. layers keeps the layers as given either way.
     NeuralNetwork(const vector<shared_ptr<Layer>>& layers_,
                   const shared_ptr<LossFunction>& loss_,
-                  const shared_ptr<Optimizer>& optimizer_);
+                  const shared_ptr<Optimizer>& optimizer_,
+                  bool fuse = true);
+
+    // The returned tensors share the buffers the network reuses on every
+    // pass, so they are only valid until the next call to forward or
+    // backward. Clone them to keep them longer.
+    Tensor forward(const Tensor& X);
+
+    Tensor backward(const Tensor& output, const Tensor& expected_output);
+
+    // Same with the class of each column instead of one-hot targets. The
+    // loss must support labels, see LossFunction. Throws
+    // std::invalid_argument for labels that do not fit output, see
+    // checkLabels().
+    Tensor backward(const Tensor& output, const vector<int>& labels);
+
+    // Runs forward on X, then the loss and its gradient in one pass with
+    // LossFunction::computeWithGradient, and backward through every layer.
+    // Returns the loss. The gradients are left in the layers for update().
+    double trainStep(const Tensor& X, const Tensor& expected_output);
+    double trainStep(const Tensor& X, const vector<int>& labels);
+
+    // Output of the last forward pass, valid until the next one
+    Tensor getOutput() const;
+
+    // Output of the network out of training, whatever its mode, computed
+    // with Layer::predict() into the buffers of context. The network is not
+    // changed, so many threads can share one copy of the parameters, for
+    // instance through a shared_ptr<const NeuralNetwork>, each with its own
+    // context. It must not be trained or reconfigured meanwhile. The result
+    // is valid until the next call with the same context.
+    Tensor predict(const Tensor& X, InferenceContext& context) const;
+
+    // Same with a context of its own, allocated on every call
+    Tensor predict(const Tensor& X) const;
+
+    // A network starts in training mode. In eval mode forward is predict()
+    // with a context owned by the network, so it keeps nothing for backward
+    // and writes the layers to two buffers, which after the first call are
+    // reused by every call with an input no wider. backward and trainStep
+    // throw std::logic_error. eval() releases the buffers and the caches of
+    // the last training pass, and train() the buffers of eval mode.
+    void train();
+    void eval();
+    bool isTraining() const { return training; }
+
+    // One optimizer step of all the Linear layers at once
+    void update(double learn_rate, int batch_size);
 
-    Matrix forward(const Matrix& X);
+    // Parameters and gradients of every Linear layer in one aligned buffer
+    // each. W, b, dW and db of the layers are views of these arenas, each
+    // starting at a 64-byte boundary, with zeros in between, so whole-model
+    // operations such as gradientClipping() run over one contiguous tensor.
+    // The first backward pass packs them, copying the parameters in, so a
+    // network that only runs inference, such as one built from mapModel(),
+    // leaves its parameters where they are. Empty until then.
+    Tensor getParameters() const { return parameters; }
+    Tensor getGradients() const { return gradients; }
 
-    Matrix backward(const Matrix& output, const Matrix& expected_output);
+    // Sets the accuracy of the exp, tanh and erf kernels of every layer.
+    // MathAccuracy::Exact, the default, matches libm.
+    void setMathAccuracy(MathAccuracy accuracy);
 
-    void update(double learn_rate, int batch_size);
+    // Seeds the random streams of the Dropout and NormalSampling layers, and
+    // restarts their steps, so that training is reproducible for any number
+    // of threads. Each layer is also told its index in layers, so no two
+    // share a stream. The constructor seeds them with 0.
+    void setSeed(uint64_t seed);
+
+private:
+    bool training;
+
+    void setTraining(bool training);
+
+    // Layers run by forward and backward, after fusion
+    vector<shared_ptr<Layer>> execution_layers;
+
+    // True when the last layer is a SoftMax and the loss a CrossEntropy, whose
+    // gradients combine into output - expected_output
+    bool softmax_cross_entropy;
+
+    // Propagates loss_delta back through the executed layers
+    Tensor backpropagate();
+
+    // Output and delta buffers of each executed layer, and the delta of the loss
+    vector<Tensor> activations;
+    vector<Tensor> deltas;
+    Tensor loss_delta;
+
+    // Used by forward in eval mode
+    InferenceContext eval_context;
+
+    // Last buffer written by forward
+    Tensor output;
+
+    // Every Linear layer once, in the order of layers
+    vector<shared_ptr<Linear>> linear_layers;
+
+    // See getParameters()
+    Tensor parameters;
+    Tensor gradients;
+    bool packed;
+
+    void packParameters();
+};
+
+
+// Puts a network in eval mode for the lifetime of the object and then
+// restores the mode it had:
+//
+//     {
+//         NoGrad no_grad(nn);
+//         Y_hat = nn.forward(X);
+//     }
+class NoGrad {
+public:
+    explicit NoGrad(NeuralNetwork& network);
+    ~NoGrad();
+
+    NoGrad(const NoGrad&) = delete;
+    NoGrad& operator=(const NoGrad&) = delete;
+private:
+    NeuralNetwork& network;
+    bool was_training;
 };
 
+// Rewrites every Linear layer followed by a Relu, LeakyRelu, Sigmoid, Tanh or
+// Gelu layer into one Dense layer sharing the Linear parameters
+vector<shared_ptr<Layer>> fuseLayers(const vector<shared_ptr<Layer>>& layers);
+
 vector<vector<int>> loadData(const char* file_name);
 
+// Loads batch it into X, one example per column, and the class of each
+// example into labels. X and labels are resized in place, so buffers passed
+// on every iteration are reused.
+void loadBatch(const vector<vector<int>> &data,
+               int batch_size,
+               int it,
+               Tensor &X,
+               vector<int> &labels);
+
+// Same with the classes as one-hot columns of Y, which has num_classes rows.
+// Throws std::out_of_range for labels outside of it.
+void loadBatch(const vector<vector<int>> &data,
+               int batch_size,
+               int it,
+               Tensor &X,
+               Tensor &Y,
+               int num_classes = 10);
+
+// Compatibility overload for callers still using the nested Matrix type
 void loadBatch(const vector<vector<int>> &data,
                int batch_size,
                int it,
                Matrix &X,
-               Matrix &Y);
+               Matrix &Y,
+               int num_classes = 10);
 
 void resize(Matrix& a, const Matrix& b);
 
-vector<int> getPrediction(const Matrix &A);
+vector<int> getPrediction(const Tensor &A);
+
+double getAccuracy(const Tensor &A, const Tensor &Y);
 
-double getAccuracy(const Matrix &A, const Matrix &Y);
+// Fraction of columns of A whose largest element is at row labels[j]
+double getAccuracy(const Tensor &A, const vector<int> &labels);
 
+// Scales the gradients of the network so that their global norm is at most
+// clip, with one parallel reduction and one scale over getGradients()
 void gradientClipping(NeuralNetwork &nn, double clip);
 
 #endif // NNUTILS_H
\ No newline at end of file
@@ -10,23 +10,61 @@
 
 #include <vector>
 #include "typedefs.h"
+#include "tensor.h"
+#include "kernels.h"
+#include "expression.h"
 
 
-Vector rowsSum(const Matrix & M);
+// Each operation comes in three forms: one returning a new tensor, an _into
+// form that writes into dst, and for elementwise operations an _inplace form
+// that overwrites its first argument. dst is resized with ensureShape(), so a
+// buffer reused between calls is only allocated once. Elementwise operations
+// allow dst to be one of their arguments; dot_into and T_into do not.
+//
+// The returning forms of sum, minusM, hadamard and product(Tensor) are
+// declared in expression.h. They return lazy expressions that take tensors,
+// matrices, vectors or other expressions, and are evaluated when assigned to
+// a Tensor or a Matrix or passed to eval_into().
 
-Vector product(Vector v, double a);
+Tensor rowsSum(const Tensor & M);
+void rowsSum_into(Tensor & dst, const Tensor & M);
 
-Matrix product(Matrix M, double a);
+Vector product(const Vector & v, double a);
+void product_inplace(Vector & v, double a);
 
-Matrix T(const Matrix&M);
+void product_into(Tensor & dst, const Tensor & M, double a);
+void product_inplace(Tensor & M, double a);
 
-Matrix dot(const Matrix & M1, const Matrix & M2);
+Tensor T(const Tensor & M);
+void T_into(Tensor & dst, const Tensor & M);
 
-Matrix sum(const Matrix & M, const Vector & b);
+Tensor dot(const Tensor & M1, const Tensor & M2);
+void dot_into(Tensor & dst, const Tensor & M1, const Tensor & M2);
 
-Matrix minusM(const Matrix & M1, const Matrix & M2);
+// C = alpha * op(A) * op(B) + beta * C, where op(X) is X transposed when the
+// matching flag is set and X otherwise. A and B are read in place, without
+// materializing the transposes, and C must already have the result's shape.
+// C is not read when beta is 0.
+void gemm(bool transA, bool transB,
+          double alpha, const Tensor & A, const Tensor & B,
+          double beta, Tensor & C);
 
-Matrix hadamard(const Matrix & M1, const Matrix & M2);
+// dst = activation(W * X + b), where b is added to every column. The bias
+// and the activation are applied by the GEMM epilogue while each tile of dst
+// is still in cache. activation may be null, and pre_activation, when not
+// null, receives W * X + b.
+void dense_into(Tensor & dst, const Tensor & W, const Tensor & X, const Tensor & b,
+                UnaryKernel activation = nullptr, Scalar param = 0,
+                Tensor * pre_activation = nullptr);
 
+void sum_into(Tensor & dst, const Tensor & M, const Tensor & b);
+void sum_inplace(Tensor & M, const Tensor & b);
 
-#endif
\ No newline at end of file
+void minusM_into(Tensor & dst, const Tensor & M1, const Tensor & M2);
+void minusM_inplace(Tensor & M1, const Tensor & M2);
+
+void hadamard_into(Tensor & dst, const Tensor & M1, const Tensor & M2);
+void hadamard_inplace(Tensor & M1, const Tensor & M2);
+
+
+#endif
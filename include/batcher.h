@@ -0,0 +1,154 @@
+/*
+ * File: include/batcher.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the request batcher that coalesces small inference requests into batches.
+ */
+
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "typedefs.h"
+#include "tensor.h"
+#include "NNUtils.h"
+
+
+// Latency histogram
+//////////////////////////////////////////////////////////////////////////////
+
+// Counts durations in microseconds in logarithmic buckets, four per power of
+// two, so percentiles are within 19% of the exact value at a fixed memory
+// cost however many are recorded
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 4 * 40;
+
+    LatencyHistogram();
+
+    void record(double microseconds);
+
+    uint64_t count() const { return total; }
+
+    // Upper bound of the bucket holding the given fraction of the durations,
+    // 0.5 for the median. 0 if nothing was recorded.
+    double percentile(double fraction) const;
+
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t total;
+};
+
+
+// Request batcher
+//////////////////////////////////////////////////////////////////////////////
+
+struct BatcherOptions {
+    // Columns run in one forward pass. A request with more columns than this
+    // is run alone.
+    int max_batch_size = 64;
+
+    // Longest time the first request of a batch waits for more to arrive
+    std::chrono::microseconds max_delay = std::chrono::microseconds(1000);
+
+    // Threads running the batches, each with its own InferenceContext
+    int num_workers = 1;
+};
+
+
+struct BatcherStats {
+    uint64_t requests;
+    uint64_t batches;
+
+    // From submit() until the result is ready, in microseconds
+    double p50_latency;
+    double p99_latency;
+
+    // Number of batches of each size in columns, indexed by size
+    std::vector<uint64_t> batch_sizes;
+};
+
+
+// Runs the inference requests of many clients through one network. Each
+// request is a tensor with one sample per column. Requests are queued and
+// coalesced, in order of arrival, into batches of up to max_batch_size
+// columns, which wait at most max_delay after their first request. A worker
+// runs each batch with NeuralNetwork::predict() and gives every request its
+// own columns of the output through the future returned by submit().
+class RequestBatcher {
+public:
+    // Throws std::invalid_argument if the options are not positive
+    RequestBatcher(const shared_ptr<const NeuralNetwork>& network,
+                   int input_size,
+                   const BatcherOptions& options = BatcherOptions());
+
+    // Runs what is still queued and stops the workers
+    ~RequestBatcher();
+
+    RequestBatcher(const RequestBatcher&) = delete;
+    RequestBatcher& operator=(const RequestBatcher&) = delete;
+
+    // Queues the columns of X, which are copied, so the buffer can be reused
+    // at once. Throws std::invalid_argument if X does not have input_size
+    // rows, and std::logic_error after shutdown(). Errors of the forward pass
+    // are thrown by the future.
+    std::future<Tensor> submit(const Tensor& X);
+
+    // Same without copying X, which must not change until the future is
+    // ready. X is run in place when it is alone in its batch, which is
+    // always the case from max_batch_size columns on, and is otherwise
+    // copied into the input of the batch.
+    std::future<Tensor> submitView(const Tensor& X);
+
+    // Runs what is still queued and waits for the workers. Called by the
+    // destructor.
+    void shutdown();
+
+    BatcherStats getStats() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+        Tensor input;
+        std::promise<Tensor> result;
+        Clock::time_point arrival;
+    };
+
+    shared_ptr<const NeuralNetwork> network;
+    int input_size;
+    BatcherOptions options;
+
+    std::deque<Request> queue;
+    int queued_columns;
+    bool stopping;
+
+    mutable std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<std::thread> workers;
+
+    LatencyHistogram latency;
+    std::vector<uint64_t> batch_sizes;
+    uint64_t batches;
+
+    std::future<Tensor> enqueue(const Tensor& X);
+
+    void work();
+
+    // Takes the requests of the next batch off the queue, waiting for them.
+    // Returns false when stopping and nothing is left.
+    bool nextBatch(std::vector<Request>& batch);
+
+    void run(std::vector<Request>& batch, Tensor& X, InferenceContext& context);
+};
+
+
+#endif // BATCHER_H
@@ -0,0 +1,115 @@
+/*
+ * File: include/checkpoint.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the training checkpoints, written in the background and resumed exactly.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "typedefs.h"
+#include "NNUtils.h"
+
+
+// Checkpoints
+//////////////////////////////////////////////////////////////////////////////
+
+// A checkpoint holds everything a training loop needs to go on as if it had
+// never stopped: the parameters of every Linear layer, the state the
+// optimizer keeps for them and its step, the random state of the Dropout and
+// NormalSampling layers, and the progress of the loop. Learning rate
+// schedules are functions of the epoch, and batches of their index, so the
+// progress is also their position.
+//
+// The file is written in the byte order and precision of the host:
+//
+//     Header       Magic "DCPPCKPT", format version, sizeof(Scalar), number
+//                  of tensors, random states and values, the progress, the
+//                  optimizer step, the size of the data, and the CRC-32C of
+//                  the data and of the header itself
+//     Data         Each tensor as its rows and columns and its elements row
+//                  by row, then each random state, then the values
+//
+// Tensors are stored layer by layer: W, b, and then the optimizer state of
+// the layer, see Optimizer::getState().
+
+const uint32_t CHECKPOINT_VERSION = 1;
+
+// Where the training loop is: the epoch, and the batch of that epoch it
+// runs next. values holds anything else the loop needs back, such as a
+// running sum of the loss.
+struct TrainingProgress {
+    int64_t epoch = 0;
+    int64_t iteration = 0;
+    vector<double> values;
+};
+
+
+// Writes checkpoints of a network to one file without stalling training.
+// save() only copies the state into one of two buffers, and a thread of the
+// writer serializes it, writes it to file_name.tmp, syncs it and renames it
+// over file_name. The file therefore always holds a whole checkpoint, the old
+// one until the new one is on disk, even if the process or the machine
+// crashes midway.
+//
+// A checkpoint saved while the previous one is still being written waits in
+// the other buffer. If another comes before that one is written, it replaces
+// it, so save() never waits for the disk. Only one thread may use a writer.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const string& file_name);
+
+    // Writes the last checkpoint saved before returning
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // Copies the state of network and progress. The network can be trained
+    // again as soon as it returns. Throws std::runtime_error if an earlier
+    // checkpoint could not be written.
+    void save(const NeuralNetwork& network, const TrainingProgress& progress);
+
+    // Waits until every checkpoint saved is on disk. Throws
+    // std::runtime_error if one could not be written.
+    void flush();
+
+private:
+    string file_name;
+
+    // Buffers in the layout of the file, the one queued for the thread and
+    // the one it is writing, -1 for none
+    vector<char> buffers[2];
+    int queued;
+    int writing;
+
+    bool stopping;
+    string error;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    void work();
+    void throwError();
+};
+
+
+// Restores in network the state saved in file_name, and returns the progress
+// saved with it in progress. The network must have the layers and optimizer
+// it was saved with. Returns false, changing nothing, if there is no such
+// file. Throws std::runtime_error, also changing nothing, for a file that
+// cannot be read, is corrupt, was written with another version or precision,
+// or does not match the network.
+bool loadCheckpoint(const string& file_name, NeuralNetwork& network, TrainingProgress& progress);
+
+
+#endif // CHECKPOINT_H
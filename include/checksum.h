@@ -0,0 +1,21 @@
+/*
+ * File: include/checksum.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the checksum used to validate the files written by the framework.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+// CRC-32C (Castagnoli) of size bytes, continuing from the checksum crc of the
+// bytes before them. Uses the crc32 instruction of SSE4.2 when the CPU has
+// it, which checks several gigabytes per second.
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+
+#endif // CHECKSUM_H
@@ -0,0 +1,91 @@
+/*
+ * File: include/client.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the client of the inference server.
+ */
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "typedefs.h"
+#include "ipc.h"
+
+
+// Inference client
+//////////////////////////////////////////////////////////////////////////////
+
+// Connection to an InferenceServer, with a ring of slots in shared memory
+// for the samples and outputs. Up to slots requests can be in flight at
+// once. Samples are written straight into the ring, so a request is never
+// copied on its way to the server. Not thread-safe: use one client per
+// thread.
+//
+//     Scalar* samples = client.reserve(n);
+//     // Write n samples of client.inputSize() values
+//     uint64_t ticket = client.send();
+//     const Scalar* outputs = client.wait(ticket);
+class InferenceClient {
+public:
+    // Connects to the server listening on socket_path. Throws
+    // std::runtime_error on failure, or if the server was built with another
+    // precision.
+    InferenceClient(const std::string& socket_path, int slots = 8, int slot_columns = 64);
+    ~InferenceClient();
+
+    InferenceClient(const InferenceClient&) = delete;
+    InferenceClient& operator=(const InferenceClient&) = delete;
+
+    int inputSize() const { return hello.input_size; }
+    int outputSize() const { return hello.output_size; }
+    int slotColumns() const { return slot_columns; }
+
+    // Buffer of the next slot of the ring, for n <= slotColumns() samples of
+    // inputSize() values, one after another. Waits for the response to the
+    // previous request of the slot. Throws std::invalid_argument for a bad n.
+    Scalar* reserve(int n);
+
+    // Sends the samples of the last reserve(). Returns the ticket of the
+    // request.
+    uint64_t send();
+
+    // Waits for the response to ticket. Returns the outputs, outputSize()
+    // values per sample, which are valid until the slot is reserved again.
+    // Throws std::runtime_error if the request failed or the connection was
+    // lost.
+    const Scalar* wait(uint64_t ticket);
+
+    // Runs n samples and copies their outputs to outputs
+    void infer(const Scalar* samples, int n, Scalar* outputs);
+
+private:
+    struct Slot {
+        uint64_t ticket = 0;
+        uint32_t columns = 0;
+        bool pending = false;
+        int32_t status = IPC_OK;
+    };
+
+    int fd;
+    HelloMessage hello;
+    int slot_columns;
+    size_t slot_scalars;
+
+    Scalar* ring;
+    size_t ring_bytes;
+
+    std::vector<Slot> slots;
+    int next_slot;
+    int reserved;
+    uint64_t next_ticket;
+
+    // Reads responses until the slot is no longer pending
+    void complete(int slot);
+};
+
+
+#endif // CLIENT_H
@@ -0,0 +1,45 @@
+/*
+ * File: include/elementwise.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the functions that apply elementwise kernels to whole tensors.
+ */
+
+#ifndef ELEMENTWISE_H
+#define ELEMENTWISE_H
+
+#include <cstdint>
+#include <vector>
+#include "kernels.h"
+#include "tensor.h"
+
+
+// Tensors with fewer elements than this are processed on the calling thread,
+// larger ones are split among OpenMP threads in cache line aligned chunks.
+const size_t ELEMENTWISE_PARALLEL_THRESHOLD = 1 << 15;
+
+// out = kernel(x, y) elementwise, using the kernels of the active instruction
+// set, e.g. applyKernel(kernels().add, x, y, out). out must already have the
+// shape of x and y and may be one of them.
+void applyKernel(BinaryKernel kernel, const Tensor& x, const Tensor& y, Tensor& out);
+
+// out = kernel(x) elementwise, with a passed as the kernel parameter
+void applyKernel(UnaryKernel kernel, const Tensor& x, Scalar a, Tensor& out);
+
+// out(i, j) = x(i, j) + b(i, 0)
+void addColumn(const Tensor& x, const Tensor& b, Tensor& out);
+
+// Packs one bit per element of x, in row-major order, into mask: the bit is
+// set when the element is greater than 0, or greater or equal when
+// inclusive is set
+void packMask(const Tensor& x, bool inclusive, std::vector<uint64_t>& mask);
+
+// out = x * (bit ? 1 : a) elementwise, with the bits of packMask()
+void applyMask(const Tensor& x, const std::vector<uint64_t>& mask, Scalar a, Tensor& out);
+
+// Sum of the squares of the elements of x, e.g. the squared norm of a
+// gradient. The same for any number of threads.
+double sumSquares(const Tensor& x);
+
+
+#endif // ELEMENTWISE_H
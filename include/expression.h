@@ -0,0 +1,280 @@
+/*
+ * File: include/expression.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the expression templates that fuse chains of elementwise operations.
+ */
+
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+
+#include "elementwise.h"
+#include "kernels.h"
+#include "tensor.h"
+
+
+// Expressions
+//////////////////////////////////////////////////////////////////////////////
+
+// hadamard(), minusM(), sum(), product() and elementwise() build a tree of
+// expressions instead of computing a tensor. Nothing is evaluated until the
+// tree is assigned, either to a new Tensor or into a buffer with eval_into():
+//
+//     eval_into(delta, hadamard(prev_delta, elementwise(kernels().relu_derivative, z)));
+//
+// The tree is then walked once over blocks of EXPRESSION_BLOCK elements.
+// Intermediate results live in small stack buffers that stay in L1, and each
+// node runs the kernel of the active instruction set, so the result is
+// bitwise identical to applying the operations one at a time.
+//
+// Nodes hold their operands by value. Tensors are shallow, so this keeps
+// their buffers alive without copying them.
+
+const int EXPRESSION_BLOCK = 256;
+
+template <typename E>
+class Expression {
+public:
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    // Evaluates the expression into a Matrix, for the call sites of the
+    // nested vector representation. Tensors are built from expressions by
+    // the constructor of Tensor.
+    operator Matrix() const;
+};
+
+// Every expression provides:
+//
+//   int rows() const, int cols() const
+//   bool flat() const
+//       True if the elements can be indexed linearly, that is, every operand
+//       is contiguous and nothing is broadcast.
+//   const Scalar* block(int i, ptrdiff_t j, int n, Scalar* scratch) const
+//       Pointer to elements (i, j) to (i, j + n - 1), or to elements j to
+//       j + n - 1 of the flattened tensor when i is -1. scratch has room for
+//       n elements and is where computed values are written.
+
+
+// Leaf holding a tensor
+class TensorExpression : public Expression<TensorExpression> {
+public:
+    explicit TensorExpression(const Tensor& t) : t(t) {}
+
+    int rows() const { return t.rows(); }
+    int cols() const { return t.cols(); }
+    bool flat() const { return t.isContiguous(); }
+
+    const Scalar* block(int i, ptrdiff_t j, int n, Scalar* scratch) const {
+        if (i < 0) {
+            return t.data() + j;
+        }
+        if (t.stride(1) == 1) {
+            return &t(i, j);
+        }
+        for (int k = 0; k < n; k++) {
+            scratch[k] = t(i, j + k);
+        }
+        return scratch;
+    }
+
+private:
+    Tensor t;
+};
+
+// kernel(x, y)
+template <typename X, typename Y>
+class BinaryExpression : public Expression<BinaryExpression<X, Y> > {
+public:
+    BinaryExpression(BinaryKernel kernel, const X& x, const Y& y)
+        : kernel(kernel), x(x), y(y) {}
+
+    int rows() const { return x.rows(); }
+    int cols() const { return x.cols(); }
+    bool flat() const { return x.flat() && y.flat(); }
+
+    const Scalar* block(int i, ptrdiff_t j, int n, Scalar* scratch) const {
+        alignas(64) Scalar x_scratch[EXPRESSION_BLOCK];
+        alignas(64) Scalar y_scratch[EXPRESSION_BLOCK];
+        kernel(n, x.block(i, j, n, x_scratch), y.block(i, j, n, y_scratch), scratch);
+        return scratch;
+    }
+
+private:
+    BinaryKernel kernel;
+    X x;
+    Y y;
+};
+
+// kernel(x) with parameter a
+template <typename X>
+class UnaryExpression : public Expression<UnaryExpression<X> > {
+public:
+    UnaryExpression(UnaryKernel kernel, const X& x, Scalar a)
+        : kernel(kernel), x(x), a(a) {}
+
+    int rows() const { return x.rows(); }
+    int cols() const { return x.cols(); }
+    bool flat() const { return x.flat(); }
+
+    const Scalar* block(int i, ptrdiff_t j, int n, Scalar* scratch) const {
+        alignas(64) Scalar x_scratch[EXPRESSION_BLOCK];
+        kernel(n, x.block(i, j, n, x_scratch), a, scratch);
+        return scratch;
+    }
+
+private:
+    UnaryKernel kernel;
+    X x;
+    Scalar a;
+};
+
+// x(i, j) + b(i, 0)
+template <typename X>
+class ColumnExpression : public Expression<ColumnExpression<X> > {
+public:
+    ColumnExpression(const X& x, const Tensor& b) : x(x), b(b) {}
+
+    int rows() const { return x.rows(); }
+    int cols() const { return x.cols(); }
+    bool flat() const { return false; }
+
+    const Scalar* block(int i, ptrdiff_t j, int n, Scalar* scratch) const {
+        alignas(64) Scalar x_scratch[EXPRESSION_BLOCK];
+        kernels().add_scalar(n, x.block(i, j, n, x_scratch), b(i, 0), scratch);
+        return scratch;
+    }
+
+private:
+    X x;
+    Tensor b;
+};
+
+
+// Expression type of an operand: tensors, and types converted to them such
+// as Matrix and Vector, become leaves and expressions are used as they are.
+// Other types have no member and are rejected.
+template <typename T, typename Enable = void>
+struct ExpressionOf {};
+
+template <typename T>
+struct ExpressionOf<T, typename std::enable_if<!std::is_base_of<Expression<T>, T>::value &&
+                                               std::is_convertible<T, Tensor>::value>::type> {
+    typedef TensorExpression type;
+};
+
+template <typename T>
+struct ExpressionOf<T, typename std::enable_if<std::is_base_of<Expression<T>, T>::value>::type> {
+    typedef T type;
+};
+
+
+// Evaluation
+//////////////////////////////////////////////////////////////////////////////
+
+// Evaluates e into dst, which is resized with ensureShape(). dst may be one
+// of the operands of e.
+template <typename E>
+void eval_into(Tensor& dst, const Expression<E>& expression) {
+    const E& e = expression.self();
+    dst.ensureShape(e.rows(), e.cols());
+
+    if (dst.stride(1) != 1 && dst.cols() > 1) {
+        Tensor result = Tensor::allocate(dst.rows(), dst.cols());
+        eval_into(result, e);
+        dst.copyFrom(result);
+        return;
+    }
+
+    if (e.flat() && dst.isContiguous()) {
+        ptrdiff_t size = dst.size();
+        Scalar* out = dst.data();
+        #pragma omp parallel for schedule(static) if(dst.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+        for (ptrdiff_t j = 0; j < size; j += EXPRESSION_BLOCK) {
+            int n = (int)std::min<ptrdiff_t>(EXPRESSION_BLOCK, size - j);
+            const Scalar* values = e.block(-1, j, n, out + j);
+            if (values != out + j) {
+                std::copy(values, values + n, out + j);
+            }
+        }
+        return;
+    }
+
+    int rows = dst.rows();
+    int cols = dst.cols();
+    #pragma omp parallel for schedule(static) if(dst.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j += EXPRESSION_BLOCK) {
+            int n = std::min(EXPRESSION_BLOCK, cols - j);
+            Scalar* out = &dst(i, j);
+            const Scalar* values = e.block(i, j, n, out);
+            if (values != out) {
+                std::copy(values, values + n, out);
+            }
+        }
+    }
+}
+
+template <typename E>
+Tensor::Tensor(const Expression<E>& expression) : Tensor() {
+    eval_into(*this, expression);
+}
+
+template <typename E>
+Expression<E>::operator Matrix() const {
+    return Tensor(*this).toMatrix();
+}
+
+
+// Operations
+//////////////////////////////////////////////////////////////////////////////
+
+// kernel(x), e.g. elementwise(kernels().relu, x, 0.0)
+template <typename X>
+UnaryExpression<typename ExpressionOf<X>::type>
+elementwise(UnaryKernel kernel, const X& x, Scalar a) {
+    typedef typename ExpressionOf<X>::type XE;
+    return UnaryExpression<XE>(kernel, XE(x), a);
+}
+
+// kernel(x, y), e.g. elementwise(kernels().add, x, y)
+template <typename X, typename Y>
+BinaryExpression<typename ExpressionOf<X>::type, typename ExpressionOf<Y>::type>
+elementwise(BinaryKernel kernel, const X& x, const Y& y) {
+    typedef typename ExpressionOf<X>::type XE;
+    typedef typename ExpressionOf<Y>::type YE;
+    return BinaryExpression<XE, YE>(kernel, XE(x), YE(y));
+}
+
+//sums vector b with each column of the matrix M
+//Pre: M.rows() == b.rows();
+template <typename X>
+ColumnExpression<typename ExpressionOf<X>::type>
+sum(const X& M, const Tensor& b) {
+    typedef typename ExpressionOf<X>::type XE;
+    return ColumnExpression<XE>(XE(M), b);
+}
+
+template <typename X, typename Y>
+BinaryExpression<typename ExpressionOf<X>::type, typename ExpressionOf<Y>::type>
+minusM(const X& M1, const Y& M2) {
+    return elementwise(kernels().sub, M1, M2);
+}
+
+template <typename X, typename Y>
+BinaryExpression<typename ExpressionOf<X>::type, typename ExpressionOf<Y>::type>
+hadamard(const X& M1, const Y& M2) {
+    return elementwise(kernels().mul, M1, M2);
+}
+
+template <typename X>
+UnaryExpression<typename ExpressionOf<X>::type>
+product(const X& M, double a) {
+    return elementwise(kernels().scale, M, a);
+}
+
+
+#endif // EXPRESSION_H
@@ -0,0 +1,43 @@
+/*
+ * File: include/gemm.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the cache blocked general matrix multiplication engine.
+ */
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "typedefs.h"
+#include "kernels.h"
+
+
+// Work done on each tile of C as soon as its last panel has been accumulated,
+// while the tile is still in L1. In order: bias[i] is added to row i, the
+// result is copied to pre_activation (row stride ld_pre) and activation is
+// applied with activation_param. Any of the pointers may be null.
+struct GemmEpilogue {
+    const Scalar* bias;
+    Scalar* pre_activation;
+    int ld_pre;
+    UnaryKernel activation;
+    Scalar activation_param;
+};
+
+// Computes C = alpha * A * B + beta * C, where A is m x k, B is k x n and C is
+// m x n. Element (i, j) of A is a[i*rs_a + j*cs_a], and likewise for B, so
+// transposed operands are read in place. C is row-major with row stride ldc,
+// and is not read when beta is 0.
+//
+// Panels of A and B are packed into aligned buffers, blocked for the L1, L2
+// and L3 caches, and multiplied by the register-tiled micro-kernel of the
+// active instruction set. Tiles of C are distributed among OpenMP threads.
+// When epilogue is not null it is applied to every tile of C.
+void blockedGemm(int m, int n, int k, Scalar alpha,
+                 const Scalar* a, int rs_a, int cs_a,
+                 const Scalar* b, int rs_b, int cs_b,
+                 Scalar beta, Scalar* c, int ldc,
+                 const GemmEpilogue* epilogue = nullptr);
+
+
+#endif // GEMM_H
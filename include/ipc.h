@@ -0,0 +1,85 @@
+/*
+ * File: include/ipc.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the protocol spoken by the inference server and its clients.
+ */
+
+#ifndef IPC_H
+#define IPC_H
+
+#include <cstddef>
+#include <cstdint>
+#include "typedefs.h"
+
+
+// Protocol
+//////////////////////////////////////////////////////////////////////////////
+
+// A client connects to the Unix domain socket of the server, which answers
+// with a HelloMessage. The client then creates a POSIX shared memory object
+// holding a ring of slots, each with room for slot_columns samples and their
+// outputs, and sends its name in an AttachMessage. The server maps it and
+// answers with a ResponseMessage whose status is IPC_OK, after which the
+// client can unlink the name.
+//
+// To run a request, the client writes its samples, input_size values each,
+// one after another at the start of a free slot, and sends a RequestMessage.
+// The server reads them in place, writes the outputs, output_size values per
+// sample, after the inputs of the slot, and sends a ResponseMessage with the
+// same ticket. Responses may come in any order. A slot is free again once its
+// response has arrived.
+//
+// Messages are sent in the byte order of the host, which both sides share.
+
+const uint32_t IPC_MAGIC = 0x44435050;
+
+const int32_t IPC_OK = 0;
+const int32_t IPC_BAD_REQUEST = 1;
+const int32_t IPC_FAILED = 2;
+
+const size_t IPC_NAME_SIZE = 64;
+
+struct HelloMessage {
+    uint32_t magic;
+    uint32_t scalar_size;
+    uint32_t input_size;
+    uint32_t output_size;
+    uint32_t max_batch_size;
+};
+
+struct AttachMessage {
+    char name[IPC_NAME_SIZE];
+    uint32_t slots;
+    uint32_t slot_columns;
+};
+
+struct RequestMessage {
+    uint64_t ticket;
+    uint32_t slot;
+    uint32_t columns;
+};
+
+struct ResponseMessage {
+    uint64_t ticket;
+    uint32_t slot;
+    int32_t status;
+};
+
+// Scalars in each slot of the ring
+inline size_t slotScalars(const HelloMessage& hello, uint32_t slot_columns) {
+    return (size_t)slot_columns * (hello.input_size + hello.output_size);
+}
+
+// Size in bytes of the shared memory object of a ring
+inline size_t ringBytes(const HelloMessage& hello, uint32_t slots, uint32_t slot_columns) {
+    return slots * slotScalars(hello, slot_columns) * sizeof(Scalar);
+}
+
+// Send or receive exactly size bytes, retrying after partial transfers and
+// signals. Return false if the connection is closed or fails.
+bool sendAll(int fd, const void* data, size_t size);
+bool receiveAll(int fd, void* data, size_t size);
+
+
+#endif // IPC_H
@@ -0,0 +1,221 @@
+/*
+ * File: include/kernels.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the table of low level compute kernels and the runtime selection of the instruction set.
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "typedefs.h"
+
+
+// Instruction sets
+//////////////////////////////////////////////////////////////////////////////
+
+enum class Isa { Scalar, SSE2, AVX2, AVX512 };
+
+// Best instruction set supported by the CPU
+Isa detectIsa();
+
+// Instruction set used by kernels(). Defaults to detectIsa(), and can be
+// overridden with the DEEPCPP_ISA environment variable (scalar, sse2, avx2,
+// avx512) or with setIsa(). Requests above detectIsa() are lowered to it.
+Isa activeIsa();
+
+void setIsa(Isa isa);
+
+const char* isaName(Isa isa);
+
+
+// Accuracy of exp, log, erf and of the activations built on them
+//////////////////////////////////////////////////////////////////////////////
+
+enum class MathAccuracy {
+    Exact,  // libm, one element at a time
+    High,   // SIMD polynomials, relative error below 1e-7 (4e-7 in float)
+    Fast    // SIMD polynomials, relative error below 1e-4
+};
+
+// tests/test-math.cpp checks these bounds against libm for every kernel.
+
+
+// Kernels
+//////////////////////////////////////////////////////////////////////////////
+
+// out[i] = f(x[i], y[i]) for i < n
+typedef void (*BinaryKernel)(size_t n, const Scalar* x, const Scalar* y, Scalar* out);
+
+// out[i] = f(x[i]) for i < n, where a is the parameter of f if it has one
+typedef void (*UnaryKernel)(size_t n, const Scalar* x, Scalar a, Scalar* out);
+
+// Coefficients of one Adam step, computed once per step for all parameters:
+//     g = grad_scale * g
+//     m = beta1 * m + (1 - beta1) * g
+//     v = beta2 * v + (1 - beta2) * g^2
+//     w = decay * w - step_size * m / (sqrt(v) * correction2 + epsilon)
+// step_size folds the first bias correction into the learning rate,
+// correction2 is 1 / sqrt(1 - beta2^t), and decay is 1 - learn_rate *
+// weight_decay for decoupled weight decay (AdamW), 1 otherwise.
+struct AdamStep {
+    Scalar grad_scale;
+    Scalar beta1;
+    Scalar beta2;
+    Scalar step_size;
+    Scalar correction2;
+    Scalar epsilon;
+    Scalar decay;
+};
+
+// Coefficients of one SGD step:
+//     g = grad_scale * g
+//     u = momentum * u + g
+//     w = w - learn_rate * (nesterov ? g + momentum * u : u)
+// Without a velocity u, w = w - learn_rate * g.
+struct SgdStep {
+    Scalar grad_scale;
+    Scalar learn_rate;
+    Scalar momentum;
+    bool nesterov;
+};
+
+// Coefficients of one LARS step of a tensor, whose trust ratio is folded
+// into local_rate:
+//     g = grad_scale * g + weight_decay * w
+//     u = momentum * u + local_rate * g
+//     w = w - u
+struct LarsStep {
+    Scalar grad_scale;
+    Scalar weight_decay;
+    Scalar local_rate;
+    Scalar momentum;
+};
+
+// Coefficients of one LAMB step. The moments are updated like those of
+// AdamStep, and the direction of the step is
+//     r = correction1 * m / (sqrt(v) * correction2 + epsilon) + weight_decay * w
+// where correction1 is 1 / (1 - beta1^t).
+struct LambStep {
+    Scalar grad_scale;
+    Scalar beta1;
+    Scalar beta2;
+    Scalar correction1;
+    Scalar correction2;
+    Scalar epsilon;
+    Scalar weight_decay;
+};
+
+// 8-bit optimizer state is quantized in blocks of this many values, each
+// with a float scale: the largest magnitude in the block. Moments m are
+// stored as codes c in [-127, 127] standing for scale * sign(c) * (c/127)^2,
+// second moments v as codes c in [0, 255] standing for scale * (c/255)^4,
+// so small values keep their precision.
+const size_t QUANTIZATION_BLOCK = 256;
+
+struct KernelTable {
+    Isa isa;
+    MathAccuracy accuracy;
+
+    // Elementwise arithmetic. out may alias x or y.
+    BinaryKernel add;
+    BinaryKernel sub;
+    BinaryKernel mul;
+    UnaryKernel scale;          // a * x
+    UnaryKernel add_scalar;     // x + a
+
+    // Sum of x[i]^2 for i < n, accumulated in vector lanes, so the rounding
+    // depends on the vector width
+    double (*sum_squares)(size_t n, const Scalar* x);
+
+    // Optimizer steps over n parameters w with gradients g and the moments
+    // or velocity of the optimizer, updated in place. velocity may be null.
+    void (*adam_step)(size_t n, Scalar* w, const Scalar* g, Scalar* m, Scalar* v,
+                      const AdamStep& step);
+    void (*sgd_step)(size_t n, Scalar* w, const Scalar* g, Scalar* velocity,
+                     const SgdStep& step);
+
+    // adam_step over moments quantized in blocks of QUANTIZATION_BLOCK
+    // values, starting at the first value of a block. Each block is
+    // dequantized, updated and quantized again while it is in cache.
+    void (*adam_step_8bit)(size_t n, Scalar* w, const Scalar* g, int8_t* m, uint8_t* v,
+                           float* m_scales, float* v_scales, const AdamStep& step);
+
+    // Layer-wise adaptive steps. lamb_moments updates m and v and returns
+    // the sum of the squares of r, from which the trust ratio of the tensor
+    // is computed, and lamb_apply then moves w by rate * r.
+    void (*lars_step)(size_t n, Scalar* w, const Scalar* g, Scalar* u,
+                      const LarsStep& step);
+    double (*lamb_moments)(size_t n, const Scalar* w, const Scalar* g, Scalar* m,
+                           Scalar* v, const LambStep& step);
+    void (*lamb_apply)(size_t n, Scalar* w, const Scalar* m, const Scalar* v,
+                       const LambStep& step, Scalar rate);
+
+    // Activations and their derivatives. a is the slope of LeakyRelu for
+    // negative inputs and is ignored by the rest.
+    UnaryKernel relu;
+    UnaryKernel relu_derivative;
+    UnaryKernel leaky_relu;
+    UnaryKernel leaky_relu_derivative;
+    UnaryKernel sigmoid;
+    UnaryKernel sigmoid_derivative;
+    UnaryKernel tanh;
+    UnaryKernel tanh_derivative;
+    UnaryKernel sigmoid_output_derivative;  // derivative given sigmoid(x)
+    UnaryKernel tanh_output_derivative;     // derivative given tanh(x)
+    UnaryKernel gelu;                // tanh approximation
+    UnaryKernel gelu_derivative;
+    UnaryKernel gelu_erf;            // x * Phi(x), with erf
+    UnaryKernel gelu_erf_derivative;
+
+    // Transcendental functions, as chosen by accuracy
+    UnaryKernel exp;
+    UnaryKernel log;
+    UnaryKernel erf;
+
+    // Philox4x32-10 counter-based generator: writes the four words of block
+    // first + b, for b < n_blocks, to out[4*b] to out[4*b + 3]. The 128-bit
+    // counter of a block is its index in the low half and stream in the high
+    // half, and key is the 64-bit key. See include/random.h.
+    void (*philox)(size_t n_blocks, uint64_t first, uint64_t stream, uint64_t key,
+                   uint32_t* out);
+
+    // GEMM micro-kernel. Computes C = alpha * A * B + beta * C for one
+    // gemm_mr x gemm_nr tile of C with row stride ldc. Element (i, p) of the
+    // A panel is a[i*rs_a + p*cs_a], which covers both packed panels (rs_a = 1,
+    // cs_a = gemm_mr) and rows read in place. The B panel is packed as gemm_nr
+    // values per k. C is not read when beta is 0.
+    int gemm_mr;
+    int gemm_nr;
+    void (*gemm_micro)(int kc, const Scalar* a, int rs_a, int cs_a,
+                       const Scalar* b, Scalar* c, int ldc,
+                       Scalar alpha, Scalar beta);
+
+    // Matrix-vector product y = alpha * A * x + beta * y, where A is m x k
+    // with rows of stride lda, x is contiguous and y has stride incy. y is
+    // not read when beta is 0.
+    void (*gemv)(int m, int k, const Scalar* a, int lda, const Scalar* x,
+                 Scalar* y, int incy, Scalar alpha, Scalar beta);
+
+    // Cache blocking: kc x gemm_nr panels of B stay in L1, gemm_mc x kc
+    // blocks of A stay in L2 and kc x gemm_nc panels of B stay in L3.
+    int gemm_kc;
+    int gemm_mc;
+    int gemm_nc;
+};
+
+// Kernels of the active instruction set. Only the sigmoid, tanh, gelu, exp,
+// log and erf kernels depend on accuracy; the approximate ones give bitwise
+// identical results on every instruction set, like the rest.
+const KernelTable& kernels(MathAccuracy accuracy = MathAccuracy::Exact);
+
+// Kernels of each instruction set, use kernels() instead
+const KernelTable& scalarKernelTable(MathAccuracy accuracy = MathAccuracy::Exact);
+const KernelTable& sse2KernelTable(MathAccuracy accuracy = MathAccuracy::Exact);
+const KernelTable& avx2KernelTable(MathAccuracy accuracy = MathAccuracy::Exact);
+const KernelTable& avx512KernelTable(MathAccuracy accuracy = MathAccuracy::Exact);
+
+
+#endif // KERNELS_H
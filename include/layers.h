@@ -8,8 +8,12 @@
 #ifndef LAYERS_H
 #define LAYERS_H
 
-#include <random>
+#include <cstdint>
+#include <vector>
 #include "typedefs.h"
+#include "tensor.h"
+#include "kernels.h"
+#include "random.h"
 
 
 // Layers
@@ -17,117 +21,284 @@
 
 class Layer {
 protected:
-    Matrix delta;
-    Matrix input;
+    Tensor delta;
+    Tensor input;
 
     double input_size;
     double output_size;
+
+    MathAccuracy math_accuracy = MathAccuracy::Exact;
+    bool training = true;
 public:
-    virtual Matrix forward(const Matrix& input) = 0;
-    virtual Matrix backward(const Matrix& delta) = 0;
-    Matrix getDelta();
-    Matrix getInput();
+    // Write the output, or the delta for the previous layer, into a buffer
+    // owned by the caller and resized with ensureShape(). The input is kept
+    // as a shallow reference for backward, so its buffer must not be reused
+    // until then.
+    virtual void forward(const Tensor& input, Tensor& output) = 0;
+    virtual void backward(const Tensor& prev_delta, Tensor& delta_out) = 0;
+
+    // Output of forward out of training. Reads the parameters and settings
+    // but changes nothing in the layer, so any number of threads can call it
+    // at once as long as the layer is not trained or reconfigured meanwhile.
+    virtual void predict(const Tensor& input, Tensor& output) const = 0;
+
+    // Versions returning a newly allocated tensor
+    Tensor forward(const Tensor& input);
+    Tensor backward(const Tensor& prev_delta);
+
+    Tensor getDelta();
+    Tensor getInput();
     virtual Vector getGradient() { return Vector(0); }
     virtual void scaleGradient(double scale) {}
+
+    // Accuracy of the exp, tanh and erf kernels used by the layer
+    MathAccuracy getMathAccuracy() const { return math_accuracy; }
+    void setMathAccuracy(MathAccuracy accuracy) { math_accuracy = accuracy; }
+
+    // Layers that draw random numbers take them from the streams of (seed,
+    // step, layer), with step counting their forward passes from 0 again.
+    // NeuralNetwork passes each layer its index. Ignored by the rest.
+    virtual void setSeed(uint64_t seed, uint32_t layer) {}
+
+    // Seed and step of the random streams of the layer, which checkpoints
+    // save and restore. Null for layers that draw no random numbers.
+    virtual RandomState* randomState() { return nullptr; }
+
+    // Out of training, forward keeps nothing for backward, which must not be
+    // called, Dropout scales its input by keep_probability, the expected
+    // value of its training output, and NormalSampling returns mu. Leaving
+    // training releases what the last training pass kept.
+    bool isTraining() const { return training; }
+    virtual void setTraining(bool training);
 };
 
 
 class Linear : public Layer {
 private:
     // weights and biases are initialized randomly between -0.5 and 0.5
-    void initWeightsBias(Matrix & W, Vector & b);
+    void initWeightsBias(Tensor & W, Tensor & b);
 
 public:
     // Weights and biases
-    Matrix W;
-    Vector b;
+    Tensor W;
+    Tensor b;
 
     // Gradient
-    Matrix dW;
-    Vector db;
+    Tensor dW;
+    Tensor db;
 
     Linear(int input_size, int output_size);
-    Matrix forward(const Matrix& input) override;
-    Matrix backward(const Matrix& prev_delta) override;
+
+    // Layer with the given parameters, which are shared, not copied. The
+    // gradients are allocated by the first backward pass.
+    Linear(const Tensor& W, const Tensor& b);
+    friend class Dense;
+    using Layer::forward;
+    using Layer::backward;
+    void forward(const Tensor& input, Tensor& output) override;
+    void predict(const Tensor& input, Tensor& output) const override;
+    void backward(const Tensor& prev_delta, Tensor& delta_out) override;
     Vector getGradient() override;
     void scaleGradient(double scale) override;
 };
 
 
-class Sigmoid : public Layer {
-    Matrix derivative(const Matrix & input);
-public:    
-    Matrix forward(const Matrix &z) override;
-    Matrix backward(const Matrix &prev_delta) override;    
+// What an activation layer keeps from forward to compute its derivative
+enum class ActivationCache {
+    Input,   // The input, from which backward recomputes the derivative
+    Output,  // The output, from which the derivative is cheaper to compute.
+             // Costs no memory inside a NeuralNetwork, which keeps the
+             // output anyway as the input of the next layer.
+    Mask     // One bit per element. Only Relu and LeakyRelu.
 };
 
 
-class  Tanh : public Layer {
-private:
-    Matrix derivative(const Matrix & input);
+class Activation : public Layer {
+protected:
+    ActivationCache cache;
+
+    // Kept according to cache
+    Tensor output;
+    std::vector<uint64_t> mask;
+
+    explicit Activation(ActivationCache cache);
 public:
-    Matrix forward(const Matrix &z) override;
-    Matrix backward(const Matrix &prev_delta) override;
+    ActivationCache getCache() const { return cache; }
+
+    // Throws std::invalid_argument if the layer does not support cache
+    void setCache(ActivationCache cache);
+    virtual bool supportsCache(ActivationCache cache) const = 0;
+
+    void setTraining(bool training) override;
 };
 
 
-class Relu : public Layer {
-private:
-    Matrix derivative(const Matrix & input);
+// Activation computed elementwise by the kernels of KernelTable. Can be
+// fused with a preceding Linear layer into a Dense layer.
+class KernelActivation : public Activation {
 public:
-    Matrix forward(const Matrix &z) override;
-    Matrix backward(const Matrix &prev_delta) override;
+    // Which elements the Mask cache marks, as in packMask()
+    enum MaskRule { NoMask, Positive, NonNegative };
+
+    UnaryKernel KernelTable::* const function;
+    UnaryKernel KernelTable::* const derivative;
+    // Derivative as a function of the output, or null if there is none
+    UnaryKernel KernelTable::* const output_derivative;
+    const MaskRule mask_rule;
+
+    // Parameter passed to the kernels
+    virtual Scalar parameter() const { return 0; }
+
+    bool supportsCache(ActivationCache cache) const override;
+
+    using Layer::forward;
+    using Layer::backward;
+    void forward(const Tensor& input, Tensor& output) override;
+    void predict(const Tensor& input, Tensor& output) const override;
+    void backward(const Tensor& prev_delta, Tensor& delta_out) override;
+
+protected:
+    KernelActivation(UnaryKernel KernelTable::* function,
+                     UnaryKernel KernelTable::* derivative,
+                     UnaryKernel KernelTable::* output_derivative,
+                     MaskRule mask_rule,
+                     ActivationCache cache);
 };
 
 
-class  LeakyRelu : public Layer {
-private:
-    Matrix derivative(const Matrix & input);
+class Sigmoid : public KernelActivation {
+public:
+    Sigmoid(ActivationCache cache = ActivationCache::Output);
+};
+
+
+class  Tanh : public KernelActivation {
+public:
+    Tanh(ActivationCache cache = ActivationCache::Output);
+};
+
+
+class Relu : public KernelActivation {
+public:
+    Relu(ActivationCache cache = ActivationCache::Input);
+};
+
+
+// The Output and Mask caches assume alpha > 0
+class  LeakyRelu : public KernelActivation {
 public:
     double alpha;
-    LeakyRelu(double alpha);
-    Matrix forward(const Matrix &z) override;
-    Matrix backward(const Matrix &prev_delta) override;
+    LeakyRelu(double alpha, ActivationCache cache = ActivationCache::Input);
+    Scalar parameter() const override { return alpha; }
 };
 
 
-class  SoftMax : public Layer {
+// Normalizes each column. To train a classifier, end the network with the
+// logits and use the SoftmaxCrossEntropy loss instead, and add this layer
+// only for inference.
+class  SoftMax : public Activation {
 private:
-    Matrix derivative(const Matrix & input);
+    // Maximum and sum of each column
+    Tensor column_max;
+    Tensor column_sum;
+
+    // Softmax of each column of input, with the maximum and sum of each
+    // column computed in column_max and column_sum
+    void normalize(const Tensor & input, Tensor & output,
+                   Tensor & column_max, Tensor & column_sum) const;
+    void derivative(const Tensor & input, Tensor & out);
 public:
-    Matrix forward(const Matrix &z) override;
-    Matrix backward(const Matrix &prev_delta) override;
+    SoftMax(ActivationCache cache = ActivationCache::Input);
+    bool supportsCache(ActivationCache cache) const override;
+    using Layer::forward;
+    using Layer::backward;
+    void forward(const Tensor& z, Tensor& output) override;
+    void predict(const Tensor& input, Tensor& output) const override;
+    void backward(const Tensor& prev_delta, Tensor& delta_out) override;
 };
 
 
-class Gelu : public Layer {
-private:
-    Matrix derivative(const Matrix & input);
+// x * Phi(x), where Phi is the standard normal CDF. Tanh uses the usual tanh
+// approximation of Phi and Erf computes it exactly. Only supports the Input
+// cache.
+class Gelu : public KernelActivation {
 public:
-    Matrix forward(const Matrix &z) override;
-    Matrix backward(const Matrix &prev_delta) override;
+    enum Formula { Tanh, Erf };
+
+    const Formula formula;
+    Gelu(Formula formula = Tanh, ActivationCache cache = ActivationCache::Input);
 };
 
 
+// Keeps each element with probability keep_probability. The mask is one bit
+// per element, drawn in parallel from the layer's RandomStream. Kept elements
+// are not scaled, so out of training the input is scaled by keep_probability
+// instead to keep the expected output.
 class Dropout : public Layer {
 private:
-    Matrix mask;
+    std::vector<uint64_t> mask;
     double keep_probability;
-    std::default_random_engine generator;
+    RandomState random;
 public:
     Dropout(double keep_probability_);
-    Matrix forward(const Matrix& input) override;
-    Matrix backward(const Matrix& prev_delta) override;
+    double getKeepProbability() const { return keep_probability; }
+    using Layer::forward;
+    using Layer::backward;
+    void forward(const Tensor& input, Tensor& output) override;
+    void predict(const Tensor& input, Tensor& output) const override;
+    void backward(const Tensor& prev_delta, Tensor& delta_out) override;
+    void setSeed(uint64_t seed, uint32_t layer) override;
+    RandomState* randomState() override { return &random; }
+    void setTraining(bool training) override;
+};
+
+
+// Linear layer followed by a KernelActivation, run as one: the bias and the
+// activation are applied by the GEMM epilogue, so the pre-activation is never
+// read back in forward, and only written when the activation caches its
+// input. Shares the parameters and gradients of the Linear layer and the
+// settings of the activation. Built by fuseLayers().
+class Dense : public Layer {
+private:
+    shared_ptr<Linear> linear;
+    shared_ptr<KernelActivation> activation;
+
+    Tensor pre_activation;
+    Tensor pre_activation_delta;
+    Tensor output;
+    std::vector<uint64_t> mask;
+public:
+    Dense(const shared_ptr<Linear>& linear,
+          const shared_ptr<KernelActivation>& activation);
+
+    using Layer::forward;
+    using Layer::backward;
+    void forward(const Tensor& input, Tensor& output) override;
+    void predict(const Tensor& input, Tensor& output) const override;
+    void backward(const Tensor& prev_delta, Tensor& delta_out) override;
+    void setTraining(bool training) override;
 };
 
 
+// Splits the input into mu and log_var halves and samples
+// mu + exp(log_var / 2) * epsilon, with epsilon drawn in parallel from the
+// layer's RandomStream. Out of training the output is mu.
 class NormalSampling : public Layer {
 private:
-    Matrix mu;
-    Matrix log_var;
+    Tensor mu;
+    Tensor log_var;
+    Tensor std_dev;
+    Tensor epsilon;
+    RandomState random;
 public:
-    Matrix forward(const Matrix& input) override;
-    Matrix backward(const Matrix& prev_delta) override;
+    using Layer::forward;
+    using Layer::backward;
+    void forward(const Tensor& input, Tensor& output) override;
+    void predict(const Tensor& input, Tensor& output) const override;
+    void backward(const Tensor& prev_delta, Tensor& delta_out) override;
+    void setSeed(uint64_t seed, uint32_t layer) override;
+    RandomState* randomState() override { return &random; }
+    void setTraining(bool training) override;
 };
 
 
@@ -8,31 +8,95 @@
 #ifndef LOSSES_H
 #define LOSSES_H
 #include "typedefs.h"
+#include "tensor.h"
+
+// Throws std::invalid_argument unless labels holds one class per column of
+// A, each a row of A. Every loss taking labels checks them with it.
+void checkLabels(const Tensor &A, const vector<int> &labels);
+
 // Loss Functions
 //////////////////////////////////////////////////////////////////////////////
 
 class LossFunction {
 public:
-    virtual double compute(const Matrix &A, const Matrix &Y) const = 0;
-    virtual Matrix backward(const Matrix &A, const Matrix &Y) const = 0;
+    virtual double compute(const Tensor &A, const Tensor &Y) const = 0;
+
+    // Writes the gradient of the loss with respect to A into dA, which is
+    // resized with ensureShape()
+    virtual void backward(const Tensor &A, const Tensor &Y, Tensor &dA) const = 0;
+    Tensor backward(const Tensor &A, const Tensor &Y) const;
+
+    // Classification losses also take the class of each column instead of
+    // one-hot targets. The others throw std::invalid_argument.
+    virtual double compute(const Tensor &A, const vector<int> &labels) const;
+    virtual void backward(const Tensor &A, const vector<int> &labels, Tensor &dA) const;
+
+    // Returns the loss and writes its gradient into dA, like compute() and
+    // backward() together but reading A and the targets once. The losses in
+    // this file do it in a single parallel pass whose result does not depend
+    // on the number of threads. The default calls backward() and compute().
+    virtual double computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const;
+    virtual double computeWithGradient(const Tensor &A, const vector<int> &labels,
+                                       Tensor &dA) const;
 };
 
 class CrossEntropy : public LossFunction {
 public:
-    double compute(const Matrix &A, const Matrix &Y) const override;
-    Matrix backward(const Matrix &A, const Matrix &Y) const override;
+    using LossFunction::compute;
+    using LossFunction::backward;
+    using LossFunction::computeWithGradient;
+    double compute(const Tensor &A, const Tensor &Y) const override;
+    void backward(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
+    double compute(const Tensor &A, const vector<int> &labels) const override;
+    void backward(const Tensor &A, const vector<int> &labels, Tensor &dA) const override;
+    double computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
+    double computeWithGradient(const Tensor &A, const vector<int> &labels,
+                               Tensor &dA) const override;
+};
+
+// Softmax followed by cross entropy, computed from the logits A, so that the
+// network ends in its last Linear layer rather than in a SoftMax layer. Uses
+// log-sum-exp, so large logits do not overflow, and the gradient is
+// softmax(A) - Y. Classes are rows and each column of Y must sum to 1. With
+// labels, the one-hot targets are never built: the gradient is softmax(A)
+// with 1 subtracted at each label.
+class SoftmaxCrossEntropy : public LossFunction {
+public:
+    using LossFunction::compute;
+    using LossFunction::backward;
+    using LossFunction::computeWithGradient;
+    double compute(const Tensor &A, const Tensor &Y) const override;
+    void backward(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
+    double compute(const Tensor &A, const vector<int> &labels) const override;
+    void backward(const Tensor &A, const vector<int> &labels, Tensor &dA) const override;
+    double computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
+    double computeWithGradient(const Tensor &A, const vector<int> &labels,
+                               Tensor &dA) const override;
+
+private:
+    // Returns the loss and, unless dA is null, writes the gradient into it.
+    // The targets are Y or labels, whichever is not null.
+    double evaluate(const Tensor &A, const Tensor *Y, const int *labels, Tensor *dA) const;
 };
 
 class BinaryCrossEntropy : public LossFunction {
 public:
-    double compute(const Matrix &A, const Matrix &Y) const override;
-    Matrix backward(const Matrix &A, const Matrix &Y) const override;
+    using LossFunction::compute;
+    using LossFunction::backward;
+    using LossFunction::computeWithGradient;
+    double compute(const Tensor &A, const Tensor &Y) const override;
+    void backward(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
+    double computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
 };
 
 class MeanSquaredError : public LossFunction {
 public:
-    double compute(const Matrix &A, const Matrix &Y) const override;
-    Matrix backward(const Matrix &A, const Matrix &Y) const override;
+    using LossFunction::compute;
+    using LossFunction::backward;
+    using LossFunction::computeWithGradient;
+    double compute(const Tensor &A, const Tensor &Y) const override;
+    void backward(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
+    double computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const override;
 };
 
 
@@ -0,0 +1,64 @@
+/*
+ * File: include/model.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the binary model file format.
+ */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "typedefs.h"
+#include "layers.h"
+#include "NNUtils.h"
+
+
+// Model files
+//////////////////////////////////////////////////////////////////////////////
+
+// A model file holds the layers of a network, with their settings and
+// parameters, in the byte order and precision of the host that wrote it:
+//
+//     Header       64 bytes: magic "DCPPMODL", format version, sizeof(Scalar),
+//                  number of layers, offset and size of the data, and the
+//                  CRC-32C of the layer records, of the data and of the
+//                  header itself
+//     Layers       One 64-byte record per layer: its type, activation cache,
+//                  math accuracy, GELU formula, LeakyRelu alpha or Dropout
+//                  keep probability, and for Linear layers the shape and
+//                  offsets of W and b
+//     Data         W and b of every Linear layer, row by row, each starting
+//                  at a multiple of 64 bytes
+//
+// Fused Dense layers are stored as the Linear and activation layers they were
+// built from. Random seeds, losses and optimizers are not stored.
+
+const uint32_t MODEL_VERSION = 1;
+
+// Writes the layers to file_name. Throws std::runtime_error if it cannot,
+// and std::invalid_argument for a layer type the format does not know.
+void saveModel(const vector<shared_ptr<Layer>>& layers, const string& file_name);
+void saveModel(const NeuralNetwork& network, const string& file_name);
+
+// Layers stored in file_name, whose parameters are views of a private memory
+// mapping of the file and are used in place: nothing is copied when loading,
+// and processes mapping the same file share its pages in the page cache until
+// they write to them. The mapping lives as long as any of the tensors.
+//
+// The header and the layer records are always checked. Checking the data
+// reads the whole file, so it can be skipped with verify_data = false when
+// the file is trusted and startup time matters. Throws std::runtime_error for
+// a file that cannot be read, is corrupt, has another version, or was written
+// with another precision.
+vector<shared_ptr<Layer>> mapModel(const string& file_name, bool verify_data = true);
+
+// Same with the parameters copied out of the file, into tensors of their own
+// that can be trained
+vector<shared_ptr<Layer>> loadModel(const string& file_name);
+
+
+#endif // MODEL_H
@@ -7,37 +7,256 @@
 
 #include "layers.h"
 #include "typedefs.h"
+#include "tensor.h"
+#include <cstdint>
 #include <map>
 
+// A contiguous run of parameters, their gradients and up to two tensors of
+// optimizer state of the same size. decay marks the weights, as opposed to
+// the biases.
+struct Segment {
+    Scalar* w;
+    const Scalar* g;
+    Scalar* s1;
+    Scalar* s2;
+    size_t n;
+    bool decay;
+};
+
+// Piece of segment of at most ELEMENTWISE_PARALLEL_THRESHOLD values. Pieces
+// of all the segments of a step run in parallel, so the layers are swept
+// together instead of one after another.
+struct Chunk {
+    size_t segment;
+    size_t begin;
+    size_t end;
+};
+
+// The layers of a step, their segments and the chunks these are split into,
+// kept by an optimizer from one step to the next so that steps allocate
+// nothing. The segments are refilled every step, as the buffers of the
+// parameters can move, and only split again when their sizes change.
+template <typename S>
+struct SweepPlan {
+    vector<Linear*> layers;
+    vector<S> segments;
+    vector<Chunk> chunks;
+
+    // Sizes of the segments the chunks were split for, and their sum
+    vector<size_t> sizes;
+    size_t total = 0;
+};
+
 class Optimizer {
 public:
+    // Updates the parameters of one layer with its gradients
     virtual void update(Linear& layer, double learn_rate, int batch_size) = 0;
+
+    // One step of all the layers of a network, which is what
+    // NeuralNetwork::update() calls. Updates them one by one unless the
+    // optimizer overrides it; Adam and SGD sweep all the parameters at once.
+    virtual void update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                        int batch_size);
+
     virtual void initialize(const Linear& layer) {};
+
+    // State kept between updates, which checkpoints save and restore: the
+    // tensors kept for layer, sharing their buffers, and the number of
+    // updates done
+    virtual vector<Tensor> getState(const Linear& layer) { return vector<Tensor>(); }
+    virtual uint64_t getStep() const { return 0; }
+    virtual void setStep(uint64_t step) {}
 };
 
+// Adam updates every parameter and both of its moments in one vectorized
+// pass over all the layers, with the bias corrections computed once per step.
+// weight_decay is decoupled from the gradient, as in AdamW, and only applied
+// to W.
 class Adam : public Optimizer {
 public:
-    Adam(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
+    Adam(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8,
+         double weight_decay = 0);
+
+    using Optimizer::update;
+    void initialize(const Linear& layer) override;
+
+    // Counts one step per call, while the overload for all the layers counts
+    // one for all of them
+    void update(Linear& layer, double learn_rate, int batch_size) override;
+    void update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                int batch_size) override;
+
+    // mW, mb, vW and vb
+    vector<Tensor> getState(const Linear& layer) override;
+    uint64_t getStep() const override { return t; }
+    void setStep(uint64_t step) override { t = step; }
+
+protected:
+    struct OptimizationState {
+        Tensor mW;
+        Tensor mb;
+        Tensor vW;
+        Tensor vb;
+    };
+
+    double beta1;
+    double beta2;
+    double epsilon;
+    double weight_decay;
+    uint64_t t;
+    std::map<const Linear*, OptimizationState> optimization_states;
+    SweepPlan<Segment> plan;
+
+    // Updates of the public overloads, one step for all of layers
+    virtual void step(const vector<Linear*>& layers, double learn_rate, int batch_size);
+    OptimizationState& stateOf(const Linear& layer);
+};
+
+// Adam with decoupled weight decay (Loshchilov and Hutter)
+class AdamW : public Adam {
+public:
+    AdamW(double weight_decay = 0.01, double beta1 = 0.9, double beta2 = 0.999,
+          double epsilon = 1e-8);
+};
+
+// Adam whose moments are quantized to 8 bits in blocks of
+// QUANTIZATION_BLOCK values with a scale each, see kernels.h, and
+// dequantized on the fly by the update kernel. They take 2 bytes per
+// parameter instead of 2 * sizeof(Scalar), and track full precision Adam
+// closely; bin/optimizer-comparison compares both on MNIST.
+class Adam8bit : public Optimizer {
+public:
+    Adam8bit(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8,
+             double weight_decay = 0);
 
+    using Optimizer::update;
     void initialize(const Linear& layer) override;
     void update(Linear& layer, double learn_rate, int batch_size) override;
+    void update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                int batch_size) override;
+
+    // The codes and scales of the moments of W and of b, each packed into
+    // one column tensor whose bytes are not scalars
+    vector<Tensor> getState(const Linear& layer) override;
+    uint64_t getStep() const override { return t; }
+    void setStep(uint64_t step) override { t = step; }
 
 private:
+    // Codes of m and v for n values, then the scales of their blocks, in
+    // the buffer of storage
+    struct QuantizedMoments {
+        Tensor storage;
+        size_t n;
+
+        explicit QuantizedMoments(size_t n = 0);
+        int8_t* m();
+        uint8_t* v();
+        float* m_scales();
+        float* v_scales();
+    };
+
     struct OptimizationState {
-        Matrix mW;
-        Vector mb;
-        Matrix vW;
-        Vector vb;
+        QuantizedMoments W;
+        QuantizedMoments b;
+    };
+
+    // Segment whose moments are quantized
+    struct QuantizedSegment {
+        Scalar* w;
+        const Scalar* g;
+        QuantizedMoments* moments;
+        size_t n;
+        bool decay;
     };
 
     double beta1;
     double beta2;
     double epsilon;
-    int t;
+    double weight_decay;
+    uint64_t t;
     std::map<const Linear*, OptimizationState> optimization_states;
+    SweepPlan<QuantizedSegment> plan;
+
+    void step(const vector<Linear*>& layers, double learn_rate, int batch_size);
 };
 
+// Plain SGD when momentum is 0, which keeps no state. Otherwise SGD with
+// momentum, or Nesterov momentum if nesterov is set.
 class SGD : public Optimizer {
 public:
+    SGD(double momentum = 0, bool nesterov = false);
+
+    using Optimizer::update;
+    void initialize(const Linear& layer) override;
     void update(Linear& layer, double learn_rate, int batch_size) override;
-};
\ No newline at end of file
+    void update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                int batch_size) override;
+
+    // The velocities of W and b, if any
+    vector<Tensor> getState(const Linear& layer) override;
+
+protected:
+    struct Velocity {
+        Tensor vW;
+        Tensor vb;
+    };
+
+    double momentum;
+    bool nesterov;
+    std::map<const Linear*, Velocity> velocities;
+    SweepPlan<Segment> plan;
+
+    virtual void step(const vector<Linear*>& layers, double learn_rate, int batch_size);
+    Velocity& velocityOf(const Linear& layer);
+};
+
+
+// Layer-wise adaptive optimizers, for training with large batches. Each
+// weight matrix gets its own trust ratio, computed every step from its norm
+// and the norm of its update, so that every layer moves by a similar
+// fraction of its weights however large the batch, and the learning rate
+// can grow with the batch size. They are usually run with a warmup, see
+// WarmupLR. Biases are updated with the learning rate as is, without weight
+// decay.
+
+// LARS (You et al., "Large batch training of convolutional networks"): SGD
+// with momentum whose learning rate for W is scaled by
+//     trust_coefficient * ||W|| / (||dW|| + weight_decay * ||W||)
+// with dW averaged over the batch
+class LARS : public SGD {
+public:
+    LARS(double momentum = 0.9, double weight_decay = 1e-4,
+         double trust_coefficient = 0.001);
+
+    // Velocities are kept even without momentum
+    void initialize(const Linear& layer) override;
+
+protected:
+    double weight_decay;
+    double trust_coefficient;
+
+    // Squared norms and step of each segment, kept to reuse their buffers
+    vector<double> w_squares;
+    vector<double> g_squares;
+    vector<LarsStep> steps;
+
+    void step(const vector<Linear*>& layers, double learn_rate, int batch_size) override;
+};
+
+// LAMB (You et al., "Large batch optimization for deep learning"): AdamW
+// whose step for W, the Adam direction plus weight decay r, is scaled by
+// ||W|| / ||r||
+class LAMB : public Adam {
+public:
+    LAMB(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-6,
+         double weight_decay = 0.01);
+
+protected:
+    // Squared norms and learning rate of each segment, kept to reuse their
+    // buffers
+    vector<double> r_squares;
+    vector<double> w_squares;
+    vector<Scalar> rates;
+
+    void step(const vector<Linear*>& layers, double learn_rate, int batch_size) override;
+};
@@ -0,0 +1,57 @@
+/*
+ * File: include/random.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the counter-based random number streams used by the stochastic layers.
+ */
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "typedefs.h"
+
+
+// Random streams
+//////////////////////////////////////////////////////////////////////////////
+
+// Random numbers of one layer at one step, from the Philox4x32-10 kernel of
+// kernels(). Each block of the generator gives four 32-bit words, and block k
+// is a function of (seed, step, layer, k) only. Blocks are generated in
+// parallel and in any order, so the numbers do not depend on the number of
+// threads, and a stream can be replayed from its three coordinates. Only the
+// low 32 bits of step are used.
+class RandomStream {
+public:
+    RandomStream(uint64_t seed, uint64_t step, uint32_t layer);
+
+    // Words 4 * first to 4 * (first + n_blocks) - 1
+    void words(uint64_t first, size_t n_blocks, uint32_t* out) const;
+
+    // Packs n bits into mask, 64 per word, each set with probability p. Bit k
+    // comes from word k of the stream.
+    void bernoulli(size_t n, double p, std::vector<uint64_t>& mask) const;
+
+    // Fills out with n values from the standard normal distribution, by the
+    // Box-Muller transform of words 2i and 2i + 1 into values 2i and 2i + 1
+    void normal(size_t n, Scalar* out) const;
+
+private:
+    uint64_t key;
+    uint64_t stream;
+};
+
+// Seed of a stochastic layer and the step it is at. Every forward pass draws
+// from next(), so each pass gets its own stream.
+struct RandomState {
+    uint64_t seed = 0;
+    uint64_t step = 0;
+    uint32_t layer = 0;
+
+    RandomStream next() { return RandomStream(seed, step++, layer); }
+};
+
+
+#endif // RANDOM_H
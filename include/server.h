@@ -0,0 +1,71 @@
+/*
+ * File: include/server.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the inference server that serves a network over a Unix domain socket.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "typedefs.h"
+#include "ipc.h"
+#include "batcher.h"
+
+
+// Inference server
+//////////////////////////////////////////////////////////////////////////////
+
+// Serves network to the processes of the host, with the protocol of ipc.h.
+// The samples of every client are read in place from their shared memory and
+// run through one RequestBatcher.
+class InferenceServer {
+public:
+    // Listens on socket_path, replacing any socket left there. Throws
+    // std::runtime_error if it cannot.
+    InferenceServer(const shared_ptr<const NeuralNetwork>& network,
+                    int input_size,
+                    const std::string& socket_path,
+                    const BatcherOptions& options = BatcherOptions());
+
+    // Closes every connection and removes the socket
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    // Accepts clients until stop() is called
+    void run();
+
+    // Makes run() return within a few hundred milliseconds. Safe to call from
+    // a signal handler.
+    void stop();
+
+    BatcherStats getStats() const { return batcher.getStats(); }
+
+private:
+    struct Connection;
+
+    std::string socket_path;
+    int listen_fd;
+    HelloMessage hello;
+    std::atomic<bool> stopping;
+
+    RequestBatcher batcher;
+    std::list<shared_ptr<Connection>> connections;
+
+    // Threads of one connection
+    void handshake(Connection& connection);
+    void receive(Connection& connection);
+    void respond(Connection& connection);
+
+    void closeFinished();
+};
+
+
+#endif // SERVER_H
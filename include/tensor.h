@@ -0,0 +1,125 @@
+/*
+ * File: include/tensor.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the Tensor class, a strided view over a single aligned buffer.
+ */
+
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include <cstddef>
+#include <memory>
+#include "typedefs.h"
+
+template <typename E>
+class Expression;
+
+
+// Tensor
+//////////////////////////////////////////////////////////////////////////////
+
+// Two dimensional tensor whose elements live in one contiguous, 64-byte
+// aligned buffer. Element (i, j) is found at data()[i*stride(0) + j*stride(1)].
+//
+// Copies are shallow: copying a Tensor, or taking a view with t(), rowSlice()
+// or colSlice(), shares the underlying buffer. Use clone() to get an
+// independent copy.
+class Tensor {
+public:
+    static const size_t ALIGNMENT = 64;
+
+    Tensor();
+    Tensor(int rows, int cols, Scalar value = 0.0);
+
+    // Compatibility with the nested vector representation. Throws
+    // std::invalid_argument if the rows of M have different lengths.
+    Tensor(const Matrix& M);
+    Tensor(const Vector& v);
+    operator Matrix() const;
+    Matrix toMatrix() const;
+    Vector toVector() const;
+
+    // Evaluates an expression of elementwise operations into a new tensor,
+    // see include/expression.h
+    template <typename E>
+    Tensor(const Expression<E>& expression);
+
+    // Tensor whose elements are left uninitialized
+    static Tensor allocate(int rows, int cols);
+
+    // Tensor over rows x cols elements stored row by row at storage.get(),
+    // such as a memory mapping, which is shared instead of copied. The
+    // aliasing constructor of shared_ptr can tie it to the owner of the
+    // memory.
+    static Tensor wrap(const shared_ptr<Scalar>& storage, int rows, int cols);
+
+    // Empty tensor whose buffer ensureShape() reshapes in place for any shape
+    // that fits in it, and only grows, so an output buffer reused across calls
+    // with different shapes stops allocating once it has held the largest one.
+    // Only for buffers with a single owner: a copy shares the buffer and is
+    // reshaped over it too. Views taken with t(), view() or the slices are
+    // plain tensors.
+    static Tensor growable();
+
+    // Makes this tensor rows x cols. The current buffer is kept, and written
+    // through, when the shape already matches, or for a growable() tensor when
+    // it fits; otherwise a new uninitialized buffer is allocated. Output
+    // buffers reused across calls are sized this way.
+    void ensureShape(int rows, int cols);
+
+    int rows() const { return n_rows; }
+    int cols() const { return n_cols; }
+    int stride(int dim) const { return dim == 0 ? row_stride : col_stride; }
+    size_t size() const { return (size_t)n_rows * n_cols; }
+    bool empty() const { return size() == 0; }
+
+    // True if the elements are stored row by row without gaps
+    bool isContiguous() const;
+    bool sameShape(const Tensor& other) const;
+
+    Scalar* data() { return ptr; }
+    const Scalar* data() const { return ptr; }
+
+    Scalar& operator()(int i, int j) {
+        return ptr[(ptrdiff_t)i * row_stride + (ptrdiff_t)j * col_stride];
+    }
+    const Scalar& operator()(int i, int j) const {
+        return ptr[(ptrdiff_t)i * row_stride + (ptrdiff_t)j * col_stride];
+    }
+
+    // Linear indexing, only valid for contiguous tensors
+    Scalar& operator[](size_t i) { return ptr[i]; }
+    const Scalar& operator[](size_t i) const { return ptr[i]; }
+
+    // Zero-copy views
+    Tensor t() const;
+    Tensor rowSlice(int begin, int end) const;
+    Tensor colSlice(int begin, int end) const;
+
+    // rows x cols tensor over the elements of this contiguous tensor from
+    // offset on, taken row by row
+    Tensor view(size_t offset, int rows, int cols) const;
+
+    Tensor clone() const;
+    void fill(Scalar value);
+
+    // Copies the elements of other, which must have the same shape
+    void copyFrom(const Tensor& other);
+
+private:
+    shared_ptr<Scalar> storage;
+    Scalar* ptr;
+    int n_rows;
+    int n_cols;
+    int row_stride;
+    int col_stride;
+
+    // Whether ensureShape() reuses the buffer, of capacity elements, for
+    // other shapes, see growable()
+    bool grows;
+    size_t capacity;
+};
+
+
+#endif // TENSOR_H
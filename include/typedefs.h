@@ -11,7 +11,16 @@
 #include <vector>
 using namespace std;
 
-typedef vector<vector<double>> Matrix;
-typedef vector<double> Vector;
+// Floating point type of every tensor, kernel and parameter. Double is the
+// default and the reference for validation; build with PRECISION=float to
+// halve the memory traffic and double the SIMD width.
+#ifdef DEEPCPP_FLOAT32
+typedef float Scalar;
+#else
+typedef double Scalar;
+#endif
+
+typedef vector<vector<Scalar>> Matrix;
+typedef vector<Scalar> Vector;
 
 #endif // TYPEDEFS_H
\ No newline at end of file
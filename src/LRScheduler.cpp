@@ -51,4 +51,17 @@ double Triangular2CyclicLR::getLearningRate(int iteration) {
            std::max(0.0, (double)(1 - x)) / std::pow(2, cycle - 1);
 
     return lr;
-}
\ No newline at end of file
+}
+
+
+WarmupLR::WarmupLR(const std::shared_ptr<LearningRateScheduler>& schedule,
+                   int warmup_length)
+    : schedule(schedule), warmup_length(warmup_length) {}
+
+double WarmupLR::getLearningRate(int epoch) {
+    double lr = schedule->getLearningRate(epoch);
+    if (epoch < warmup_length) {
+        lr *= (double)(epoch + 1) / warmup_length;
+    }
+    return lr;
+}
@@ -6,9 +6,12 @@
  */
 
 #include <iostream>
+#include <set>
+#include <stdexcept>
 #include "NNUtils.h"
 #include "losses.h"
 #include "layers.h"
+#include "elementwise.h"
 
 
 
@@ -18,66 +21,330 @@
 
 NeuralNetwork::NeuralNetwork(const std::vector<std::shared_ptr<Layer>>& layers_,
                              const std::shared_ptr<LossFunction>& loss_,
-                             const std::shared_ptr<Optimizer>& optimizer_)
-    : layers(layers_), loss(loss_), optimizer(optimizer_) {
+                             const std::shared_ptr<Optimizer>& optimizer_,
+                             bool fuse)
+    : layers(layers_), loss(loss_), optimizer(optimizer_), training(true),
+      execution_layers(fuse ? fuseLayers(layers_) : layers_),
+      activations(execution_layers.size()), deltas(execution_layers.size()),
+      packed(false) {
+
+    softmax_cross_entropy = !execution_layers.empty() &&
+        std::dynamic_pointer_cast<SoftMax>(execution_layers.back()) &&
+        std::dynamic_pointer_cast<CrossEntropy>(loss);
 
+    // Layers listed twice share their parameters, and are updated once
+    std::set<const Linear*> seen;
     for (auto& layer : layers) {
         auto linear_layer = std::dynamic_pointer_cast<Linear>(layer);
-        if (linear_layer) {
+        if (linear_layer && seen.insert(linear_layer.get()).second) {
+            linear_layers.push_back(linear_layer);
             optimizer->initialize(*linear_layer);
         }
     }
+
+    setSeed(0);
+}
+
+
+
+void NeuralNetwork::setMathAccuracy(MathAccuracy accuracy) {
+    for (auto& layer : layers) {
+        layer->setMathAccuracy(accuracy);
+    }
+    for (auto& layer : execution_layers) {
+        layer->setMathAccuracy(accuracy);
+    }
+}
+
+
+
+void NeuralNetwork::setSeed(uint64_t seed) {
+    for (size_t i = 0; i < layers.size(); i++) {
+        layers[i]->setSeed(seed, i);
+    }
+}
+
+
+
+void NeuralNetwork::train() {
+    setTraining(true);
 }
 
 
 
-Matrix NeuralNetwork::forward(const Matrix& input) {
+void NeuralNetwork::eval() {
+    setTraining(false);
+}
+
+
 
-    Matrix current_input = input;
+void NeuralNetwork::setTraining(bool training_) {
+    training = training_;
 
     for (auto& layer : layers) {
-        current_input = layer->forward(current_input);
-        
+        layer->setTraining(training);
+    }
+    for (auto& layer : execution_layers) {
+        layer->setTraining(training);
+    }
+
+    // Each mode keeps its own buffers
+    output = Tensor();
+    if (training) {
+        eval_context = InferenceContext();
+    } else {
+        for (size_t i = 0; i < activations.size(); i++) {
+            activations[i] = Tensor();
+            deltas[i] = Tensor();
+        }
+        loss_delta = Tensor();
+    }
+}
+
+
+
+Tensor NeuralNetwork::forward(const Tensor& input) {
+
+    if (!training) {
+        output = predict(input, eval_context);
+        return output;
     }
 
-    return current_input;
+    const Tensor* current_input = &input;
+
+    for (size_t i = 0; i < execution_layers.size(); i++) {
+        execution_layers[i]->forward(*current_input, activations[i]);
+        current_input = &activations[i];
+    }
+
+    output = *current_input;
+    return output;
 }
 
 
 
-Matrix NeuralNetwork::backward(const Matrix & output, const Matrix& expected_output) {
+Tensor NeuralNetwork::predict(const Tensor& input, InferenceContext& context) const {
+
+    const Tensor* current_input = &input;
+
+    // No layer keeps its input, so the output of layer i can overwrite the
+    // input of layer i - 1. The first layer writes to the buffer the input is
+    // not in, in case it is a previous output.
+    int first_buffer = input.data() != nullptr &&
+                       input.data() == context.buffers[0].data();
+
+    for (size_t i = 0; i < execution_layers.size(); i++) {
+        Tensor& current_output = context.buffers[(i + first_buffer) % 2];
+        execution_layers[i]->predict(*current_input, current_output);
+        current_input = &current_output;
+    }
+
+    // A view, so that copies of the result do not reshape the buffer
+    context.output = current_input == &input ? input
+                   : current_input->view(0, current_input->rows(), current_input->cols());
+    return context.output;
+}
+
+
+
+Tensor NeuralNetwork::predict(const Tensor& input) const {
+    InferenceContext context;
+    return predict(input, context);
+}
+
+
+
+Tensor NeuralNetwork::backward(const Tensor & output, const Tensor& expected_output) {
+
+    if (!training) {
+        throw std::logic_error("NeuralNetwork: backward in eval mode");
+    }
 
     // If the combination of last layer and loss is softmax and crossentropy the
     // process is optimized using the difference between the output and expected
-    // output, it then skips the last layer and loss.
+    // output, it then skips the last layer and loss. SoftmaxCrossEntropy does
+    // the same from the logits, without a SoftMax layer.
 
-    bool is_softmax_cross_entropy = 
-        std::dynamic_pointer_cast<SoftMax>(layers.back()) && 
-        std::dynamic_pointer_cast<CrossEntropy>(loss);
-    
-    Matrix delta = is_softmax_cross_entropy 
-                   ? minusM(output,expected_output)
-                   : loss->backward(output, expected_output);
-    
+    if (softmax_cross_entropy) {
+        minusM_into(loss_delta, output, expected_output);
+    } else {
+        loss->backward(output, expected_output, loss_delta);
+    }
+
+    return backpropagate();
+}
+
+
+
+Tensor NeuralNetwork::backward(const Tensor & output, const vector<int>& labels) {
+
+    if (!training) {
+        throw std::logic_error("NeuralNetwork: backward in eval mode");
+    }
+
+    if (softmax_cross_entropy) {
+        // output - one_hot(labels)
+        checkLabels(output, labels);
+        loss_delta.ensureShape(output.rows(), output.cols());
+        loss_delta.copyFrom(output);
+        for (int j = 0; j < output.cols(); j++) {
+            loss_delta(labels[j], j) -= 1;
+        }
+    } else {
+        loss->backward(output, labels, loss_delta);
+    }
+
+    return backpropagate();
+}
+
+
+
+double NeuralNetwork::trainStep(const Tensor& X, const Tensor& expected_output) {
+
+    if (!training) {
+        throw std::logic_error("NeuralNetwork: trainStep in eval mode");
+    }
+
+    Tensor output = forward(X);
+
+    // The gradient of SoftMax and CrossEntropy together is computed by
+    // backward() without the loss
+    if (softmax_cross_entropy) {
+        double value = loss->compute(output, expected_output);
+        backward(output, expected_output);
+        return value;
+    }
+
+    double value = loss->computeWithGradient(output, expected_output, loss_delta);
+    backpropagate();
+    return value;
+}
+
+
+
+double NeuralNetwork::trainStep(const Tensor& X, const vector<int>& labels) {
+
+    if (!training) {
+        throw std::logic_error("NeuralNetwork: trainStep in eval mode");
+    }
+
+    Tensor output = forward(X);
 
-    int start_layer = layers.size() - 1 - is_softmax_cross_entropy;
+    if (softmax_cross_entropy) {
+        double value = loss->compute(output, labels);
+        backward(output, labels);
+        return value;
+    }
+
+    double value = loss->computeWithGradient(output, labels, loss_delta);
+    backpropagate();
+    return value;
+}
+
+
+
+Tensor NeuralNetwork::getOutput() const {
+    return output;
+}
+
+
+
+NoGrad::NoGrad(NeuralNetwork& network)
+    : network(network), was_training(network.isTraining()) {
+    network.eval();
+}
+
+
+
+NoGrad::~NoGrad() {
+    if (was_training) {
+        network.train();
+    }
+}
+
+
+
+Tensor NeuralNetwork::backpropagate() {
+
+    if (!packed) {
+        packParameters();
+    }
+
+    int start_layer = execution_layers.size() - 1 - softmax_cross_entropy;
+
+    const Tensor* delta = &loss_delta;
 
     for (int i = start_layer; i >= 0; i--) {
-        delta = layers[i]->backward(delta);
+        execution_layers[i]->backward(*delta, deltas[i]);
+        delta = &deltas[i];
+    }
+
+    return *delta;
+}
+
+
+
+void NeuralNetwork::packParameters() {
+
+    // Element offsets of W, b, dW and db in the arenas, all padded to whole
+    // cache lines
+    const size_t alignment = Tensor::ALIGNMENT / sizeof(Scalar);
+    auto padded = [&](size_t n) { return (n + alignment - 1) / alignment * alignment; };
+
+    size_t size = 0;
+    for (auto& linear_layer : linear_layers) {
+        size += padded(linear_layer->W.size()) + padded(linear_layer->b.size());
+    }
+
+    parameters = Tensor(1, size, 0);
+    gradients = Tensor(1, size, 0);
+
+    size_t offset = 0;
+    for (auto& linear_layer : linear_layers) {
+        int rows = linear_layer->W.rows();
+        int cols = linear_layer->W.cols();
+
+        Tensor W = parameters.view(offset, rows, cols);
+        W.copyFrom(linear_layer->W);
+        linear_layer->W = W;
+        linear_layer->dW = gradients.view(offset, rows, cols);
+        offset += padded(W.size());
+
+        Tensor b = parameters.view(offset, rows, 1);
+        b.copyFrom(linear_layer->b);
+        linear_layer->b = b;
+        linear_layer->db = gradients.view(offset, rows, 1);
+        offset += padded(b.size());
     }
 
-    return delta;
+    packed = true;
 }
 
 
 
 void NeuralNetwork::update(double learn_rate, int batch_size) {
-    for (auto& layer : layers) {
-        auto linear_layer = std::dynamic_pointer_cast<Linear>(layer);
-        if (linear_layer) {
-            optimizer->update(*linear_layer, learn_rate, batch_size);
+    optimizer->update(linear_layers, learn_rate, batch_size);
+}
+
+
+vector<shared_ptr<Layer>> fuseLayers(const vector<shared_ptr<Layer>>& layers) {
+
+    vector<shared_ptr<Layer>> fused;
+
+    for (size_t i = 0; i < layers.size(); i++) {
+        auto linear_layer = std::dynamic_pointer_cast<Linear>(layers[i]);
+        auto activation = i + 1 < layers.size()
+                          ? std::dynamic_pointer_cast<KernelActivation>(layers[i + 1])
+                          : nullptr;
+        if (linear_layer && activation) {
+            fused.push_back(make_shared<Dense>(linear_layer, activation));
+            i++;
+        } else {
+            fused.push_back(layers[i]);
         }
     }
+
+    return fused;
 }
 
 
@@ -105,40 +372,76 @@ vector<vector<int>> loadData(const char* file_name){
 void loadBatch(const vector<vector<int>> &data,
                int batch_size,
                int it,
-               Matrix &A,
-               Matrix &one_hot) {
+               Tensor &A,
+               vector<int> &labels) {
 
     int data_columns = data[0].size() - 1;
-    A = Matrix(batch_size, Vector(data_columns, 0));
-    one_hot = Matrix(batch_size, Vector(10, 0));
+    A.ensureShape(data_columns, batch_size);
+    labels.resize(batch_size);
 
     int first = batch_size * it;
     int last = first + batch_size;
 
+    // Each example is stored as a column
     for (int i = first, k = 0; i < last; i++, k++) {
 
-        int label = data[i][0];
-        one_hot[k][label] = 1;
+        labels[k] = data[i][0];
 
         for (int j = 0; j < data_columns; j++) {
-            A[k][j] = static_cast<double>(data[i][j + 1]) / 255;
+            A(j, k) = static_cast<Scalar>(data[i][j + 1]) / 255;
+        }
+    }
+}
+
+
+
+void loadBatch(const vector<vector<int>> &data,
+               int batch_size,
+               int it,
+               Tensor &A,
+               Tensor &one_hot,
+               int num_classes) {
+
+    static thread_local vector<int> labels;
+    loadBatch(data, batch_size, it, A, labels);
+
+    one_hot.ensureShape(num_classes, batch_size);
+    one_hot.fill(0);
+    for (int k = 0; k < batch_size; k++) {
+        if (labels[k] < 0 || labels[k] >= num_classes) {
+            throw std::out_of_range("loadBatch: label out of range");
         }
+        one_hot(labels[k], k) = 1;
     }
-    A = T(A);
-    one_hot = T(one_hot);
 }
 
 
 
-vector<int> getPrediction(const Matrix & A){
+void loadBatch(const vector<vector<int>> &data,
+               int batch_size,
+               int it,
+               Matrix &A,
+               Matrix &one_hot,
+               int num_classes) {
+
+    Tensor A_tensor;
+    Tensor one_hot_tensor;
+    loadBatch(data, batch_size, it, A_tensor, one_hot_tensor, num_classes);
+    A = A_tensor.toMatrix();
+    one_hot = one_hot_tensor.toMatrix();
+}
+
+
+
+vector<int> getPrediction(const Tensor & A){
 
     vector<int> v;
-    for(int j = 0; j < A[0].size(); j++){
+    for(int j = 0; j < A.cols(); j++){
         int max_int;
         double max = -INFINITY;
-        for(int i = 0; i < A.size(); i++)
-            if(A[i][j]>max){
-                max = A[i][j];
+        for(int i = 0; i < A.rows(); i++)
+            if(A(i, j)>max){
+                max = A(i, j);
                 max_int = i;                
             }
         v.push_back(max_int);
@@ -149,22 +452,42 @@ vector<int> getPrediction(const Matrix & A){
 
 
 
-double getAccuracy(const Matrix & A, const Matrix & Y){
+double getAccuracy(const Tensor & A, const Tensor & Y){
 
     double right = 0;
-    for(int j = 0; j < A[0].size(); j++){
+    for(int j = 0; j < A.cols(); j++){
         int max_int;
         double max = -INFINITY;
-        for(int i = 0; i < A.size(); i++)
-            if(A[i][j]>max){
-                max = A[i][j];
+        for(int i = 0; i < A.rows(); i++)
+            if(A(i, j)>max){
+                max = A(i, j);
                 max_int = i;
             }
-        if(Y[max_int][j]==1)
+        if(Y(max_int, j)==1)
             right+=1;
     }
 
-    return right/Y[0].size();
+    return right/Y.cols();
+}
+
+
+
+double getAccuracy(const Tensor & A, const vector<int> & labels){
+
+    double right = 0;
+    for(int j = 0; j < A.cols(); j++){
+        int max_int;
+        double max = -INFINITY;
+        for(int i = 0; i < A.rows(); i++)
+            if(A(i, j)>max){
+                max = A(i, j);
+                max_int = i;
+            }
+        if(max_int == labels[j])
+            right+=1;
+    }
+
+    return right/labels.size();
 }
 
 
@@ -180,34 +503,14 @@ void resize(Matrix& a, const Matrix& b) {
 
 void gradientClipping(NeuralNetwork& network, double max_norm) {
 
-    // Obtain the gradient of all layers
-    Vector gradient;
-    for (const auto& layer : network.layers) {
-        auto linear_layer = std::dynamic_pointer_cast<Linear>(layer);
-        if (linear_layer) {
-            Vector layer_gradient = linear_layer->getGradient();
-            gradient.insert(gradient.end(),
-                            layer_gradient.begin(),
-                            layer_gradient.end());
-        }
-    }
-
-    // Compute the norm of the gradient
-    double grad_norm = 0.0;
-    for (const auto& elem : gradient) {
-        grad_norm += elem * elem;
-    }
-    grad_norm = std::sqrt(grad_norm);
+    // The gradients of all layers are one tensor, so the global norm is a
+    // single reduction and the clipping a single scale
+    Tensor gradients = network.getGradients();
+    double grad_norm = std::sqrt(sumSquares(gradients));
 
     // If the norm is greater than the maximum, perform the clipping
     if (grad_norm > max_norm) {
-        double scale = max_norm / grad_norm;
-        for (const auto& layer : network.layers) {
-            auto linear_layer = std::dynamic_pointer_cast<Linear>(layer);
-            if (linear_layer) {
-                linear_layer->scaleGradient(scale);
-            }
-        }
+        applyKernel(kernels().scale, gradients, max_norm / grad_norm, gradients);
     }
 }
 
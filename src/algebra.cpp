@@ -6,144 +6,177 @@
  */
 
 #include "algebra.h"
+#include "gemm.h"
+#include "elementwise.h"
 #include <iostream>
 #include <omp.h>
 
 
 
-Matrix dot(const Matrix& a, const Matrix& b) {
+Tensor dot(const Tensor& a, const Tensor& b) {
+    Tensor c;
+    dot_into(c, a, b);
+    return c;
+}
 
-    int n = a.size();
-    int m = a[0].size();
-    int p = b[0].size();
+void dot_into(Tensor& c, const Tensor& a, const Tensor& b) {
+    c.ensureShape(a.rows(), b.cols());
+    gemm(false, false, 1.0, a, b, 0.0, c);
+}
 
-    Matrix c(n, Vector(p, 0));
 
-    #pragma omp parallel for
-    for (int i = 0; i < n; ++i) {
-        for (int k = 0; k < m; ++k) {
-            for (int j = 0; j < p; ++j) {
-                #pragma omp atomic update
-                c[i][j] += a[i][k] * b[k][j];
-            }
-        }
-    }
 
-    return c;
+void gemm(bool transA, bool transB,
+          double alpha, const Tensor& A, const Tensor& B,
+          double beta, Tensor& C) {
+
+    Tensor a = transA ? A.t() : A;
+    Tensor b = transB ? B.t() : B;
+
+    if (C.stride(1) == 1 || C.cols() <= 1) {
+        blockedGemm(C.rows(), C.cols(), a.cols(), alpha,
+                    a.data(), a.stride(0), a.stride(1),
+                    b.data(), b.stride(0), b.stride(1),
+                    beta, C.data(), C.stride(0));
+    } else if (C.stride(0) == 1) {
+        // C is a transposed view: compute C^T = op(B)^T * op(A)^T instead
+        blockedGemm(C.cols(), C.rows(), a.cols(), alpha,
+                    b.data(), b.stride(1), b.stride(0),
+                    a.data(), a.stride(1), a.stride(0),
+                    beta, C.data(), C.stride(1));
+    } else {
+        Tensor c = beta == 0.0 ? Tensor::allocate(C.rows(), C.cols()) : C.clone();
+        gemm(false, false, alpha, a, b, beta, c);
+        C.copyFrom(c);
+    }
 }
 
 
-//sums vector b with each column of the matrix M
-//Pre: M.size() == b.size();
-Matrix sum(const Matrix & M, const Vector & b) {
-    int num_rows = M.size();
-    int num_cols = M[0].size();
+void dense_into(Tensor& dst, const Tensor& W, const Tensor& X, const Tensor& b,
+                UnaryKernel activation, Scalar param, Tensor* pre_activation) {
 
-    Matrix M2(num_rows, Vector(num_cols, 0));
+    dst.ensureShape(W.rows(), X.cols());
+    if (pre_activation) {
+        pre_activation->ensureShape(dst.rows(), dst.cols());
+    }
 
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_rows; i++) {
-        for (int j = 0; j < num_cols; j++) {
-            M2[i][j] = b[i] + M[i][j];
-        }
+    bool direct = (dst.stride(1) == 1 || dst.cols() <= 1) &&
+                  (b.stride(0) == 1 || b.rows() <= 1) &&
+                  (!pre_activation || pre_activation->stride(1) == 1 || dst.cols() <= 1);
+
+    if (direct) {
+        GemmEpilogue epilogue = {
+            b.data(),
+            pre_activation ? pre_activation->data() : nullptr,
+            pre_activation ? pre_activation->stride(0) : 0,
+            activation,
+            param
+        };
+        blockedGemm(dst.rows(), dst.cols(), W.cols(), 1.0,
+                    W.data(), W.stride(0), W.stride(1),
+                    X.data(), X.stride(0), X.stride(1),
+                    0.0, dst.data(), dst.stride(0), &epilogue);
+        return;
     }
 
-    return M2;
+    gemm(false, false, 1.0, W, X, 0.0, dst);
+    addColumn(dst, b, dst);
+    if (pre_activation) {
+        pre_activation->copyFrom(dst);
+    }
+    if (activation) {
+        applyKernel(activation, dst, param, dst);
+    }
 }
 
 
-Matrix T(const Matrix& m) {
-    int num_rows = m.size();
-    int num_cols = m[0].size();
-
-    Matrix mt(num_cols, Vector(num_rows, 0));
-
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_rows; i++) {
-        for (int j = 0; j < num_cols; j++) {
-            mt[j][i] = m[i][j];
-        }
-    }
+//sums vector b with each column of the matrix M
+//Pre: M.rows() == b.rows();
+void sum_into(Tensor & dst, const Tensor & M, const Tensor & b) {
+    dst.ensureShape(M.rows(), M.cols());
+    addColumn(M, b, dst);
+}
 
-    return mt;
+void sum_inplace(Tensor & M, const Tensor & b) {
+    addColumn(M, b, M);
 }
 
 
-Matrix minusM(const Matrix &m1, const Matrix &m2) {
-    int num_rows = m1.size();
-    int num_cols = m1[0].size();
+Tensor T(const Tensor& m) {
+    return m.t().clone();
+}
 
-    Matrix m(num_rows, Vector(num_cols, 0));
+void T_into(Tensor& dst, const Tensor& m) {
+    dst.ensureShape(m.cols(), m.rows());
+    dst.copyFrom(m.t());
+}
 
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_rows; i++) {
-        for (int j = 0; j < num_cols; j++) {
-            m[i][j] = m1[i][j] - m2[i][j];
-        }
-    }
 
-    return m;
+void minusM_into(Tensor &dst, const Tensor &m1, const Tensor &m2) {
+    dst.ensureShape(m1.rows(), m1.cols());
+    applyKernel(kernels().sub, m1, m2, dst);
 }
 
+void minusM_inplace(Tensor &m1, const Tensor &m2) {
+    applyKernel(kernels().sub, m1, m2, m1);
+}
 
-Matrix product(Matrix m1, double a) {
-    int num_rows = m1.size();
-    int num_cols = m1[0].size();
 
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_rows; i++) {
-        for (int j = 0; j < num_cols; j++) {
-            m1[i][j] *= a;
-        }
-    }
+void product_into(Tensor &dst, const Tensor &m1, double a) {
+    dst.ensureShape(m1.rows(), m1.cols());
+    applyKernel(kernels().scale, m1, a, dst);
+}
 
-    return m1;
+void product_inplace(Tensor &m1, double a) {
+    applyKernel(kernels().scale, m1, a, m1);
 }
 
 
-Vector product(Vector v, double a) {
+Vector product(const Vector & v, double a) {
+    Vector result = v;
+    product_inplace(result, a);
+    return result;
+}
+
+void product_inplace(Vector & v, double a) {
     int vecSize = v.size();
 
     #pragma omp parallel for
     for (int i = 0; i < vecSize; i++) {
         v[i] *= a;
     }
-
-    return v;
 }
 
 
 //devuelve un vector con la suma de cada una de las filas
-Vector rowsSum(const Matrix & m) {
-    int num_rows = m.size();
-    int num_cols = m[0].size();
+Tensor rowsSum(const Tensor & m) {
+    Tensor v;
+    rowsSum_into(v, m);
+    return v;
+}
 
-    Vector v(num_rows, 0);
+void rowsSum_into(Tensor & v, const Tensor & m) {
+    int num_rows = m.rows();
+    int num_cols = m.cols();
+
+    v.ensureShape(num_rows, 1);
 
     #pragma omp parallel for
     for (int i = 0; i < num_rows; i++) {
+        double row_sum = 0;
         for (int j = 0; j < num_cols; j++) {
-            #pragma omp atomic
-            v[i] += m[i][j];
+            row_sum += m(i, j);
         }
+        v(i, 0) = row_sum;
     }
-
-    return v;
 }
 
 
-Matrix hadamard(const Matrix &m1, const Matrix &m2) {
-    int num_rows = m1.size();
-    int num_cols = m1[0].size();
-
-    Matrix m(num_rows, Vector(num_cols, 0));
-
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < num_rows; i++) {
-        for (int j = 0; j < num_cols; j++) {
-            m[i][j] = m1[i][j] * m2[i][j];
-        }
-    }
+void hadamard_into(Tensor &dst, const Tensor &m1, const Tensor &m2) {
+    dst.ensureShape(m1.rows(), m1.cols());
+    applyKernel(kernels().mul, m1, m2, dst);
+}
 
-    return m;
-}
\ No newline at end of file
+void hadamard_inplace(Tensor &m1, const Tensor &m2) {
+    applyKernel(kernels().mul, m1, m2, m1);
+}
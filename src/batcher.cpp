@@ -0,0 +1,257 @@
+/*
+ * File: src/batcher.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the request batcher that coalesces small inference requests into batches.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "batcher.h"
+
+
+// Latency histogram
+//////////////////////////////////////////////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram() : buckets(BUCKETS, 0), total(0) {}
+
+void LatencyHistogram::record(double microseconds) {
+    // Bucket 0 holds everything below 1us, and bucket b > 0 the durations in
+    // [2^((b - 1) / 4), 2^(b / 4))
+    int bucket = 0;
+    if (microseconds >= 1) {
+        bucket = std::min(BUCKETS - 1, 1 + (int)std::floor(4 * std::log2(microseconds)));
+    }
+    buckets[bucket]++;
+    total++;
+}
+
+double LatencyHistogram::percentile(double fraction) const {
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)std::ceil(fraction * total);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank && seen > 0) {
+            return std::exp2(b / 4.0);
+        }
+    }
+    return std::exp2((BUCKETS - 1) / 4.0);
+}
+
+
+// Request batcher
+//////////////////////////////////////////////////////////////////////////////
+
+RequestBatcher::RequestBatcher(const shared_ptr<const NeuralNetwork>& network,
+                               int input_size,
+                               const BatcherOptions& options)
+    : network(network), input_size(input_size), options(options),
+      queued_columns(0), stopping(false), batches(0) {
+
+    if (options.max_batch_size <= 0 || options.num_workers <= 0 ||
+        options.max_delay.count() < 0) {
+        throw std::invalid_argument("RequestBatcher: invalid options");
+    }
+
+    for (int i = 0; i < options.num_workers; i++) {
+        workers.emplace_back(&RequestBatcher::work, this);
+    }
+}
+
+
+
+RequestBatcher::~RequestBatcher() {
+    shutdown();
+}
+
+
+
+void RequestBatcher::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+
+
+std::future<Tensor> RequestBatcher::submit(const Tensor& X) {
+    return enqueue(X.clone());
+}
+
+
+
+std::future<Tensor> RequestBatcher::submitView(const Tensor& X) {
+    return enqueue(X);
+}
+
+
+
+std::future<Tensor> RequestBatcher::enqueue(const Tensor& X) {
+
+    if (X.rows() != input_size || X.cols() == 0) {
+        throw std::invalid_argument("RequestBatcher: wrong input shape");
+    }
+
+    Request request;
+    request.input = X;
+    std::future<Tensor> result = request.result.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            throw std::logic_error("RequestBatcher: submit after shutdown");
+        }
+        request.arrival = Clock::now();
+        queued_columns += X.cols();
+        queue.push_back(std::move(request));
+    }
+    ready.notify_one();
+
+    return result;
+}
+
+
+
+BatcherStats RequestBatcher::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    BatcherStats stats;
+    stats.requests = latency.count();
+    stats.batches = batches;
+    stats.p50_latency = latency.percentile(0.5);
+    stats.p99_latency = latency.percentile(0.99);
+    stats.batch_sizes = batch_sizes;
+    return stats;
+}
+
+
+
+void RequestBatcher::work() {
+
+    // Reused by every batch of this worker
+    std::vector<Request> batch;
+    Tensor X = Tensor::growable();
+    InferenceContext context;
+
+    while (nextBatch(batch)) {
+        run(batch, X, context);
+        batch.clear();
+    }
+}
+
+
+
+bool RequestBatcher::nextBatch(std::vector<Request>& batch) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Wait until the batch is full or its first request reaches the deadline.
+    // Another worker may take the requests meanwhile, so everything is
+    // checked again on every wake up.
+    for (;;) {
+        ready.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return false;
+        }
+
+        Clock::time_point deadline = queue.front().arrival + options.max_delay;
+        if (stopping || queued_columns >= options.max_batch_size ||
+            Clock::now() >= deadline) {
+            break;
+        }
+        ready.wait_until(lock, deadline);
+    }
+
+    int columns = 0;
+    while (!queue.empty()) {
+        int request_columns = queue.front().input.cols();
+        if (columns > 0 && columns + request_columns > options.max_batch_size) {
+            break;
+        }
+        columns += request_columns;
+        queued_columns -= request_columns;
+        batch.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+
+    // What is left is the start of the next batch
+    bool more = !queue.empty();
+    lock.unlock();
+    if (more) {
+        ready.notify_one();
+    }
+
+    return true;
+}
+
+
+
+void RequestBatcher::run(std::vector<Request>& batch, Tensor& X,
+                         InferenceContext& context) {
+
+    int columns = 0;
+    for (const auto& request : batch) {
+        columns += request.input.cols();
+    }
+
+    // A request alone is run from its own buffer
+    const Tensor* input = &batch[0].input;
+    if (batch.size() > 1) {
+        X.ensureShape(input_size, columns);
+        int begin = 0;
+        for (const auto& request : batch) {
+            Tensor columns_view = X.colSlice(begin, begin + request.input.cols());
+            columns_view.copyFrom(request.input);
+            begin += request.input.cols();
+        }
+        input = &X;
+    }
+
+    std::vector<Tensor> outputs(batch.size());
+    std::exception_ptr error;
+    try {
+        Tensor Y = network->predict(*input, context);
+        int begin = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            int end = begin + batch[i].input.cols();
+            outputs[i] = Y.colSlice(begin, end).clone();
+            begin = end;
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    Clock::time_point done = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batches++;
+        if ((int)batch_sizes.size() <= columns) {
+            batch_sizes.resize(columns + 1, 0);
+        }
+        batch_sizes[columns]++;
+        for (const auto& request : batch) {
+            latency.record(std::chrono::duration<double, std::micro>(done - request.arrival).count());
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (error) {
+            batch[i].result.set_exception(error);
+        } else {
+            batch[i].result.set_value(outputs[i]);
+        }
+    }
+}
@@ -0,0 +1,401 @@
+/*
+ * File: src/checkpoint.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the training checkpoints, written in the background and resumed exactly.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "checksum.h"
+
+
+static const char CHECKPOINT_MAGIC[8] = {'D', 'C', 'P', 'P', 'C', 'K', 'P', 'T'};
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t scalar_size;
+    uint32_t num_tensors;
+    uint32_t num_random_states;
+    uint32_t num_values;
+    uint32_t data_checksum;
+    int64_t epoch;
+    int64_t iteration;
+    uint64_t optimizer_step;
+    uint64_t data_size;
+    uint8_t reserved[12];
+    uint32_t header_checksum;   // Of the bytes above
+};
+
+struct TensorRecord {
+    int32_t rows;
+    int32_t cols;
+};
+
+struct RandomStateRecord {
+    uint64_t seed;
+    uint64_t step;
+    uint32_t layer;
+    uint32_t reserved;
+};
+
+
+// State of a network, in the order of the file
+struct NetworkState {
+    vector<Tensor> tensors;
+    vector<RandomState*> random_states;
+};
+
+static NetworkState networkState(const NeuralNetwork& network) {
+    NetworkState state;
+    for (const auto& layer : network.layers) {
+        if (auto linear = dynamic_pointer_cast<Linear>(layer)) {
+            state.tensors.push_back(linear->W);
+            state.tensors.push_back(linear->b);
+            for (const Tensor& tensor : network.optimizer->getState(*linear)) {
+                state.tensors.push_back(tensor);
+            }
+        }
+        if (RandomState* random = layer->randomState()) {
+            state.random_states.push_back(random);
+        }
+    }
+    return state;
+}
+
+static size_t dataSize(const NetworkState& state, size_t num_values) {
+    size_t size = 0;
+    for (const Tensor& tensor : state.tensors) {
+        size += sizeof(TensorRecord) + tensor.size() * sizeof(Scalar);
+    }
+    size += state.random_states.size() * sizeof(RandomStateRecord);
+    size += num_values * sizeof(double);
+    return size;
+}
+
+// Copies tensor row by row to or from bytes, and returns the end of its rows
+static char* copyTensor(const Tensor& tensor, char* bytes) {
+    if (tensor.empty()) {
+        return bytes;
+    }
+    size_t row_bytes = tensor.cols() * sizeof(Scalar);
+    for (int i = 0; i < tensor.rows(); i++) {
+        if (tensor.stride(1) == 1) {
+            memcpy(bytes, &tensor(i, 0), row_bytes);
+        } else {
+            Scalar* row = reinterpret_cast<Scalar*>(bytes);
+            for (int j = 0; j < tensor.cols(); j++) {
+                memcpy(row + j, &tensor(i, j), sizeof(Scalar));
+            }
+        }
+        bytes += row_bytes;
+    }
+    return bytes;
+}
+
+static const char* copyTensor(const char* bytes, Tensor& tensor) {
+    if (tensor.empty()) {
+        return bytes;
+    }
+    size_t row_bytes = tensor.cols() * sizeof(Scalar);
+    for (int i = 0; i < tensor.rows(); i++) {
+        if (tensor.stride(1) == 1) {
+            memcpy(&tensor(i, 0), bytes, row_bytes);
+        } else {
+            const Scalar* row = reinterpret_cast<const Scalar*>(bytes);
+            for (int j = 0; j < tensor.cols(); j++) {
+                memcpy(&tensor(i, j), row + j, sizeof(Scalar));
+            }
+        }
+        bytes += row_bytes;
+    }
+    return bytes;
+}
+
+static void writeAll(int fd, const char* bytes, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(string("CheckpointWriter: cannot write: ") + strerror(errno));
+        }
+        bytes += written;
+        size -= written;
+    }
+}
+
+// Replaces file_name with bytes: either the old file or the whole new one is
+// found there after a crash
+static void writeAtomically(const string& file_name, const vector<char>& bytes) {
+    string temporary = file_name + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("CheckpointWriter: cannot open " + temporary);
+    }
+
+    try {
+        writeAll(fd, bytes.data(), bytes.size());
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        throw std::runtime_error("CheckpointWriter: cannot sync " + temporary);
+    }
+
+    if (rename(temporary.c_str(), file_name.c_str()) != 0) {
+        throw std::runtime_error("CheckpointWriter: cannot rename " + temporary);
+    }
+
+    // The rename itself is only durable once the directory is synced
+    size_t slash = file_name.rfind('/');
+    string directory = slash == string::npos ? "." : file_name.substr(0, slash + (slash == 0));
+    int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        throw std::runtime_error("CheckpointWriter: cannot open " + directory);
+    }
+    int result = fsync(dir_fd);
+    close(dir_fd);
+    if (result != 0) {
+        throw std::runtime_error("CheckpointWriter: cannot sync " + directory);
+    }
+}
+
+
+// CheckpointWriter
+//////////////////////////////////////////////////////////////////////////////
+
+CheckpointWriter::CheckpointWriter(const string& file_name)
+    : file_name(file_name), queued(-1), writing(-1), stopping(false) {
+    thread = std::thread(&CheckpointWriter::work, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+void CheckpointWriter::save(const NeuralNetwork& network, const TrainingProgress& progress) {
+    int target;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        throwError();
+        // A queued checkpoint is replaced by this newer one, so it is taken
+        // back from the thread while it is overwritten
+        target = queued != -1 ? queued : 1 - std::max(writing, 0);
+        queued = -1;
+    }
+
+    NetworkState state = networkState(network);
+
+    vector<char>& buffer = buffers[target];
+    buffer.resize(sizeof(CheckpointHeader) + dataSize(state, progress.values.size()));
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.scalar_size = sizeof(Scalar);
+    header.num_tensors = state.tensors.size();
+    header.num_random_states = state.random_states.size();
+    header.num_values = progress.values.size();
+    header.epoch = progress.epoch;
+    header.iteration = progress.iteration;
+    header.optimizer_step = network.optimizer->getStep();
+    header.data_size = buffer.size() - sizeof(CheckpointHeader);
+    // The checksums are left to the thread
+
+    char* bytes = buffer.data();
+    memcpy(bytes, &header, sizeof(header));
+    bytes += sizeof(header);
+
+    for (const Tensor& tensor : state.tensors) {
+        TensorRecord record = { tensor.rows(), tensor.cols() };
+        memcpy(bytes, &record, sizeof(record));
+        bytes = copyTensor(tensor, bytes + sizeof(record));
+    }
+    for (const RandomState* random : state.random_states) {
+        RandomStateRecord record = { random->seed, random->step, random->layer, 0 };
+        memcpy(bytes, &record, sizeof(record));
+        bytes += sizeof(record);
+    }
+    if (!progress.values.empty()) {
+        memcpy(bytes, progress.values.data(), progress.values.size() * sizeof(double));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued = target;
+    }
+    changed.notify_all();
+}
+
+void CheckpointWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return queued == -1 && writing == -1; });
+    throwError();
+}
+
+void CheckpointWriter::throwError() {
+    if (!error.empty()) {
+        string message = error;
+        error.clear();
+        throw std::runtime_error(message);
+    }
+}
+
+void CheckpointWriter::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return queued != -1 || stopping; });
+        if (queued == -1) {
+            return;
+        }
+        writing = queued;
+        queued = -1;
+        lock.unlock();
+
+        vector<char>& buffer = buffers[writing];
+        CheckpointHeader header;
+        memcpy(&header, buffer.data(), sizeof(header));
+        header.data_checksum = crc32c(buffer.data() + sizeof(header), header.data_size);
+        header.header_checksum = crc32c(&header, offsetof(CheckpointHeader, header_checksum));
+        memcpy(buffer.data(), &header, sizeof(header));
+
+        string failure;
+        try {
+            writeAtomically(file_name, buffer);
+        } catch (const std::exception& e) {
+            failure = e.what();
+        }
+
+        lock.lock();
+        if (!failure.empty()) {
+            error = failure;
+        }
+        writing = -1;
+        changed.notify_all();
+    }
+}
+
+
+// Loading
+//////////////////////////////////////////////////////////////////////////////
+
+static vector<char> readFile(const string& file_name, bool& found) {
+    vector<char> bytes;
+    int fd = open(file_name.c_str(), O_RDONLY);
+    found = fd >= 0 || errno != ENOENT;
+    if (!found) {
+        return bytes;
+    }
+
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("loadCheckpoint: cannot open " + file_name);
+    }
+
+    bytes.resize(file_stat.st_size);
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = read(fd, bytes.data() + done, bytes.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            throw std::runtime_error("loadCheckpoint: cannot read " + file_name);
+        }
+        done += n;
+    }
+    close(fd);
+    return bytes;
+}
+
+bool loadCheckpoint(const string& file_name, NeuralNetwork& network, TrainingProgress& progress) {
+    bool found;
+    vector<char> bytes = readFile(file_name, found);
+    if (!found) {
+        return false;
+    }
+
+    CheckpointHeader header;
+    if (bytes.size() < sizeof(header)) {
+        throw std::runtime_error("loadCheckpoint: not a checkpoint: " + file_name);
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.header_checksum != crc32c(&header, offsetof(CheckpointHeader, header_checksum))) {
+        throw std::runtime_error("loadCheckpoint: not a checkpoint: " + file_name);
+    }
+    if (header.version != CHECKPOINT_VERSION) {
+        throw std::runtime_error("loadCheckpoint: unsupported checkpoint version");
+    }
+    if (header.scalar_size != sizeof(Scalar)) {
+        throw std::runtime_error("loadCheckpoint: checkpoint written with another precision");
+    }
+    if (header.data_size != bytes.size() - sizeof(header)) {
+        throw std::runtime_error("loadCheckpoint: truncated checkpoint");
+    }
+    const char* data = bytes.data() + sizeof(header);
+    if (header.data_checksum != crc32c(data, header.data_size)) {
+        throw std::runtime_error("loadCheckpoint: corrupt checkpoint");
+    }
+
+    // Everything is checked against the network before any of it is changed
+    NetworkState state = networkState(network);
+    if (header.num_tensors != state.tensors.size() ||
+        header.num_random_states != state.random_states.size() ||
+        header.data_size != dataSize(state, header.num_values)) {
+        throw std::runtime_error("loadCheckpoint: checkpoint does not match the network");
+    }
+    const char* p = data;
+    for (const Tensor& tensor : state.tensors) {
+        TensorRecord record;
+        memcpy(&record, p, sizeof(record));
+        if (record.rows != tensor.rows() || record.cols != tensor.cols()) {
+            throw std::runtime_error("loadCheckpoint: checkpoint does not match the network");
+        }
+        p += sizeof(record) + tensor.size() * sizeof(Scalar);
+    }
+
+    p = data;
+    for (Tensor& tensor : state.tensors) {
+        p = copyTensor(p + sizeof(TensorRecord), tensor);
+    }
+    for (RandomState* random : state.random_states) {
+        RandomStateRecord record;
+        memcpy(&record, p, sizeof(record));
+        random->seed = record.seed;
+        random->step = record.step;
+        random->layer = record.layer;
+        p += sizeof(record);
+    }
+    progress.values.resize(header.num_values);
+    if (header.num_values > 0) {
+        memcpy(progress.values.data(), p, header.num_values * sizeof(double));
+    }
+
+    network.optimizer->setStep(header.optimizer_step);
+    progress.epoch = header.epoch;
+    progress.iteration = header.iteration;
+    return true;
+}
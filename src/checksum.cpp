@@ -0,0 +1,68 @@
+/*
+ * File: src/checksum.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the checksum used to validate the files written by the framework.
+ */
+
+#include <cstring>
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+
+static const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+static uint32_t crc32cSoftware(const unsigned char* p, size_t size, uint32_t crc) {
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value >> 1) ^ (value & 1 ? CRC32C_POLYNOMIAL : 0);
+            }
+            table[i] = value;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(const unsigned char* p, size_t size, uint32_t crc) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    uint32_t crc32 = (uint32_t)crc64;
+    for (; size > 0; p++, size--) {
+        crc32 = _mm_crc32_u8(crc32, *p);
+    }
+    return crc32;
+}
+#endif
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+
+#if defined(__x86_64__)
+    static const bool hardware = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+    if (hardware) {
+        return ~crc32cHardware(p, size, crc);
+    }
+#endif
+
+    return ~crc32cSoftware(p, size, crc);
+}
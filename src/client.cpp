@@ -0,0 +1,185 @@
+/*
+ * File: src/client.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the client of the inference server.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "client.h"
+
+
+// Name of a new shared memory object, unique in the host
+static std::string ringName() {
+    static std::atomic<unsigned> counter(0);
+    char name[IPC_NAME_SIZE];
+    std::snprintf(name, sizeof(name), "/deepcpp-%d-%u", (int)getpid(), counter++);
+    return name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+InferenceClient::InferenceClient(const std::string& socket_path, int slots_, int slot_columns)
+    : fd(-1), slot_columns(slot_columns), ring(nullptr), ring_bytes(0),
+      slots(std::max(slots_, 0)), next_slot(0), reserved(-1), next_ticket(1) {
+
+    if (slots_ <= 0 || slot_columns <= 0) {
+        throw std::invalid_argument("InferenceClient: invalid ring");
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("InferenceClient: socket path too long");
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("InferenceClient: cannot connect to " + socket_path);
+    }
+
+    if (!receiveAll(fd, &hello, sizeof(hello)) || hello.magic != IPC_MAGIC ||
+        hello.scalar_size != sizeof(Scalar)) {
+        close(fd);
+        throw std::runtime_error("InferenceClient: incompatible server");
+    }
+
+    slot_scalars = slotScalars(hello, slot_columns);
+    ring_bytes = ringBytes(hello, slots_, slot_columns);
+
+    // The ring is unlinked as soon as the server has mapped it, so nothing is
+    // left behind if either side crashes
+    std::string name = ringName();
+    int shm_fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    void* p = MAP_FAILED;
+    if (shm_fd >= 0 && ftruncate(shm_fd, ring_bytes) == 0) {
+        p = mmap(nullptr, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    }
+    if (shm_fd >= 0) {
+        close(shm_fd);
+    }
+
+    AttachMessage attach;
+    std::memset(&attach, 0, sizeof(attach));
+    std::strncpy(attach.name, name.c_str(), IPC_NAME_SIZE - 1);
+    attach.slots = slots_;
+    attach.slot_columns = slot_columns;
+
+    ResponseMessage ack;
+    bool attached = p != MAP_FAILED &&
+                    sendAll(fd, &attach, sizeof(attach)) &&
+                    receiveAll(fd, &ack, sizeof(ack)) && ack.status == IPC_OK;
+    shm_unlink(name.c_str());
+
+    if (!attached) {
+        if (p != MAP_FAILED) {
+            munmap(p, ring_bytes);
+        }
+        close(fd);
+        throw std::runtime_error("InferenceClient: cannot share memory with the server");
+    }
+
+    ring = static_cast<Scalar*>(p);
+}
+
+
+
+InferenceClient::~InferenceClient() {
+    close(fd);
+    munmap(ring, ring_bytes);
+}
+
+
+
+Scalar* InferenceClient::reserve(int n) {
+
+    if (n <= 0 || n > slot_columns) {
+        throw std::invalid_argument("InferenceClient: invalid number of samples");
+    }
+
+    int slot = next_slot;
+    complete(slot);
+    next_slot = (next_slot + 1) % slots.size();
+
+    slots[slot].columns = n;
+    reserved = slot;
+    return ring + slot * slot_scalars;
+}
+
+
+
+uint64_t InferenceClient::send() {
+
+    if (reserved < 0) {
+        throw std::logic_error("InferenceClient: send without reserve");
+    }
+
+    Slot& slot = slots[reserved];
+    slot.ticket = next_ticket++;
+    slot.pending = true;
+    slot.status = IPC_OK;
+
+    RequestMessage request = { slot.ticket, (uint32_t)reserved, slot.columns };
+    reserved = -1;
+    if (!sendAll(fd, &request, sizeof(request))) {
+        throw std::runtime_error("InferenceClient: connection lost");
+    }
+
+    return request.ticket;
+}
+
+
+
+const Scalar* InferenceClient::wait(uint64_t ticket) {
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].ticket == ticket) {
+            complete(i);
+            if (slots[i].status != IPC_OK) {
+                throw std::runtime_error("InferenceClient: request failed");
+            }
+            return ring + i * slot_scalars + (size_t)slot_columns * hello.input_size;
+        }
+    }
+
+    throw std::invalid_argument("InferenceClient: unknown ticket");
+}
+
+
+
+void InferenceClient::infer(const Scalar* samples, int n, Scalar* outputs) {
+    Scalar* inputs = reserve(n);
+    std::copy(samples, samples + (size_t)n * hello.input_size, inputs);
+    const Scalar* result = wait(send());
+    std::copy(result, result + (size_t)n * hello.output_size, outputs);
+}
+
+
+
+void InferenceClient::complete(int slot) {
+    while (slots[slot].pending) {
+        ResponseMessage response;
+        if (!receiveAll(fd, &response, sizeof(response))) {
+            throw std::runtime_error("InferenceClient: connection lost");
+        }
+        if (response.slot < slots.size() && slots[response.slot].pending &&
+            slots[response.slot].ticket == response.ticket) {
+            slots[response.slot].pending = false;
+            slots[response.slot].status = response.status;
+        }
+    }
+}
@@ -0,0 +1,186 @@
+/*
+ * File: src/elementwise.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the functions that apply elementwise kernels to whole tensors.
+ */
+
+#include <algorithm>
+#include <omp.h>
+#include "elementwise.h"
+
+
+// Calls f(begin, end) over [0, n), split among threads when n is large
+template <typename F>
+static void parallelChunks(size_t n, F f) {
+    if (n < ELEMENTWISE_PARALLEL_THRESHOLD || omp_in_parallel()) {
+        f(0, n);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        size_t threads = omp_get_num_threads();
+        size_t chunk = (n + threads - 1) / threads;
+        chunk = (chunk + 7) / 8 * 8;
+
+        size_t begin = std::min(n, omp_get_thread_num() * chunk);
+        size_t end = std::min(n, begin + chunk);
+        if (begin < end) {
+            f(begin, end);
+        }
+    }
+}
+
+static bool unitColumnStride(const Tensor& x) {
+    return x.stride(1) == 1 || x.cols() <= 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void applyKernel(BinaryKernel kernel, const Tensor& x, const Tensor& y, Tensor& out) {
+    if (x.isContiguous() && y.isContiguous() && out.isContiguous()) {
+        const Scalar* xp = x.data();
+        const Scalar* yp = y.data();
+        Scalar* op = out.data();
+        parallelChunks(out.size(), [&](size_t begin, size_t end) {
+            kernel(end - begin, xp + begin, yp + begin, op + begin);
+        });
+        return;
+    }
+
+    if (unitColumnStride(x) && unitColumnStride(y) && unitColumnStride(out)) {
+        int rows = out.rows();
+        #pragma omp parallel for if(out.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+        for (int i = 0; i < rows; i++) {
+            kernel(out.cols(), &x(i, 0), &y(i, 0), &out(i, 0));
+        }
+        return;
+    }
+
+    Tensor result = Tensor::allocate(out.rows(), out.cols());
+    applyKernel(kernel, x.clone(), y.clone(), result);
+    out.copyFrom(result);
+}
+
+void applyKernel(UnaryKernel kernel, const Tensor& x, Scalar a, Tensor& out) {
+    if (x.isContiguous() && out.isContiguous()) {
+        const Scalar* xp = x.data();
+        Scalar* op = out.data();
+        parallelChunks(out.size(), [&](size_t begin, size_t end) {
+            kernel(end - begin, xp + begin, a, op + begin);
+        });
+        return;
+    }
+
+    if (unitColumnStride(x) && unitColumnStride(out)) {
+        int rows = out.rows();
+        #pragma omp parallel for if(out.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+        for (int i = 0; i < rows; i++) {
+            kernel(out.cols(), &x(i, 0), a, &out(i, 0));
+        }
+        return;
+    }
+
+    Tensor result = Tensor::allocate(out.rows(), out.cols());
+    applyKernel(kernel, x.clone(), a, result);
+    out.copyFrom(result);
+}
+
+void addColumn(const Tensor& x, const Tensor& b, Tensor& out) {
+    if (!unitColumnStride(x) || !unitColumnStride(out)) {
+        Tensor result = Tensor::allocate(out.rows(), out.cols());
+        addColumn(x.clone(), b, result);
+        out.copyFrom(result);
+        return;
+    }
+
+    UnaryKernel kernel = kernels().add_scalar;
+    int rows = out.rows();
+
+    #pragma omp parallel for if(out.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (int i = 0; i < rows; i++) {
+        kernel(out.cols(), &x(i, 0), b(i, 0), &out(i, 0));
+    }
+}
+
+void packMask(const Tensor& x, bool inclusive, std::vector<uint64_t>& mask) {
+    if (!x.isContiguous()) {
+        packMask(x.clone(), inclusive, mask);
+        return;
+    }
+
+    const Scalar* xp = x.data();
+    size_t n = x.size();
+    ptrdiff_t words = (n + 63) / 64;
+    mask.resize(words);
+
+    #pragma omp parallel for if(n >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (ptrdiff_t w = 0; w < words; w++) {
+        const Scalar* p = xp + w * 64;
+        int count = std::min<size_t>(64, n - w * 64);
+        uint64_t bits = 0;
+        for (int k = 0; k < count; k++) {
+            bool set = inclusive ? p[k] >= 0 : p[k] > 0;
+            bits |= (uint64_t)set << k;
+        }
+        mask[w] = bits;
+    }
+}
+
+void applyMask(const Tensor& x, const std::vector<uint64_t>& mask, Scalar a, Tensor& out) {
+    if (!x.isContiguous() || !out.isContiguous()) {
+        Tensor result = Tensor::allocate(out.rows(), out.cols());
+        applyMask(x.clone(), mask, a, result);
+        out.copyFrom(result);
+        return;
+    }
+
+    const Scalar* xp = x.data();
+    Scalar* op = out.data();
+    size_t n = out.size();
+    ptrdiff_t words = (n + 63) / 64;
+
+    #pragma omp parallel for if(n >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (ptrdiff_t w = 0; w < words; w++) {
+        int count = std::min<size_t>(64, n - w * 64);
+        uint64_t bits = mask[w];
+        for (int k = 0; k < count; k++) {
+            Scalar factor = (bits >> k) & 1 ? Scalar(1) : a;
+            op[w * 64 + k] = xp[w * 64 + k] * factor;
+        }
+    }
+}
+
+// Upper bound on the number of partial sums, so that they fit on the stack
+static const int SUM_SQUARES_CHUNKS = 64;
+
+double sumSquares(const Tensor& x) {
+    if (!x.isContiguous()) {
+        return sumSquares(x.clone());
+    }
+
+    // Blocks of fixed size, grouped into chunks whose partial sums are added
+    // in order, so the result does not depend on the number of threads
+    const Scalar* xp = x.data();
+    size_t n = x.size();
+    ptrdiff_t n_blocks = (n + ELEMENTWISE_PARALLEL_THRESHOLD - 1) / ELEMENTWISE_PARALLEL_THRESHOLD;
+    ptrdiff_t n_chunks = std::min<ptrdiff_t>(SUM_SQUARES_CHUNKS, n_blocks);
+    double partial[SUM_SQUARES_CHUNKS] = {};
+    auto kernel = kernels().sum_squares;
+
+    #pragma omp parallel for schedule(static) if(n_chunks > 1)
+    for (ptrdiff_t c = 0; c < n_chunks; c++) {
+        for (ptrdiff_t b = c * n_blocks / n_chunks; b < (c + 1) * n_blocks / n_chunks; b++) {
+            size_t begin = b * ELEMENTWISE_PARALLEL_THRESHOLD;
+            size_t end = std::min(n, begin + ELEMENTWISE_PARALLEL_THRESHOLD);
+            partial[c] += kernel(end - begin, xp + begin);
+        }
+    }
+
+    double sum = 0;
+    for (ptrdiff_t c = 0; c < n_chunks; c++) {
+        sum += partial[c];
+    }
+    return sum;
+}
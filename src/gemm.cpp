@@ -0,0 +1,320 @@
+/*
+ * File: src/gemm.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the cache blocked general matrix multiplication engine.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <omp.h>
+
+#include "gemm.h"
+#include "kernels.h"
+
+
+// Products with fewer multiply-adds than this run on the calling thread
+static const double GEMM_PARALLEL_THRESHOLD = 64.0 * 64.0 * 64.0;
+
+// Matrix-vector products with fewer multiply-adds than this run on the
+// calling thread. They are bound by the memory traffic of A, which one core
+// already streams at close to full speed for small layers.
+static const double GEMV_PARALLEL_THRESHOLD = 256.0 * 1024.0;
+
+// Number of B slivers below which A is read in place instead of packed
+static const int GEMM_PACK_A_MIN_COLS = 16;
+
+// Largest micro-tile of any kernel table, in elements
+static const int GEMM_MAX_TILE = 512;
+
+
+// Aligned scratch memory that grows on demand and is reused between calls
+class PackBuffer {
+public:
+    PackBuffer() : data(nullptr), capacity(0) {}
+    ~PackBuffer() { free(data); }
+
+    Scalar* get(size_t n) {
+        if (n > capacity) {
+            free(data);
+            data = nullptr;
+            capacity = 0;
+            void* p = nullptr;
+            if (posix_memalign(&p, 64, n * sizeof(Scalar)) != 0) {
+                throw std::bad_alloc();
+            }
+            data = static_cast<Scalar*>(p);
+            capacity = n;
+        }
+        return data;
+    }
+
+private:
+    Scalar* data;
+    size_t capacity;
+};
+
+
+// Packs a sliver of rows rows of A into mr values per k, zero padded
+static void packSliverA(int rows, int kc, const Scalar* a, int rs_a, int cs_a,
+                        int mr, Scalar* dst) {
+    for (int p = 0; p < kc; p++) {
+        const Scalar* src = a + (ptrdiff_t)p * cs_a;
+        for (int i = 0; i < rows; i++) {
+            dst[i] = src[(ptrdiff_t)i * rs_a];
+        }
+        for (int i = rows; i < mr; i++) {
+            dst[i] = 0.0;
+        }
+        dst += mr;
+    }
+}
+
+// Packs a sliver of cols columns of B into nr values per k, zero padded
+static void packSliverB(int cols, int kc, const Scalar* b, int rs_b, int cs_b,
+                        int nr, Scalar* dst) {
+    for (int p = 0; p < kc; p++) {
+        const Scalar* src = b + (ptrdiff_t)p * rs_b;
+        if (cs_b == 1) {
+            std::copy(src, src + cols, dst);
+        } else {
+            for (int j = 0; j < cols; j++) {
+                dst[j] = src[(ptrdiff_t)j * cs_b];
+            }
+        }
+        for (int j = cols; j < nr; j++) {
+            dst[j] = 0.0;
+        }
+        dst += nr;
+    }
+}
+
+static void scale(int m, int n, Scalar beta, Scalar* c, int ldc) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            Scalar& value = c[(ptrdiff_t)i * ldc + j];
+            value = beta == 0.0 ? 0.0 : beta * value;
+        }
+    }
+}
+
+// Applies the epilogue to the m x n block of C whose first element is (i0, j0)
+static void applyEpilogue(const GemmEpilogue& epilogue, int i0, int j0,
+                          int m, int n, Scalar* c, int ldc) {
+    const KernelTable& kt = kernels();
+
+    for (int i = 0; i < m; i++) {
+        Scalar* row = c + (ptrdiff_t)i * ldc;
+        if (epilogue.bias) {
+            kt.add_scalar(n, row, epilogue.bias[i0 + i], row);
+        }
+        if (epilogue.pre_activation) {
+            std::copy(row, row + n, epilogue.pre_activation
+                      + (ptrdiff_t)(i0 + i) * epilogue.ld_pre + j0);
+        }
+        if (epilogue.activation) {
+            epilogue.activation(n, row, epilogue.activation_param, row);
+        }
+    }
+}
+
+// Same for the m x 1 block of C starting at row i0 when C, the bias and
+// pre_activation are contiguous columns, so each step is one kernel call
+static void applyColumnEpilogue(const GemmEpilogue& epilogue, int i0, int m, Scalar* c) {
+    const KernelTable& kt = kernels();
+
+    if (epilogue.bias) {
+        kt.add(m, c, epilogue.bias + i0, c);
+    }
+    if (epilogue.pre_activation) {
+        std::copy(c, c + m, epilogue.pre_activation + i0);
+    }
+    if (epilogue.activation) {
+        epilogue.activation(m, c, epilogue.activation_param, c);
+    }
+}
+
+// C = alpha * A * b + beta * C for a single column b, with the rows of A
+// contiguous. Each row of A is read once and nothing is packed.
+static void gemv(int m, int k, Scalar alpha,
+                 const Scalar* a, int rs_a,
+                 const Scalar* b, int rs_b,
+                 Scalar beta, Scalar* c, int ldc,
+                 const GemmEpilogue* epilogue) {
+
+    const KernelTable& kt = kernels();
+
+    // The kernel reads x contiguously
+    static thread_local PackBuffer buffer_x;
+    const Scalar* x = b;
+    if (rs_b != 1) {
+        Scalar* packed = buffer_x.get(k);
+        for (int p = 0; p < k; p++) {
+            packed[p] = b[(ptrdiff_t)p * rs_b];
+        }
+        x = packed;
+    }
+
+    bool column_epilogue = epilogue && ldc == 1 &&
+                           (!epilogue->pre_activation || epilogue->ld_pre == 1);
+    bool parallel = (double)m * k >= GEMV_PARALLEL_THRESHOLD && !omp_in_parallel();
+
+    #pragma omp parallel if(parallel)
+    {
+        // Contiguous blocks of rows, so each thread streams its own part of A
+        int threads = omp_get_num_threads();
+        int rows = (m + threads - 1) / threads;
+        int i0 = std::min(m, omp_get_thread_num() * rows);
+        int i1 = std::min(m, i0 + rows);
+
+        if (i1 > i0) {
+            Scalar* cp = c + (ptrdiff_t)i0 * ldc;
+            kt.gemv(i1 - i0, k, a + (ptrdiff_t)i0 * rs_a, rs_a, x, cp, ldc, alpha, beta);
+            if (column_epilogue) {
+                applyColumnEpilogue(*epilogue, i0, i1 - i0, cp);
+            } else if (epilogue) {
+                applyEpilogue(*epilogue, i0, 0, i1 - i0, 1, cp, ldc);
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void blockedGemm(int m, int n, int k, Scalar alpha,
+                 const Scalar* a, int rs_a, int cs_a,
+                 const Scalar* b, int rs_b, int cs_b,
+                 Scalar beta, Scalar* c, int ldc,
+                 const GemmEpilogue* epilogue) {
+
+    if (m <= 0 || n <= 0) {
+        return;
+    }
+
+    if (k <= 0 || alpha == 0.0) {
+        scale(m, n, beta, c, ldc);
+        if (epilogue) {
+            applyEpilogue(*epilogue, 0, 0, m, n, c, ldc);
+        }
+        return;
+    }
+
+    // A single column, as in a forward pass of one sample
+    if (n == 1 && cs_a == 1) {
+        gemv(m, k, alpha, a, rs_a, b, rs_b, beta, c, ldc, epilogue);
+        return;
+    }
+
+    const KernelTable& kt = kernels();
+    const int MR = kt.gemm_mr;
+    const int NR = kt.gemm_nr;
+    const int KC = kt.gemm_kc;
+    const int MC = kt.gemm_mc;
+    const int NC = kt.gemm_nc;
+
+    static thread_local PackBuffer buffer_a;
+    static thread_local PackBuffer buffer_b;
+
+    int max_nc = std::min(NC, n);
+    int max_mc = std::min(MC, m);
+    Scalar* packed_b = buffer_b.get((size_t)KC * ((max_nc + NR - 1) / NR) * NR);
+    Scalar* packed_a = buffer_a.get((size_t)KC * ((max_mc + MR - 1) / MR) * MR);
+
+    bool parallel = (double)m * n * k >= GEMM_PARALLEL_THRESHOLD;
+
+    // Packing A only pays off when each sliver is reused across many slivers
+    // of B. With few columns, as in a forward pass over a small batch, full
+    // slivers of A are read in place and only the ragged last one is packed.
+    bool pack_a = n > GEMM_PACK_A_MIN_COLS * NR;
+
+    #pragma omp parallel if(parallel)
+    {
+        alignas(64) Scalar tile[GEMM_MAX_TILE];
+
+        // L3: kc x nc panel of B
+        for (int jc = 0; jc < n; jc += NC) {
+            int nc = std::min(NC, n - jc);
+            int n_slivers = (nc + NR - 1) / NR;
+
+            for (int pc = 0; pc < k; pc += KC) {
+                int kc = std::min(KC, k - pc);
+                Scalar beta_p = pc == 0 ? beta : Scalar(1);
+                bool last_panel = pc + kc == k;
+
+                #pragma omp for schedule(static)
+                for (int js = 0; js < n_slivers; js++) {
+                    int j0 = jc + js * NR;
+                    packSliverB(std::min(NR, n - j0), kc,
+                                b + (ptrdiff_t)pc * rs_b + (ptrdiff_t)j0 * cs_b,
+                                rs_b, cs_b, NR, packed_b + (size_t)js * NR * kc);
+                }
+
+                // L2: mc x kc block of A
+                for (int ic = 0; ic < m; ic += MC) {
+                    int mc = std::min(MC, m - ic);
+                    int m_slivers = (mc + MR - 1) / MR;
+
+                    #pragma omp for schedule(static)
+                    for (int is = 0; is < m_slivers; is++) {
+                        int i0 = ic + is * MR;
+                        int rows = std::min(MR, m - i0);
+                        if (pack_a || rows < MR) {
+                            packSliverA(rows, kc,
+                                        a + (ptrdiff_t)i0 * rs_a + (ptrdiff_t)pc * cs_a,
+                                        rs_a, cs_a, MR, packed_a + (size_t)is * MR * kc);
+                        }
+                    }
+
+                    // L1: kc x NR sliver of B against MR x kc slivers of A
+                    #pragma omp for collapse(2) schedule(static)
+                    for (int is = 0; is < m_slivers; is++) {
+                        for (int js = 0; js < n_slivers; js++) {
+                            int i0 = ic + is * MR;
+                            int j0 = jc + js * NR;
+                            int mr = std::min(MR, m - i0);
+                            int nr = std::min(NR, n - j0);
+
+                            const Scalar* ap = packed_a + (size_t)is * MR * kc;
+                            int rs_ap = 1;
+                            int cs_ap = MR;
+                            if (!pack_a && mr == MR) {
+                                ap = a + (ptrdiff_t)i0 * rs_a + (ptrdiff_t)pc * cs_a;
+                                rs_ap = rs_a;
+                                cs_ap = cs_a;
+                            }
+
+                            const Scalar* bp = packed_b + (size_t)js * NR * kc;
+                            Scalar* cp = c + (ptrdiff_t)i0 * ldc + j0;
+
+                            if (mr == MR && nr == NR) {
+                                kt.gemm_micro(kc, ap, rs_ap, cs_ap, bp, cp, ldc,
+                                              alpha, beta_p);
+                                if (epilogue && last_panel) {
+                                    applyEpilogue(*epilogue, i0, j0, mr, nr, cp, ldc);
+                                }
+                                continue;
+                            }
+
+                            // Edge tiles are computed whole into a local
+                            // buffer and only the valid part is written back
+                            kt.gemm_micro(kc, ap, rs_ap, cs_ap, bp, tile, NR, 1.0, 0.0);
+                            for (int i = 0; i < mr; i++) {
+                                for (int j = 0; j < nr; j++) {
+                                    Scalar& value = cp[(ptrdiff_t)i * ldc + j];
+                                    Scalar product = alpha * tile[i * NR + j];
+                                    value = beta_p == 0.0 ? product
+                                                          : product + beta_p * value;
+                                }
+                            }
+                            if (epilogue && last_panel) {
+                                applyEpilogue(*epilogue, i0, j0, mr, nr, cp, ldc);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
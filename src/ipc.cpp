@@ -0,0 +1,44 @@
+/*
+ * File: src/ipc.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the protocol spoken by the inference server and its clients.
+ */
+
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "ipc.h"
+
+
+bool sendAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool receiveAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = recv(fd, p, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        p += received;
+        size -= received;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+/*
+ * File: src/kernels.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the runtime selection of the kernel table by instruction set.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include "kernels.h"
+
+
+static const KernelTable* tableFor(Isa isa, MathAccuracy accuracy = MathAccuracy::Exact) {
+    switch (isa) {
+        case Isa::AVX512: return &avx512KernelTable(accuracy);
+        case Isa::AVX2:   return &avx2KernelTable(accuracy);
+        case Isa::SSE2:   return &sse2KernelTable(accuracy);
+        default:          return &scalarKernelTable(accuracy);
+    }
+}
+
+static Isa isaFromEnvironment(Isa fallback) {
+    const char* name = std::getenv("DEEPCPP_ISA");
+    if (name == nullptr) {
+        return fallback;
+    }
+
+    const Isa all[] = { Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512 };
+    for (Isa isa : all) {
+        if (std::strcmp(name, isaName(isa)) == 0) {
+            return isa;
+        }
+    }
+
+    return fallback;
+}
+
+static std::atomic<const KernelTable*>& activeTable() {
+    static std::atomic<const KernelTable*> table(
+        tableFor(std::min(isaFromEnvironment(detectIsa()), detectIsa())));
+    return table;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Isa detectIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Isa::SSE2;
+    }
+#endif
+    return Isa::Scalar;
+}
+
+Isa activeIsa() {
+    return activeTable().load()->isa;
+}
+
+void setIsa(Isa isa) {
+    activeTable().store(tableFor(std::min(isa, detectIsa())));
+}
+
+const char* isaName(Isa isa) {
+    switch (isa) {
+        case Isa::AVX512: return "avx512";
+        case Isa::AVX2:   return "avx2";
+        case Isa::SSE2:   return "sse2";
+        default:          return "scalar";
+    }
+}
+
+const KernelTable& kernels(MathAccuracy accuracy) {
+    const KernelTable* table = activeTable().load(std::memory_order_relaxed);
+    if (accuracy == MathAccuracy::Exact) {
+        return *table;
+    }
+    return *tableFor(table->isa, accuracy);
+}
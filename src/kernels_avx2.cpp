@@ -0,0 +1,13 @@
+/*
+ * File: src/kernels_avx2.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the kernels compiled for AVX2 and FMA.
+ */
+
+#define DEEPCPP_AVX2
+#define KERNEL_NAMESPACE avx2_kernels
+#define KERNEL_TABLE avx2KernelTable
+#define KERNEL_ISA Isa::AVX2
+
+#include "kernels_impl.h"
@@ -0,0 +1,13 @@
+/*
+ * File: src/kernels_avx512.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the kernels compiled for AVX-512.
+ */
+
+#define DEEPCPP_AVX512
+#define KERNEL_NAMESPACE avx512_kernels
+#define KERNEL_TABLE avx512KernelTable
+#define KERNEL_ISA Isa::AVX512
+
+#include "kernels_impl.h"
@@ -0,0 +1,782 @@
+/*
+ * File: src/kernels_impl.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the kernel implementations shared by every instruction set.
+ */
+
+// Each src/kernels_<isa>.cpp file defines KERNEL_NAMESPACE, KERNEL_TABLE,
+// KERNEL_ISA and optionally one of the DEEPCPP_<ISA> macros, and then includes
+// this file. The namespace keeps the code generated for different instruction
+// sets apart, since each file is compiled with its own -m flags.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include "kernels.h"
+
+namespace KERNEL_NAMESPACE {
+
+#include "simd.h"
+#include "simd_math.h"
+
+
+// Elementwise
+//////////////////////////////////////////////////////////////////////////////
+
+// Applies Op over whole vectors and finishes the tail one lane at a time.
+// Op is written once over the Simd interface, so both parts round the same.
+template <typename Op>
+void binaryLoop(size_t n, const Scalar* x, const Scalar* y, Scalar* out) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+    size_t i = 0;
+
+    for (; i + S::width <= n; i += S::width) {
+        S::store(out + i, Op::template apply<S>(S::load(x + i), S::load(y + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = Op::template apply<S1>(x[i], y[i]);
+    }
+}
+
+template <typename Op>
+void unaryLoop(size_t n, const Scalar* x, Scalar a, Scalar* out) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+    size_t i = 0;
+    S::type av = S::set1(a);
+
+    for (; i + S::width <= n; i += S::width) {
+        S::store(out + i, Op::template apply<S>(S::load(x + i), av));
+    }
+    for (; i < n; i++) {
+        out[i] = Op::template apply<S1>(x[i], a);
+    }
+}
+
+#define ELEMENTWISE_OP(name, expression)                                    \
+    struct name {                                                           \
+        template <typename S>                                               \
+        static typename S::type apply(typename S::type x,                   \
+                                      typename S::type y) {                 \
+            return expression;                                              \
+        }                                                                   \
+    };
+
+ELEMENTWISE_OP(AddOp, S::add(x, y))
+ELEMENTWISE_OP(SubOp, S::sub(x, y))
+ELEMENTWISE_OP(MulOp, S::mul(x, y))
+
+// For the unary operations y holds the parameter a
+ELEMENTWISE_OP(ScaleOp, S::mul(y, x))
+ELEMENTWISE_OP(AddScalarOp, S::add(x, y))
+ELEMENTWISE_OP(ReluOp, S::max(x, S::zero()))
+ELEMENTWISE_OP(ReluDerivativeOp,
+               S::select(S::greater(x, S::zero()), S::set1(1), S::zero()))
+ELEMENTWISE_OP(LeakyReluOp,
+               S::select(S::greaterEqual(x, S::zero()), x, S::mul(y, x)))
+ELEMENTWISE_OP(LeakyReluDerivativeOp,
+               S::select(S::greaterEqual(x, S::zero()), S::set1(1), y))
+
+// Derivatives computed from the output of the activation, which round like
+// the ones below because they share the same formula
+ELEMENTWISE_OP(SigmoidOutputDerivativeOp, S::mul(x, S::sub(S::set1(1), x)))
+ELEMENTWISE_OP(TanhOutputDerivativeOp, S::sub(S::set1(1), S::mul(x, x)))
+
+#undef ELEMENTWISE_OP
+
+
+// MathAccuracy::Exact
+//
+// The activations below need libm, which has no vector version with the same
+// rounding, so they are evaluated one element at a time on every instruction
+// set.
+
+const Scalar SQRT2_OVER_PI = std::sqrt(2.0 / M_PI);
+const Scalar GELU_CONSTANT = 0.044715;
+const Scalar INV_SQRT2 = 1.0 / std::sqrt(2.0);
+const Scalar INV_SQRT_2PI = 1.0 / std::sqrt(2.0 * M_PI);
+
+void sigmoidKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = Scalar(1) / (Scalar(1) + std::exp(-x[i]));
+    }
+}
+
+void sigmoidDerivativeKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        Scalar sigmoid_val = Scalar(1) / (Scalar(1) + std::exp(-x[i]));
+        out[i] = sigmoid_val * (Scalar(1) - sigmoid_val);
+    }
+}
+
+void tanhKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::tanh(x[i]);
+    }
+}
+
+void tanhDerivativeKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        Scalar tanh_val = std::tanh(x[i]);
+        out[i] = Scalar(1) - tanh_val * tanh_val;
+    }
+}
+
+void geluKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        Scalar v = x[i];
+        Scalar cdf = Scalar(0.5) * (Scalar(1) + std::tanh(SQRT2_OVER_PI * (v + GELU_CONSTANT * v * v * v)));
+        out[i] = v * cdf;
+    }
+}
+
+// cdf + v * pdf, with the tanh approximation of both
+void geluDerivativeKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        Scalar v = x[i];
+        Scalar tanh_val = std::tanh(SQRT2_OVER_PI * (v + GELU_CONSTANT * v * v * v));
+        Scalar cdf = Scalar(0.5) * (Scalar(1) + tanh_val);
+        out[i] = cdf + Scalar(0.5) * v * (Scalar(1) - tanh_val * tanh_val)
+                 * (SQRT2_OVER_PI * (Scalar(1) + GELU_CONSTANT * Scalar(3) * v * v));
+    }
+}
+
+void geluErfKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        Scalar v = x[i];
+        out[i] = v * (Scalar(0.5) * (Scalar(1) + std::erf(v * INV_SQRT2)));
+    }
+}
+
+void geluErfDerivativeKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        Scalar v = x[i];
+        Scalar cdf = Scalar(0.5) * (Scalar(1) + std::erf(v * INV_SQRT2));
+        out[i] = cdf + v * (INV_SQRT_2PI * std::exp(Scalar(-0.5) * v * v));
+    }
+}
+
+void expKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::exp(x[i]);
+    }
+}
+
+void logKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::log(x[i]);
+    }
+}
+
+void erfKernel(size_t n, const Scalar* x, Scalar, Scalar* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::erf(x[i]);
+    }
+}
+
+
+// MathAccuracy::High and MathAccuracy::Fast
+//
+// The same functions built on the approximations of src/simd_math.h, which
+// vectorize. Tier is HighAccuracy or FastAccuracy.
+
+#define APPROXIMATE_OP(name, expression)                                    \
+    template <typename Tier>                                                \
+    struct name {                                                           \
+        template <typename S>                                               \
+        static typename S::type apply(typename S::type x,                   \
+                                      typename S::type) {                   \
+            return expression;                                              \
+        }                                                                   \
+    };
+
+// sqrt(2 / pi) * (x + 0.044715 * x^3)
+template <typename S>
+typename S::type geluTanhArgument(typename S::type x) {
+    typename S::type x3 = S::mul(S::mul(S::set1(GELU_CONSTANT), x), S::mul(x, x));
+    return S::mul(S::set1(SQRT2_OVER_PI), S::add(x, x3));
+}
+
+// 0.5 * (1 + erf(x / sqrt(2)))
+template <typename S, typename Tier>
+typename S::type normalCdf(typename S::type x) {
+    typename S::type e = simdErf<S, Tier>(S::mul(x, S::set1(INV_SQRT2)));
+    return S::mul(S::set1(Scalar(0.5)), S::add(S::set1(1), e));
+}
+
+template <typename S, typename Tier>
+typename S::type sigmoid(typename S::type x) {
+    typename S::type e = simdExp<S, Tier>(S::sub(S::zero(), x));
+    return S::div(S::set1(1), S::add(S::set1(1), e));
+}
+
+APPROXIMATE_OP(ExpOp, (simdExp<S, Tier>(x)))
+APPROXIMATE_OP(LogOp, (simdLog<S, Tier>(x)))
+APPROXIMATE_OP(ErfOp, (simdErf<S, Tier>(x)))
+APPROXIMATE_OP(SigmoidOp, (sigmoid<S, Tier>(x)))
+APPROXIMATE_OP(SigmoidDerivativeOp,
+               (SigmoidOutputDerivativeOp::apply<S>(sigmoid<S, Tier>(x), x)))
+APPROXIMATE_OP(TanhOp, (simdTanh<S, Tier>(x)))
+APPROXIMATE_OP(TanhDerivativeOp,
+               (TanhOutputDerivativeOp::apply<S>(simdTanh<S, Tier>(x), x)))
+APPROXIMATE_OP(GeluOp,
+               (S::mul(x, S::mul(S::set1(Scalar(0.5)),
+                                 S::add(S::set1(1), simdTanh<S, Tier>(geluTanhArgument<S>(x)))))))
+APPROXIMATE_OP(GeluErfOp, (S::mul(x, normalCdf<S, Tier>(x))))
+
+template <typename Tier>
+struct GeluDerivativeOp {
+    template <typename S>
+    static typename S::type apply(typename S::type x, typename S::type) {
+        typename S::type t = simdTanh<S, Tier>(geluTanhArgument<S>(x));
+        typename S::type cdf = S::mul(S::set1(Scalar(0.5)), S::add(S::set1(1), t));
+        typename S::type slope = S::mul(S::set1(SQRT2_OVER_PI),
+                                        S::add(S::set1(1), S::mul(S::set1(GELU_CONSTANT * 3),
+                                                                  S::mul(x, x))));
+        typename S::type pdf = S::mul(S::mul(S::set1(Scalar(0.5)),
+                                             S::sub(S::set1(1), S::mul(t, t))), slope);
+        return S::add(cdf, S::mul(x, pdf));
+    }
+};
+
+template <typename Tier>
+struct GeluErfDerivativeOp {
+    template <typename S>
+    static typename S::type apply(typename S::type x, typename S::type) {
+        typename S::type half_x2 = S::mul(S::set1(Scalar(-0.5)), S::mul(x, x));
+        typename S::type pdf = S::mul(S::set1(INV_SQRT_2PI), simdExp<S, Tier>(half_x2));
+        return S::add(normalCdf<S, Tier>(x), S::mul(x, pdf));
+    }
+};
+
+#undef APPROXIMATE_OP
+
+// Replaces the transcendental kernels of an exact table
+template <typename Tier>
+KernelTable approximateTable(KernelTable table, MathAccuracy accuracy) {
+    table.accuracy = accuracy;
+    table.sigmoid = unaryLoop<SigmoidOp<Tier> >;
+    table.sigmoid_derivative = unaryLoop<SigmoidDerivativeOp<Tier> >;
+    table.tanh = unaryLoop<TanhOp<Tier> >;
+    table.tanh_derivative = unaryLoop<TanhDerivativeOp<Tier> >;
+    table.gelu = unaryLoop<GeluOp<Tier> >;
+    table.gelu_derivative = unaryLoop<GeluDerivativeOp<Tier> >;
+    table.gelu_erf = unaryLoop<GeluErfOp<Tier> >;
+    table.gelu_erf_derivative = unaryLoop<GeluErfDerivativeOp<Tier> >;
+    table.exp = unaryLoop<ExpOp<Tier> >;
+    table.log = unaryLoop<LogOp<Tier> >;
+    table.erf = unaryLoop<ErfOp<Tier> >;
+    return table;
+}
+
+
+// Random numbers
+//////////////////////////////////////////////////////////////////////////////
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"). PHILOX_LANES blocks are run through the ten rounds side by side, so
+// that the 32 x 32 -> 64 bit products vectorize with the -m flags of the
+// file. Only integer arithmetic, so every instruction set agrees.
+const int PHILOX_LANES = 16;
+
+void philoxKernel(size_t n_blocks, uint64_t first, uint64_t stream, uint64_t key,
+                  uint32_t* out) {
+    const uint32_t M0 = 0xD2511F53;
+    const uint32_t M1 = 0xCD9E8D57;
+    const uint32_t W0 = 0x9E3779B9;
+    const uint32_t W1 = 0xBB67AE85;
+
+    for (size_t b = 0; b < n_blocks; b += PHILOX_LANES) {
+        uint32_t r0[PHILOX_LANES], r1[PHILOX_LANES], r2[PHILOX_LANES], r3[PHILOX_LANES];
+
+        #pragma omp simd
+        for (int l = 0; l < PHILOX_LANES; l++) {
+            uint64_t counter = first + b + l;
+            uint32_t c0 = (uint32_t)counter;
+            uint32_t c1 = (uint32_t)(counter >> 32);
+            uint32_t c2 = (uint32_t)stream;
+            uint32_t c3 = (uint32_t)(stream >> 32);
+            uint32_t k0 = (uint32_t)key;
+            uint32_t k1 = (uint32_t)(key >> 32);
+
+            for (int round = 0; round < 10; round++) {
+                uint64_t p0 = (uint64_t)M0 * c0;
+                uint64_t p1 = (uint64_t)M1 * c2;
+                c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+                c1 = (uint32_t)p1;
+                c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+                c3 = (uint32_t)p0;
+                k0 += W0;
+                k1 += W1;
+            }
+
+            r0[l] = c0;
+            r1[l] = c1;
+            r2[l] = c2;
+            r3[l] = c3;
+        }
+
+        size_t n = n_blocks - b < (size_t)PHILOX_LANES ? n_blocks - b : PHILOX_LANES;
+        for (size_t l = 0; l < n; l++) {
+            out[4 * (b + l) + 0] = r0[l];
+            out[4 * (b + l) + 1] = r1[l];
+            out[4 * (b + l) + 2] = r2[l];
+            out[4 * (b + l) + 3] = r3[l];
+        }
+    }
+}
+
+
+// GEMM
+//////////////////////////////////////////////////////////////////////////////
+
+#if defined(DEEPCPP_AVX512) && defined(__AVX512F__)
+const int GEMM_MR = 8;
+const int GEMM_NV = 3;
+const int GEMM_KC = 192;
+const int GEMM_MC = 96;
+#elif defined(DEEPCPP_AVX2) && defined(__AVX2__)
+const int GEMM_MR = 6;
+const int GEMM_NV = 2;
+const int GEMM_KC = 192;
+const int GEMM_MC = 96;
+#elif defined(DEEPCPP_SSE2) && defined(__SSE2__)
+const int GEMM_MR = 4;
+const int GEMM_NV = 3;
+const int GEMM_KC = 192;
+const int GEMM_MC = 64;
+#else
+const int GEMM_MR = 4;
+const int GEMM_NV = 4;
+const int GEMM_KC = 192;
+const int GEMM_MC = 64;
+#endif
+
+const int GEMM_NR = GEMM_NV * Simd<Scalar>::width;
+const int GEMM_NC = 4096 - 4096 % GEMM_NR;
+
+
+// The MR x NR tile of C is kept in MR * NV registers while the panels are
+// streamed: each k step loads NV vectors of B and broadcasts MR values of A.
+void gemmMicroKernel(int kc, const Scalar* a, int rs_a, int cs_a,
+                     const Scalar* b, Scalar* c, int ldc,
+                     Scalar alpha, Scalar beta) {
+    typedef Simd<Scalar> S;
+    S::type acc[GEMM_MR][GEMM_NV];
+
+    for (int i = 0; i < GEMM_MR; i++) {
+        for (int v = 0; v < GEMM_NV; v++) {
+            acc[i][v] = S::zero();
+        }
+    }
+
+    for (int p = 0; p < kc; p++) {
+        S::type bv[GEMM_NV];
+        for (int v = 0; v < GEMM_NV; v++) {
+            bv[v] = S::load(b + v * S::width);
+        }
+
+        for (int i = 0; i < GEMM_MR; i++) {
+            S::type av = S::set1(a[i * rs_a]);
+            for (int v = 0; v < GEMM_NV; v++) {
+                acc[i][v] = S::fmadd(av, bv[v], acc[i][v]);
+            }
+        }
+
+        a += cs_a;
+        b += GEMM_NR;
+    }
+
+    S::type alpha_v = S::set1(alpha);
+    S::type beta_v = S::set1(beta);
+
+    for (int i = 0; i < GEMM_MR; i++) {
+        for (int v = 0; v < GEMM_NV; v++) {
+            Scalar* cp = c + i * ldc + v * S::width;
+            S::type r = S::mul(acc[i][v], alpha_v);
+            if (beta != 0) {
+                r = S::fmadd(beta_v, S::load(cp), r);
+            }
+            S::store(cp, r);
+        }
+    }
+}
+
+
+
+// GEMV
+//////////////////////////////////////////////////////////////////////////////
+
+const int GEMV_ROWS = 4;
+
+template <typename S>
+static Scalar horizontalSum(typename S::type v) {
+    alignas(64) Scalar lanes[S::width];
+    S::store(lanes, v);
+    Scalar sum = 0;
+    for (int l = 0; l < S::width; l++) {
+        sum += lanes[l];
+    }
+    return sum;
+}
+
+// Four accumulators hide the latency of the adds
+double sumSquaresKernel(size_t n, const Scalar* x) {
+    typedef Simd<Scalar> S;
+    S::type acc[4] = { S::zero(), S::zero(), S::zero(), S::zero() };
+
+    size_t i = 0;
+    for (; i + 4 * S::width <= n; i += 4 * S::width) {
+        for (int r = 0; r < 4; r++) {
+            S::type v = S::load(x + i + r * S::width);
+            acc[r] = S::fmadd(v, v, acc[r]);
+        }
+    }
+    for (; i + S::width <= n; i += S::width) {
+        S::type v = S::load(x + i);
+        acc[0] = S::fmadd(v, v, acc[0]);
+    }
+
+    double sum = horizontalSum<S>(S::add(S::add(acc[0], acc[1]), S::add(acc[2], acc[3])));
+    for (; i < n; i++) {
+        sum += (double)x[i] * x[i];
+    }
+    return sum;
+}
+
+template <typename S>
+static void adamStep(typename S::type& w, typename S::type g,
+                     typename S::type& m, typename S::type& v, const AdamStep& step) {
+    typedef typename S::type V;
+    V one = S::set1(1);
+    V beta1 = S::set1(step.beta1);
+    V beta2 = S::set1(step.beta2);
+
+    g = S::mul(g, S::set1(step.grad_scale));
+    m = S::add(S::mul(beta1, m), S::mul(S::sub(one, beta1), g));
+    v = S::add(S::mul(beta2, v), S::mul(S::sub(one, beta2), S::mul(g, g)));
+    V denominator = S::add(S::mul(S::sqrt(v), S::set1(step.correction2)),
+                           S::set1(step.epsilon));
+    w = S::sub(S::mul(S::set1(step.decay), w),
+               S::div(S::mul(S::set1(step.step_size), m), denominator));
+}
+
+// Each parameter is read and written once, so the step runs at the speed of
+// memory
+void adamStepKernel(size_t n, Scalar* w, const Scalar* g, Scalar* m, Scalar* v,
+                    const AdamStep& step) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+
+    size_t i = 0;
+    for (; i + S::width <= n; i += S::width) {
+        S::type wv = S::load(w + i), mv = S::load(m + i), vv = S::load(v + i);
+        adamStep<S>(wv, S::load(g + i), mv, vv, step);
+        S::store(w + i, wv);
+        S::store(m + i, mv);
+        S::store(v + i, vv);
+    }
+    for (; i < n; i++) {
+        adamStep<S1>(w[i], g[i], m[i], v[i], step);
+    }
+}
+
+template <typename S>
+static void sgdStep(typename S::type& w, typename S::type g, typename S::type* u,
+                    const SgdStep& step) {
+    typedef typename S::type V;
+    V momentum = S::set1(step.momentum);
+
+    g = S::mul(g, S::set1(step.grad_scale));
+    V direction = g;
+    if (u) {
+        *u = S::add(S::mul(momentum, *u), g);
+        direction = step.nesterov ? S::add(g, S::mul(momentum, *u)) : *u;
+    }
+    w = S::sub(w, S::mul(S::set1(step.learn_rate), direction));
+}
+
+void sgdStepKernel(size_t n, Scalar* w, const Scalar* g, Scalar* velocity,
+                   const SgdStep& step) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+
+    size_t i = 0;
+    for (; i + S::width <= n; i += S::width) {
+        S::type wv = S::load(w + i);
+        if (velocity) {
+            S::type uv = S::load(velocity + i);
+            sgdStep<S>(wv, S::load(g + i), &uv, step);
+            S::store(velocity + i, uv);
+        } else {
+            sgdStep<S>(wv, S::load(g + i), nullptr, step);
+        }
+        S::store(w + i, wv);
+    }
+    for (; i < n; i++) {
+        sgdStep<S1>(w[i], g[i], velocity ? velocity + i : nullptr, step);
+    }
+}
+
+template <typename S>
+static void larsStep(typename S::type& w, typename S::type g, typename S::type& u,
+                     const LarsStep& step) {
+    g = S::add(S::mul(S::set1(step.grad_scale), g), S::mul(S::set1(step.weight_decay), w));
+    u = S::add(S::mul(S::set1(step.momentum), u), S::mul(S::set1(step.local_rate), g));
+    w = S::sub(w, u);
+}
+
+void larsStepKernel(size_t n, Scalar* w, const Scalar* g, Scalar* u, const LarsStep& step) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+
+    size_t i = 0;
+    for (; i + S::width <= n; i += S::width) {
+        S::type wv = S::load(w + i), uv = S::load(u + i);
+        larsStep<S>(wv, S::load(g + i), uv, step);
+        S::store(w + i, wv);
+        S::store(u + i, uv);
+    }
+    for (; i < n; i++) {
+        larsStep<S1>(w[i], g[i], u[i], step);
+    }
+}
+
+template <typename S>
+static typename S::type lambDirection(typename S::type w, typename S::type m,
+                                      typename S::type v, const LambStep& step) {
+    typename S::type denominator = S::add(S::mul(S::sqrt(v), S::set1(step.correction2)),
+                                          S::set1(step.epsilon));
+    return S::add(S::div(S::mul(S::set1(step.correction1), m), denominator),
+                  S::mul(S::set1(step.weight_decay), w));
+}
+
+template <typename S>
+static typename S::type lambMoments(typename S::type w, typename S::type g,
+                                    typename S::type& m, typename S::type& v,
+                                    const LambStep& step) {
+    typedef typename S::type V;
+    V one = S::set1(1);
+    V beta1 = S::set1(step.beta1);
+    V beta2 = S::set1(step.beta2);
+
+    g = S::mul(g, S::set1(step.grad_scale));
+    m = S::add(S::mul(beta1, m), S::mul(S::sub(one, beta1), g));
+    v = S::add(S::mul(beta2, v), S::mul(S::sub(one, beta2), S::mul(g, g)));
+    V r = lambDirection<S>(w, m, v, step);
+    return S::mul(r, r);
+}
+
+double lambMomentsKernel(size_t n, const Scalar* w, const Scalar* g, Scalar* m, Scalar* v,
+                         const LambStep& step) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+
+    S::type acc = S::zero();
+    size_t i = 0;
+    for (; i + S::width <= n; i += S::width) {
+        S::type mv = S::load(m + i), vv = S::load(v + i);
+        acc = S::add(acc, lambMoments<S>(S::load(w + i), S::load(g + i), mv, vv, step));
+        S::store(m + i, mv);
+        S::store(v + i, vv);
+    }
+
+    double sum = horizontalSum<S>(acc);
+    for (; i < n; i++) {
+        sum += lambMoments<S1>(w[i], g[i], m[i], v[i], step);
+    }
+    return sum;
+}
+
+void lambApplyKernel(size_t n, Scalar* w, const Scalar* m, const Scalar* v,
+                     const LambStep& step, Scalar rate) {
+    typedef Simd<Scalar> S;
+    typedef SimdScalar<Scalar> S1;
+    S::type rate_v = S::set1(rate);
+
+    size_t i = 0;
+    for (; i + S::width <= n; i += S::width) {
+        S::type wv = S::load(w + i);
+        S::type r = lambDirection<S>(wv, S::load(m + i), S::load(v + i), step);
+        S::store(w + i, S::sub(wv, S::mul(rate_v, r)));
+    }
+    for (; i < n; i++) {
+        w[i] -= rate * lambDirection<S1>(w[i], m[i], v[i], step);
+    }
+}
+
+// Values of the codes of 8-bit moments, for a scale of 1. See kernels.h.
+struct QuantizationTables {
+    Scalar m[255];   // Codes -127 to 127
+    Scalar v[256];
+
+    QuantizationTables() {
+        for (int c = -127; c <= 127; c++) {
+            Scalar x = Scalar(c) / 127;
+            m[c + 127] = c < 0 ? -x * x : x * x;
+        }
+        for (int c = 0; c <= 255; c++) {
+            Scalar x = Scalar(c) / 255;
+            v[c] = (x * x) * (x * x);
+        }
+    }
+};
+
+static int quantizationCode(Scalar x, Scalar levels, int max_code) {
+    int code = (int)std::floor(x * levels + Scalar(0.5));
+    return code < max_code ? code : max_code;
+}
+
+void adamStep8bitKernel(size_t n, Scalar* w, const Scalar* g, int8_t* m, uint8_t* v,
+                        float* m_scales, float* v_scales, const AdamStep& step) {
+    static const QuantizationTables tables;
+    Scalar mq[QUANTIZATION_BLOCK];
+    Scalar vq[QUANTIZATION_BLOCK];
+
+    for (size_t begin = 0, block = 0; begin < n; begin += QUANTIZATION_BLOCK, block++) {
+        size_t size = n - begin < QUANTIZATION_BLOCK ? n - begin : QUANTIZATION_BLOCK;
+
+        Scalar m_scale = m_scales[block];
+        Scalar v_scale = v_scales[block];
+        for (size_t i = 0; i < size; i++) {
+            mq[i] = m_scale * tables.m[m[begin + i] + 127];
+            vq[i] = v_scale * tables.v[v[begin + i]];
+        }
+
+        adamStepKernel(size, w + begin, g + begin, mq, vq, step);
+
+        Scalar m_max = 0;
+        Scalar v_max = 0;
+        for (size_t i = 0; i < size; i++) {
+            Scalar m_abs = std::fabs(mq[i]);
+            m_max = m_abs > m_max ? m_abs : m_max;
+            v_max = vq[i] > v_max ? vq[i] : v_max;
+        }
+        m_scales[block] = (float)m_max;
+        v_scales[block] = (float)v_max;
+
+        // Codes are taken relative to the stored scales, which may have been
+        // rounded to float
+        m_scale = m_scales[block];
+        v_scale = v_scales[block];
+        for (size_t i = 0; i < size; i++) {
+            int m_code = m_scale > 0
+                ? quantizationCode(std::sqrt(std::fabs(mq[i]) / m_scale), 127, 127) : 0;
+            m[begin + i] = (int8_t)(mq[i] < 0 ? -m_code : m_code);
+            v[begin + i] = (uint8_t)(v_scale > 0
+                ? quantizationCode(std::sqrt(std::sqrt(vq[i] / v_scale)), 255, 255) : 0);
+        }
+    }
+}
+
+// GEMV_ROWS rows of A are walked together, so each vector of x is loaded
+// once for all of them and every row is read exactly once, in order.
+void gemvKernel(int m, int k, const Scalar* a, int lda, const Scalar* x,
+                Scalar* y, int incy, Scalar alpha, Scalar beta) {
+    typedef Simd<Scalar> S;
+    int kv = k - k % S::width;
+
+    int i = 0;
+    for (; i + GEMV_ROWS <= m; i += GEMV_ROWS) {
+        S::type acc[GEMV_ROWS];
+        for (int r = 0; r < GEMV_ROWS; r++) {
+            acc[r] = S::zero();
+        }
+
+        for (int p = 0; p < kv; p += S::width) {
+            S::type xv = S::load(x + p);
+            for (int r = 0; r < GEMV_ROWS; r++) {
+                acc[r] = S::fmadd(S::load(a + (ptrdiff_t)(i + r) * lda + p), xv, acc[r]);
+            }
+        }
+
+        for (int r = 0; r < GEMV_ROWS; r++) {
+            const Scalar* row = a + (ptrdiff_t)(i + r) * lda;
+            Scalar sum = horizontalSum<S>(acc[r]);
+            for (int p = kv; p < k; p++) {
+                sum += row[p] * x[p];
+            }
+            Scalar& out = y[(ptrdiff_t)(i + r) * incy];
+            out = beta == 0 ? alpha * sum : alpha * sum + beta * out;
+        }
+    }
+
+    for (; i < m; i++) {
+        const Scalar* row = a + (ptrdiff_t)i * lda;
+        S::type acc = S::zero();
+        for (int p = 0; p < kv; p += S::width) {
+            acc = S::fmadd(S::load(row + p), S::load(x + p), acc);
+        }
+        Scalar sum = horizontalSum<S>(acc);
+        for (int p = kv; p < k; p++) {
+            sum += row[p] * x[p];
+        }
+        Scalar& out = y[(ptrdiff_t)i * incy];
+        out = beta == 0 ? alpha * sum : alpha * sum + beta * out;
+    }
+}
+
+} // namespace KERNEL_NAMESPACE
+
+
+const KernelTable& KERNEL_TABLE(MathAccuracy accuracy) {
+    using namespace KERNEL_NAMESPACE;
+
+    static const KernelTable exact = {
+        KERNEL_ISA,
+        MathAccuracy::Exact,
+        binaryLoop<AddOp>,
+        binaryLoop<SubOp>,
+        binaryLoop<MulOp>,
+        unaryLoop<ScaleOp>,
+        unaryLoop<AddScalarOp>,
+        sumSquaresKernel,
+        adamStepKernel,
+        sgdStepKernel,
+        adamStep8bitKernel,
+        larsStepKernel,
+        lambMomentsKernel,
+        lambApplyKernel,
+        unaryLoop<ReluOp>,
+        unaryLoop<ReluDerivativeOp>,
+        unaryLoop<LeakyReluOp>,
+        unaryLoop<LeakyReluDerivativeOp>,
+        sigmoidKernel,
+        sigmoidDerivativeKernel,
+        tanhKernel,
+        tanhDerivativeKernel,
+        unaryLoop<SigmoidOutputDerivativeOp>,
+        unaryLoop<TanhOutputDerivativeOp>,
+        geluKernel,
+        geluDerivativeKernel,
+        geluErfKernel,
+        geluErfDerivativeKernel,
+        expKernel,
+        logKernel,
+        erfKernel,
+        philoxKernel,
+        GEMM_MR,
+        GEMM_NR,
+        gemmMicroKernel,
+        gemvKernel,
+        GEMM_KC,
+        GEMM_MC,
+        GEMM_NC
+    };
+    static const KernelTable high = approximateTable<HighAccuracy>(exact, MathAccuracy::High);
+    static const KernelTable fast = approximateTable<FastAccuracy>(exact, MathAccuracy::Fast);
+
+    switch (accuracy) {
+        case MathAccuracy::High: return high;
+        case MathAccuracy::Fast: return fast;
+        default:                 return exact;
+    }
+}
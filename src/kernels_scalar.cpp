@@ -0,0 +1,12 @@
+/*
+ * File: src/kernels_scalar.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the kernels compiled for the portable scalar reference.
+ */
+
+#define KERNEL_NAMESPACE scalar_kernels
+#define KERNEL_TABLE scalarKernelTable
+#define KERNEL_ISA Isa::Scalar
+
+#include "kernels_impl.h"
@@ -0,0 +1,13 @@
+/*
+ * File: src/kernels_sse2.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the kernels compiled for SSE2.
+ */
+
+#define DEEPCPP_SSE2
+#define KERNEL_NAMESPACE sse2_kernels
+#define KERNEL_TABLE sse2KernelTable
+#define KERNEL_ISA Isa::SSE2
+
+#include "kernels_impl.h"
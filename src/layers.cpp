@@ -7,441 +7,517 @@
 
 #include <cmath>
 #include <iostream>
-#include <random>
 #include <algorithm>
-#include <chrono>
+#include <stdexcept>
 
 #include "layers.h"
 #include "algebra.h"
 #include "NNUtils.h"
+#include "elementwise.h"
 
 // Layers
 ////////////////////////////////////////////////////////////////////////////////
 
-Matrix Layer::getDelta(){
+Tensor Layer::forward(const Tensor& input_) {
+    Tensor output;
+    forward(input_, output);
+    return output;
+}
+
+Tensor Layer::backward(const Tensor& prev_delta) {
+    Tensor delta_out;
+    backward(prev_delta, delta_out);
+    return delta_out;
+}
+
+Tensor Layer::getDelta(){
     return delta;
 }
 
-Matrix Layer::getInput(){
+Tensor Layer::getInput(){
     return input;
 }
 
+void Layer::setTraining(bool training_) {
+    training = training_;
+    if (!training) {
+        input = Tensor();
+        delta = Tensor();
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 Linear::Linear(int input_size, int output_size) {
 
-    W = Matrix(output_size, Vector(input_size, 0));
-    b = Vector(output_size, 0);
-    dW = Matrix(output_size, Vector(input_size, 0));
-    db = Vector(output_size, 0);
+    W = Tensor(output_size, input_size, 0);
+    b = Tensor(output_size, 1, 0);
+    dW = Tensor(output_size, input_size, 0);
+    db = Tensor(output_size, 1, 0);
 
     initWeightsBias(W, b);
 }
 
-Matrix Linear::forward(const Matrix& input_){
-    input = input_;
-    return sum(dot(W, input),b);
+Linear::Linear(const Tensor& W, const Tensor& b) : W(W), b(b) {}
+
+void Linear::forward(const Tensor& input_, Tensor& output){
+    if (training) {
+        input = input_;
+    }
+    predict(input_, output);
 }
 
-Matrix Linear::backward(const Matrix& prev_delta){
+void Linear::predict(const Tensor& input_, Tensor& output) const {
+    dense_into(output, W, input_, b);
+}
 
-    // lineal entrada dZ
-    dW = dot(prev_delta, T(input));
-    db = rowsSum(prev_delta);
-    delta = dot(T(W), prev_delta);
+void Linear::backward(const Tensor& prev_delta, Tensor& delta_out){
 
-    return delta;
+    // lineal entrada dZ
+    // dW = prev_delta * input^T and delta = W^T * prev_delta, with the
+    // transposes read in place
+    dW.ensureShape(W.rows(), W.cols());
+    gemm(false, true, 1.0, prev_delta, input, 0.0, dW);
+    rowsSum_into(db, prev_delta);
+    delta_out.ensureShape(W.cols(), prev_delta.cols());
+    gemm(true, false, 1.0, W, prev_delta, 0.0, delta_out);
+
+    delta = delta_out;
 }
 
 
-void Linear::initWeightsBias(Matrix & W, Vector & b){
+void Linear::initWeightsBias(Tensor & W, Tensor & b){
     
-    for(int i = 0; i < W.size();i++){
-        b[i]=((double)rand()/RAND_MAX)-0.5;
-        for(int j = 0; j < W[0].size(); j++){
-            W[i][j]=((double)rand()/RAND_MAX)-0.5;
+    for(int i = 0; i < W.rows();i++){
+        b(i, 0)=((double)rand()/RAND_MAX)-0.5;
+        for(int j = 0; j < W.cols(); j++){
+            W(i, j)=((double)rand()/RAND_MAX)-0.5;
         }
     }
 }
 
 Vector Linear::getGradient() {
 
-    int total_size = dW.size() * dW[0].size() + db.size();
+    size_t total_size = dW.size() + db.size();
 
     Vector gradient;
     gradient.reserve(total_size);
 
-    for (const auto& row : dW) {
-        for (const auto& elem : row) {
-            gradient.push_back(elem);
-        }
+    for (size_t i = 0; i < dW.size(); i++) {
+        gradient.push_back(dW[i]);
     }
 
-    for (const auto& elem : db) {
-        gradient.push_back(elem);
+    for (size_t i = 0; i < db.size(); i++) {
+        gradient.push_back(db[i]);
     }
 
     return gradient;
 }
 
 void Linear::scaleGradient(double scale) {
-    for (auto& row : dW) {
-        for (auto& elem : row) {
-            elem *= scale;
-        }
+    for (size_t i = 0; i < dW.size(); i++) {
+        dW[i] *= scale;
     }
 
-    for (auto& elem : db) {
-        elem *= scale;
+    for (size_t i = 0; i < db.size(); i++) {
+        db[i] *= scale;
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-LeakyRelu::LeakyRelu(double alpha) : alpha(alpha) {}
+Activation::Activation(ActivationCache cache) : cache(cache) {}
 
-Matrix LeakyRelu::forward(const Matrix &input_) {
-    input = input_;
-    Matrix output;
-    resize(output, input);
-
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < output.size(); i++) {
-        for (int j = 0; j < output[0].size(); j++) {
-            output[i][j] = input[i][j] >= 0 ? input[i][j]:(alpha * input[i][j]);
-        }
+void Activation::setCache(ActivationCache cache_) {
+    if (!supportsCache(cache_)) {
+        throw std::invalid_argument("Activation: unsupported cache");
     }
-
-    return output;
-}
-
-Matrix LeakyRelu::backward(const Matrix &prev_delta) {
-    delta = hadamard(prev_delta, derivative(input));
-    return delta;
+    cache = cache_;
+    output = Tensor();
+    mask.clear();
 }
 
-Matrix LeakyRelu::derivative(const Matrix &input) {
-    Matrix derivative;
-    resize(derivative, input);
-    
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < derivative.size(); i++) {
-        for (int j = 0; j < derivative[0].size(); j++) {
-            derivative[i][j] = input[i][j] >= 0 ? 1.0 : alpha;
-        }
+void Activation::setTraining(bool training_) {
+    Layer::setTraining(training_);
+    if (!training) {
+        output = Tensor();
+        mask.clear();
+        mask.shrink_to_fit();
     }
-
-    return derivative;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Matrix SoftMax::forward(const Matrix& input_) {
-    input = input_;
-    Matrix output;
-    resize(output, input);
+KernelActivation::KernelActivation(UnaryKernel KernelTable::* function,
+                                   UnaryKernel KernelTable::* derivative,
+                                   UnaryKernel KernelTable::* output_derivative,
+                                   MaskRule mask_rule,
+                                   ActivationCache cache)
+    : Activation(cache), function(function), derivative(derivative),
+      output_derivative(output_derivative), mask_rule(mask_rule) {}
+
+bool KernelActivation::supportsCache(ActivationCache cache) const {
+    switch (cache) {
+    case ActivationCache::Input:
+        return true;
+    case ActivationCache::Output:
+        return output_derivative != nullptr;
+    case ActivationCache::Mask:
+        return mask_rule != NoMask;
+    }
+    return false;
+}
 
-    #pragma omp parallel for
-    for (int j = 0; j < input[0].size(); j++) {
-        double max_val = -INFINITY;
-        //Calculamos tamaño máximo
-        for (int i = 0; i < input.size(); i++) {
-            if (input[i][j] > max_val) {
-                max_val = input[i][j];
-            }
-        }
-        double sum = 0;
-        for (int i = 0; i < input.size(); i++) {
-            double exp_val = exp(input[i][j] - max_val);
-            output[i][j] = exp_val;
-            sum += exp_val;
-        }
-        for (int i = 0; i < input.size(); i++) {
-            output[i][j] /= sum;
-        }
+void KernelActivation::forward(const Tensor &input_, Tensor &output_) {
+    predict(input_, output_);
+
+    if (!training) {
+        return;
     }
 
-    return output;
+    switch (cache) {
+    case ActivationCache::Input:
+        input = input_;
+        break;
+    case ActivationCache::Output:
+        output = output_;
+        break;
+    case ActivationCache::Mask:
+        packMask(input_, mask_rule == NonNegative, mask);
+        break;
+    }
 }
 
-Matrix SoftMax::backward(const Matrix& prev_delta) {
-    delta = hadamard(prev_delta, derivative(input));
-    return delta;
+void KernelActivation::predict(const Tensor &input_, Tensor &output_) const {
+    output_.ensureShape(input_.rows(), input_.cols());
+    applyKernel(kernels(math_accuracy).*function, input_, parameter(), output_);
 }
 
-Matrix SoftMax::derivative(const Matrix &input) {
-    Matrix derivative;
-    resize(derivative, input);
-    
-    #pragma omp parallel for
-    for (int i = 0; i < derivative.size(); i++) {
-        
-        double max_input = *std::max_element(input[i].begin(), input[i].end());
-
-        double sum_exp = 0.0;
-        for (int j = 0; j < derivative[0].size(); j++) {
-            sum_exp += exp(input[i][j] - max_input);
-        }
-        
-        for (int j = 0; j < derivative[0].size(); j++) {
-            double softmax_val = exp(input[i][j] - max_input) / sum_exp;
-            derivative[i][j] = softmax_val * (1.0 - softmax_val);
-        }
+void KernelActivation::backward(const Tensor &prev_delta, Tensor &delta_out) {
+    const KernelTable& kt = kernels(math_accuracy);
+
+    switch (cache) {
+    case ActivationCache::Input:
+        eval_into(delta_out, hadamard(prev_delta, elementwise(kt.*derivative,
+                                                              input, parameter())));
+        break;
+    case ActivationCache::Output:
+        eval_into(delta_out, hadamard(prev_delta, elementwise(kt.*output_derivative,
+                                                              output, parameter())));
+        break;
+    case ActivationCache::Mask:
+        delta_out.ensureShape(prev_delta.rows(), prev_delta.cols());
+        applyMask(prev_delta, mask, mask_rule == NonNegative ? parameter() : 0, delta_out);
+        break;
     }
-
-    return derivative;
+    delta = delta_out;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Matrix Relu::forward(const Matrix &input_) {
-    input = input_;
-    Matrix output;
-    resize(output, input);
-
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < output.size(); i++) {
-        for (int j = 0; j < output[0].size(); j++) {
-            output[i][j] = std::max(0.0, input[i][j]);
-        }
-    }
+Relu::Relu(ActivationCache cache)
+    : KernelActivation(&KernelTable::relu, &KernelTable::relu_derivative,
+                       &KernelTable::relu_derivative, Positive, cache) {
+    setCache(cache);
+}
 
-    return output;
+LeakyRelu::LeakyRelu(double alpha, ActivationCache cache)
+    : KernelActivation(&KernelTable::leaky_relu, &KernelTable::leaky_relu_derivative,
+                       &KernelTable::leaky_relu_derivative, NonNegative, cache),
+      alpha(alpha) {
+    setCache(cache);
 }
 
-Matrix Relu::backward(const Matrix &prev_delta) {
-    delta = hadamard(prev_delta, derivative(input));
-    return delta;
+Sigmoid::Sigmoid(ActivationCache cache)
+    : KernelActivation(&KernelTable::sigmoid, &KernelTable::sigmoid_derivative,
+                       &KernelTable::sigmoid_output_derivative, NoMask, cache) {
+    setCache(cache);
 }
 
-Matrix Relu::derivative(const Matrix &input_) {
-    input = input_;
-    Matrix derivative;
-    resize(derivative, input);
-    
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < derivative.size(); i++) {
-        for (int j = 0; j < derivative[0].size(); j++) {
-            derivative[i][j] = input[i][j] > 0 ? 1.0 : 0.0;
-        }
-    }
+Tanh::Tanh(ActivationCache cache)
+    : KernelActivation(&KernelTable::tanh, &KernelTable::tanh_derivative,
+                       &KernelTable::tanh_output_derivative, NoMask, cache) {
+    setCache(cache);
+}
 
-    return derivative;
+Gelu::Gelu(Formula formula, ActivationCache cache)
+    : KernelActivation(formula == Erf ? &KernelTable::gelu_erf : &KernelTable::gelu,
+                       formula == Erf ? &KernelTable::gelu_erf_derivative
+                                      : &KernelTable::gelu_derivative,
+                       nullptr, NoMask, cache),
+      formula(formula) {
+    setCache(cache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Matrix Tanh::forward(const Matrix &input_) {
-    input = input_;
+SoftMax::SoftMax(ActivationCache cache) : Activation(cache) {
+    setCache(cache);
+}
 
-    Matrix output;
-    resize(output, input);
+bool SoftMax::supportsCache(ActivationCache cache) const {
+    return cache != ActivationCache::Mask;
+}
 
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < output.size(); i++) {
-        for (int j = 0; j < output[0].size(); j++) {
-            output[i][j] = std::tanh(input[i][j]);
-        }
+void SoftMax::forward(const Tensor& input_, Tensor& output) {
+    normalize(input_, output, column_max, column_sum);
+
+    if (!training) {
+        return;
     }
 
-    return output;
+    if (cache == ActivationCache::Output) {
+        this->output = output;
+    } else {
+        input = input_;
+    }
 }
 
-Matrix Tanh::backward(const Matrix &prev_delta) {
-    delta = hadamard(prev_delta, derivative(input));
-    return delta;
+void SoftMax::predict(const Tensor& input_, Tensor& output) const {
+    Tensor column_max;
+    Tensor column_sum;
+    normalize(input_, output, column_max, column_sum);
 }
 
-Matrix Tanh::derivative(const Matrix &input) {
-    Matrix derivative;
-    resize(derivative, input);
-    
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < derivative.size(); i++) {
-        for (int j = 0; j < derivative[0].size(); j++) {
-            double tanh_val = tanh(input[i][j]);
-            derivative[i][j] = 1.0 - tanh_val * tanh_val;
+void SoftMax::normalize(const Tensor& input, Tensor& output,
+                        Tensor& column_max, Tensor& column_sum) const {
+    int rows = input.rows();
+    int cols = input.cols();
+    output.ensureShape(rows, cols);
+    column_max.ensureShape(1, cols);
+    column_sum.ensureShape(1, cols);
+
+    // Columns are normalized, but rows are walked so that exp runs over
+    // contiguous rows with the vector kernels
+    column_max.fill(-INFINITY);
+    column_sum.fill(0);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            if (input(i, j) > column_max(0, j)) {
+                column_max(0, j) = input(i, j);
+            }
         }
     }
 
-    return derivative;
-}
-
-////////////////////////////////////////////////////////////////////////////////
+    #pragma omp parallel for
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            output(i, j) = input(i, j) - column_max(0, j);
+        }
+    }
+    applyKernel(kernels(math_accuracy).exp, output, 0, output);
 
-Matrix Sigmoid::forward(const Matrix &input_) {
-    input = input_;
-    Matrix output;
-    resize(output, input);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            column_sum(0, j) += output(i, j);
+        }
+    }
 
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < output.size(); i++) {
-        for (int j = 0; j < output[0].size(); j++) {
-            output[i][j] = 1 / (1 + std::exp(-input[i][j]));
+    #pragma omp parallel for
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            output(i, j) /= column_sum(0, j);
         }
     }
+}
 
-    return output;
+void SoftMax::backward(const Tensor& prev_delta, Tensor& delta_out) {
+    if (cache == ActivationCache::Output) {
+        // s * (1 - s) from the kept output
+        eval_into(delta_out, hadamard(prev_delta, elementwise(kernels().sigmoid_output_derivative,
+                                                              output, 0.0)));
+    } else {
+        derivative(input, delta_out);
+        applyKernel(kernels().mul, prev_delta, delta_out, delta_out);
+    }
+    delta = delta_out;
 }
 
-Matrix Sigmoid::backward(const Matrix &prev_delta) {
-    delta = hadamard(prev_delta, derivative(input));
-    return delta;
+void SoftMax::derivative(const Tensor &input, Tensor &derivative) {
+    // s * (1 - s), with s normalized over each column like in forward
+    normalize(input, derivative, column_max, column_sum);
+    applyKernel(kernels().sigmoid_output_derivative, derivative, 0, derivative);
 }
 
+////////////////////////////////////////////////////////////////////////////////
 
-Matrix Sigmoid::derivative(const Matrix &input_) {
-    input = input_;
-    Matrix derivative;
-    resize(derivative, input);
-    
-    //#pragma omp parallel for collapse(2)
-    for (int i = 0; i < derivative.size(); i++) {
-        for (int j = 0; j < derivative[0].size(); j++) {
-            double sigmoid_val = 1.0 / (1.0 + exp(-input[i][j]));
-            derivative[i][j] = sigmoid_val * (1.0 - sigmoid_val);
-        }
+void NormalSampling::forward(const Tensor& input_, Tensor& output) {
+    if (!training) {
+        predict(input_, output);
+        return;
     }
 
-    return derivative;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-Matrix NormalSampling::forward(const Matrix& input_) {
     input = input_;
-    int n = input.size() / 2;
+    int n = input.rows() / 2;
 
-    resize(mu,input_);
-    mu.resize(n);
-    resize(log_var,input_);
-    log_var.resize(n);
-
-    #pragma omp parallel for
-    for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < input_[0].size(); ++j) {
-            mu[i][j] = input_[i][j];
-            log_var[i][j] = input_[i + n][j];
-        }
-    }
+    // mu and log_var are views of the two halves of the input
+    mu = input.rowSlice(0, n);
+    log_var = input.rowSlice(n, 2 * n);
 
-    Matrix output = Matrix(n,Vector(input[0].size()));
+    eval_into(std_dev, elementwise(kernels(math_accuracy).exp, product(log_var, 0.5), 0));
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::normal_distribution<> dist(0, 1);
+    epsilon.ensureShape(n, input.cols());
+    random.next().normal(epsilon.size(), epsilon.data());
 
-    #pragma omp parallel for
-    for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < input[0].size(); ++j) {
-            double epsilon = dist(gen);
-            output[i][j] = mu[i][j] + exp(0.5 * log_var[i][j]) * epsilon;
-        }
-    }
+    eval_into(output, elementwise(kernels().add, mu, hadamard(std_dev, epsilon)));
+}
 
-    return output;
+void NormalSampling::predict(const Tensor& input_, Tensor& output) const {
+    // mu
+    int n = input_.rows() / 2;
+    output.ensureShape(n, input_.cols());
+    output.copyFrom(input_.rowSlice(0, n));
 }
 
-Matrix NormalSampling::backward(const Matrix& prev_delta) {
-    int n = prev_delta.size();
-    delta.resize(prev_delta.size() * 2, Vector(prev_delta[0].size(), 0.0));
+void NormalSampling::backward(const Tensor& prev_delta, Tensor& delta_out) {
+    int n = prev_delta.rows();
+    delta_out.ensureShape(n * 2, prev_delta.cols());
+    delta = delta_out;
 
     #pragma omp parallel for
     for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < prev_delta[0].size(); ++j) {
-            delta[i][j] = prev_delta[i][j];
+        for (int j = 0; j < prev_delta.cols(); ++j) {
+            delta(i, j) = prev_delta(i, j);
         }
     }
 
     #pragma omp parallel for
     for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < prev_delta[0].size(); ++j) {
-            double grad = 0.5 * exp(log_var[i][j]) * pow(exp(0.5 * log_var[i][j]) * prev_delta[i][j], 2);
-            delta[i + n][j] = grad;
+        for (int j = 0; j < prev_delta.cols(); ++j) {
+            double grad = 0.5 * exp(log_var(i, j)) * pow(std_dev(i, j) * prev_delta(i, j), 2);
+            delta(i + n, j) = grad;
         }
     }
+}
 
-    return delta;
+void NormalSampling::setSeed(uint64_t seed, uint32_t layer) {
+    random.seed = seed;
+    random.step = 0;
+    random.layer = layer;
 }
 
-Matrix Gelu::forward(const Matrix &input_) {
-    input = input_;
-    const double sqrt2_over_pi = std::sqrt(2.0 / M_PI);
-    const double constant_0_044715 = 0.044715;
-    Matrix output;
-    resize(output,input);
+void NormalSampling::setTraining(bool training_) {
+    Layer::setTraining(training_);
+    if (!training) {
+        mu = Tensor();
+        log_var = Tensor();
+        std_dev = Tensor();
+        epsilon = Tensor();
+    }
+}
 
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < input.size(); ++i) {
-        for (std::size_t j = 0; j < input[i].size(); ++j) {
-            double x = input[i][j];
-            double cdf = 0.5 * (1.0 + std::tanh(sqrt2_over_pi * (x + constant_0_044715 * x * x * x)));
-            output[i][j] = x * cdf;
-        }
+Dropout::Dropout(double keep_probability_)
+: keep_probability(keep_probability_) {}
+
+void Dropout::forward(const Tensor& input_, Tensor& output) {
+    if (!training) {
+        predict(input_, output);
+        return;
     }
 
-    return output;
-}
+    input = input_;
+    random.next().bernoulli(input.size(), keep_probability, mask);
 
-Matrix Gelu::backward(const Matrix &prev_delta) {
-    delta = hadamard(prev_delta, derivative(input));
-    return delta;
+    // No escalamos por keep_probability aquí
+    output.ensureShape(input.rows(), input.cols());
+    applyMask(input, mask, 0, output);
 }
 
-Matrix Gelu::derivative(const Matrix &input_) {
-    const double sqrt2_over_pi = std::sqrt(2.0 / M_PI);
-    const double constant_0_044715 = 0.044715;
-    Matrix derivative;
-    resize(derivative,input);
-
-   
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < input.size(); ++i) {
-        for (std::size_t j = 0; j < input[i].size(); ++j) {
-            double x = input[i][j];
-            double alpha = 1 + std::tanh(sqrt2_over_pi*(x + constant_0_044715 * x* x * x));
-            double cdf = 0.5 * alpha;
-            double pdf = 0.5 * alpha + 0.5 * (1.0 - cdf) * alpha
-            * (sqrt2_over_pi * (1.0 + constant_0_044715 * 3.0 * x * x));
-            derivative[i][j] = pdf;
-        }
-    }
+void Dropout::predict(const Tensor& input_, Tensor& output) const {
+    // Expected value of the training output. No random numbers are drawn, so
+    // the training streams are not advanced.
+    eval_into(output, product(input_, keep_probability));
+}
 
-    return derivative;
+void Dropout::backward(const Tensor& prev_delta, Tensor& delta_out) {
+    delta_out.ensureShape(prev_delta.rows(), prev_delta.cols());
+    applyMask(prev_delta, mask, 0, delta_out);
+    delta = delta_out;
 }
 
-///////////////////////////////////////////////////////////////////////////////
+void Dropout::setSeed(uint64_t seed, uint32_t layer) {
+    random.seed = seed;
+    random.step = 0;
+    random.layer = layer;
+}
 
-// Revisar
-Dropout::Dropout(double keep_probability_) 
-: keep_probability(keep_probability_) {
-    // Usa la hora actual como semilla para el generador de números aleatorios
-    generator.seed(std::chrono::system_clock::now().time_since_epoch().count());
+void Dropout::setTraining(bool training_) {
+    Layer::setTraining(training_);
+    if (!training) {
+        mask.clear();
+        mask.shrink_to_fit();
+    }
 }
 
-Matrix Dropout::forward(const Matrix& input_) {
-    input = input_;
-    mask.resize(input.size(), std::vector<double>(input[0].size()));
+////////////////////////////////////////////////////////////////////////////////
 
-    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+Dense::Dense(const shared_ptr<Linear>& linear,
+             const shared_ptr<KernelActivation>& activation)
+    : linear(linear), activation(activation) {}
 
-    for (int i = 0; i < mask.size(); i++) {
-        for (int j = 0; j < mask[0].size(); j++) {
-            mask[i][j] = (distribution(generator) < keep_probability) ? 1.0 : 0.0;
-            input[i][j] *= mask[i][j];  // No escalamos por keep_probability aquí
-        }
+void Dense::forward(const Tensor& input_, Tensor& output_) {
+    if (!training) {
+        predict(input_, output_);
+        return;
     }
 
-    return input;
+    input = input_;
+    linear->input = input_;
+
+    ActivationCache cache = activation->getCache();
+    dense_into(output_, linear->W, input, linear->b,
+               kernels(activation->getMathAccuracy()).*activation->function,
+               activation->parameter(),
+               cache == ActivationCache::Input ? &pre_activation : nullptr);
+
+    if (cache == ActivationCache::Output) {
+        output = output_;
+    } else if (cache == ActivationCache::Mask) {
+        // The sign of the output matches the sign of the pre-activation
+        packMask(output_, activation->mask_rule == KernelActivation::NonNegative, mask);
+    }
 }
 
-Matrix Dropout::backward(const Matrix& prev_delta) {
-    Matrix delta = prev_delta;
+void Dense::predict(const Tensor& input_, Tensor& output_) const {
+    dense_into(output_, linear->W, input_, linear->b,
+               kernels(activation->getMathAccuracy()).*activation->function,
+               activation->parameter());
+}
 
-    for (int i = 0; i < delta.size(); i++) {
-        for (int j = 0; j < delta[0].size(); j++) {
-            delta[i][j] *= mask[i][j];
-        }
+void Dense::backward(const Tensor& prev_delta, Tensor& delta_out) {
+    const KernelTable& kt = kernels(activation->getMathAccuracy());
+    Scalar param = activation->parameter();
+
+    switch (activation->getCache()) {
+    case ActivationCache::Input:
+        eval_into(pre_activation_delta,
+                  hadamard(prev_delta, elementwise(kt.*activation->derivative,
+                                                   pre_activation, param)));
+        break;
+    case ActivationCache::Output:
+        eval_into(pre_activation_delta,
+                  hadamard(prev_delta, elementwise(kt.*activation->output_derivative,
+                                                   output, param)));
+        break;
+    case ActivationCache::Mask:
+        pre_activation_delta.ensureShape(prev_delta.rows(), prev_delta.cols());
+        applyMask(prev_delta, mask,
+                  activation->mask_rule == KernelActivation::NonNegative ? param : 0,
+                  pre_activation_delta);
+        break;
     }
 
-    return delta;
-}
\ No newline at end of file
+    linear->backward(pre_activation_delta, delta_out);
+    delta = delta_out;
+}
+
+void Dense::setTraining(bool training_) {
+    Layer::setTraining(training_);
+    if (!training) {
+        pre_activation = Tensor();
+        pre_activation_delta = Tensor();
+        output = Tensor();
+        mask.clear();
+        mask.shrink_to_fit();
+    }
+}
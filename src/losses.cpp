@@ -5,97 +5,362 @@
  * Description: Contains definitions for different types of loss functions for training the neural network.
  */
 
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
 #include "losses.h"
 #include "NNUtils.h"
+#include "elementwise.h"
+#include "kernels.h"
 
 
 // Loss functions
 //////////////////////////////////////////////////////////////////////////////
 
+Tensor LossFunction::backward(const Tensor &A, const Tensor &Y) const {
+    Tensor dA;
+    backward(A, Y, dA);
+    return dA;
+}
 
-double CrossEntropy::compute(const Matrix &A, const Matrix &Y) const {
-    double loss = 0.0;
-    int m = A[0].size();
-    double epsilon = 1e-6;
+double LossFunction::compute(const Tensor &, const vector<int> &) const {
+    throw std::invalid_argument("LossFunction: class labels are not supported");
+}
+
+void LossFunction::backward(const Tensor &, const vector<int> &, Tensor &) const {
+    throw std::invalid_argument("LossFunction: class labels are not supported");
+}
+
+double LossFunction::computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const {
+    backward(A, Y, dA);
+    return compute(A, Y);
+}
+
+double LossFunction::computeWithGradient(const Tensor &A, const vector<int> &labels,
+                                         Tensor &dA) const {
+    backward(A, labels, dA);
+    return compute(A, labels);
+}
 
-    for (int i = 0; i < A.size(); ++i) {
-        for (int j = 0; j < A[0].size(); ++j) {
-            loss -= Y[i][j] * log(std::max(A[i][j], epsilon)) +
-              (1 - Y[i][j]) * log(std::max(1 - A[i][j], epsilon));
+void checkLabels(const Tensor &A, const vector<int> &labels) {
+    if ((int)labels.size() != A.cols()) {
+        throw std::invalid_argument("LossFunction: one label per column expected");
+    }
+    for (int label : labels) {
+        if (label < 0 || label >= A.rows()) {
+            throw std::invalid_argument("LossFunction: label out of range");
         }
     }
-
-    return loss / m;
 }
 
-Matrix CrossEntropy::backward(const Matrix &A, const Matrix &Y) const {
-    Matrix delta;
-    resize(delta, A);
-    double epsilon = 1e-9;
 
-    for (int i = 0; i < delta.size(); ++i) {
-        for (int j = 0; j < delta[0].size(); ++j) {
-            if (Y[i][j] == 1.0) {
-                delta[i][j] = -1.0 / (A[i][j] + epsilon);
-            } else {
-                delta[i][j] = 1.0 / (1.0 - A[i][j] + epsilon);
+// Losses that are a sum over the elements of A are written as an element type
+// with static loss(a, y) and gradient(a, y), and evaluated by
+// evaluateElementwise() for both dense targets and labels.
+
+struct DenseTargets {
+    const Tensor &Y;
+    Scalar operator()(int i, int j) const { return Y(i, j); }
+};
+
+struct LabelTargets {
+    const vector<int> &labels;
+    Scalar operator()(int i, int j) const { return i == labels[j] ? 1 : 0; }
+};
+
+// Upper bound on the number of partial losses, which are summed in a fixed
+// order so that the loss does not depend on the number of threads
+static const int LOSS_CHUNKS = 64;
+
+// Accumulators kept along a row, so that the sum of the losses of a row can
+// be vectorized without reordering the additions
+static const int LOSS_LANES = 8;
+
+// Returns the sum of Element::loss over A, or 0 if with_loss is false, and
+// writes Element::gradient into dA unless it is null. A and the targets are
+// read once.
+template <typename Element, typename Targets>
+static double evaluateElementwise(const Tensor &A, const Targets &Y, bool with_loss, Tensor *dA) {
+    int rows = A.rows();
+    int cols = A.cols();
+    if (dA) {
+        dA->ensureShape(rows, cols);
+    }
+
+    int n_chunks = std::min(LOSS_CHUNKS, rows);
+    double partial[LOSS_CHUNKS] = {};
+
+    #pragma omp parallel for schedule(static) if(A.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (int c = 0; c < n_chunks; c++) {
+        double lanes[LOSS_LANES] = {};
+        for (int i = c * rows / n_chunks; i < (c + 1) * rows / n_chunks; i++) {
+            for (int j0 = 0; j0 < cols; j0 += LOSS_LANES) {
+                int n = std::min(LOSS_LANES, cols - j0);
+                for (int k = 0; k < n; k++) {
+                    Scalar a = A(i, j0 + k);
+                    Scalar y = Y(i, j0 + k);
+                    if (with_loss) {
+                        lanes[k] += Element::loss(a, y);
+                    }
+                    if (dA) {
+                        (*dA)(i, j0 + k) = Element::gradient(a, y);
+                    }
+                }
             }
         }
+        for (int k = 0; k < LOSS_LANES; k++) {
+            partial[c] += lanes[k];
+        }
+    }
+
+    double loss = 0.0;
+    for (int c = 0; c < n_chunks; c++) {
+        loss += partial[c];
     }
 
-    return delta;
+    return loss;
 }
 
-double BinaryCrossEntropy::compute(const Matrix &A, const Matrix &Y) const {
-    double loss = 0.0;
-    int m = A[0].size();
-    double epsilon = 1e-8;
+struct CrossEntropyElement {
+    static double loss(Scalar a, Scalar y) {
+        const Scalar epsilon = 1e-6;
+        return -(y * log(std::max(a, epsilon)) + (1 - y) * log(std::max(1 - a, epsilon)));
+    }
 
-    for (int i = 0; i < A.size(); ++i) {
-        for (int j = 0; j < A[0].size(); ++j) {
-            loss -= Y[i][j] * log(A[i][j] + epsilon) + (1 - Y[i][j]) * log(1 - A[i][j] + epsilon);
-        }
+    static Scalar gradient(Scalar a, Scalar y) {
+        const Scalar epsilon = 1e-9;
+        return y == 1.0 ? -1.0 / (a + epsilon) : 1.0 / (1.0 - a + epsilon);
+    }
+};
+
+struct BinaryCrossEntropyElement {
+    static double loss(Scalar a, Scalar y) {
+        const Scalar epsilon = 1e-8;
+        return -(y * log(a + epsilon) + (1 - y) * log(1 - a + epsilon));
+    }
+
+    static Scalar gradient(Scalar a, Scalar y) {
+        const Scalar epsilon = 1e-8;
+        return (a - y) / ((a + epsilon) * (1 - a + epsilon));
     }
+};
 
-    return loss / m;
+struct SquaredErrorElement {
+    static double loss(Scalar a, Scalar y) {
+        double diff = a - y;
+        return diff * diff;
+    }
+
+    static Scalar gradient(Scalar a, Scalar y) {
+        return a - y;
+    }
+};
+
+
+double CrossEntropy::compute(const Tensor &A, const Tensor &Y) const {
+    return evaluateElementwise<CrossEntropyElement>(A, DenseTargets{Y}, true, nullptr) / A.cols();
 }
 
-Matrix BinaryCrossEntropy::backward(const Matrix &A, const Matrix &Y) const {
-    Matrix dZ = A;
-    double epsilon = 1e-8;
+void CrossEntropy::backward(const Tensor &A, const Tensor &Y, Tensor &delta) const {
+    evaluateElementwise<CrossEntropyElement>(A, DenseTargets{Y}, false, &delta);
+}
+
+double CrossEntropy::computeWithGradient(const Tensor &A, const Tensor &Y, Tensor &dA) const {
+    return evaluateElementwise<CrossEntropyElement>(A, DenseTargets{Y}, true, &dA) / A.cols();
+}
+
+double CrossEntropy::compute(const Tensor &A, const vector<int> &labels) const {
+    checkLabels(A, labels);
+    return evaluateElementwise<CrossEntropyElement>(A, LabelTargets{labels}, true, nullptr)
+           / A.cols();
+}
+
+void CrossEntropy::backward(const Tensor &A, const vector<int> &labels, Tensor &delta) const {
+    checkLabels(A, labels);
+    evaluateElementwise<CrossEntropyElement>(A, LabelTargets{labels}, false, &delta);
+}
+
+double CrossEntropy::computeWithGradient(const Tensor &A, const vector<int> &labels,
+                                         Tensor &dA) const {
+    checkLabels(A, labels);
+    return evaluateElementwise<CrossEntropyElement>(A, LabelTargets{labels}, true, &dA)
+           / A.cols();
+}
+
+// Columns of the logits processed together, so that every pass runs over
+// contiguous rows while the block stays in cache
+static const int SOFTMAX_BLOCK = 256;
+
+// Upper bound on the number of partial losses, which are summed in a fixed
+// order so that the loss does not depend on the number of threads
+static const int SOFTMAX_CHUNKS = 64;
+
+// Loss of columns j0 to j0 + n - 1, and their gradient if dA is not null.
+// The targets are Y or labels, whichever is not null. Rows of dA must be
+// contiguous.
+static double softmaxCrossEntropyBlock(const Tensor &A, const Tensor *Y, const int *labels,
+                                       Tensor *dA, int j0, int n) {
+    const KernelTable& kt = kernels();
+    alignas(64) Scalar max[SOFTMAX_BLOCK];
+    alignas(64) Scalar sum[SOFTMAX_BLOCK];
+    alignas(64) Scalar scratch[SOFTMAX_BLOCK];
+    double target_logit[SOFTMAX_BLOCK];
+    double target_mass[SOFTMAX_BLOCK];
 
-    for (int i = 0; i < dZ.size(); ++i) {
-        for (int j = 0; j < dZ[0].size(); ++j) {
-            dZ[i][j] = (A[i][j] - Y[i][j]) / ((A[i][j] + epsilon) * (1 - A[i][j] + epsilon));
+    std::fill(max, max + n, -INFINITY);
+    std::fill(sum, sum + n, Scalar(0));
+    std::fill(target_logit, target_logit + n, 0.0);
+    std::fill(target_mass, target_mass + n, labels ? 1.0 : 0.0);
+
+    for (int i = 0; i < A.rows(); i++) {
+        for (int k = 0; k < n; k++) {
+            if (A(i, j0 + k) > max[k]) {
+                max[k] = A(i, j0 + k);
+            }
         }
     }
 
-    return dZ;
-}
+    if (labels) {
+        for (int k = 0; k < n; k++) {
+            target_logit[k] = A(labels[j0 + k], j0 + k) - max[k];
+        }
+    }
+
+    // exp(a - max) is summed and, for the gradient, kept in dA
+    for (int i = 0; i < A.rows(); i++) {
+        Scalar* e = dA ? &(*dA)(i, j0) : scratch;
+        for (int k = 0; k < n; k++) {
+            e[k] = A(i, j0 + k) - max[k];
+        }
+        if (Y) {
+            for (int k = 0; k < n; k++) {
+                target_logit[k] += (*Y)(i, j0 + k) * e[k];
+                target_mass[k] += (*Y)(i, j0 + k);
+            }
+        }
+        kt.exp(n, e, 0, e);
+        for (int k = 0; k < n; k++) {
+            sum[k] += e[k];
+        }
+    }
 
-double MeanSquaredError::compute(const Matrix &A, const Matrix &Y) const {
+    // -sum_i y_i * log(softmax_i) = sum_i y_i * (log(sum) - (a_i - max))
     double loss = 0.0;
-    int m = A[0].size();
+    for (int k = 0; k < n; k++) {
+        loss += target_mass[k] * std::log(sum[k]) - target_logit[k];
+    }
 
-    for (int i = 0; i < A.size(); ++i) {
-        for (int j = 0; j < A[0].size(); ++j) {
-            double diff = A[i][j] - Y[i][j];
-            loss += diff * diff;
+    if (dA && Y) {
+        for (int i = 0; i < A.rows(); i++) {
+            for (int k = 0; k < n; k++) {
+                (*dA)(i, j0 + k) = (*dA)(i, j0 + k) / sum[k] - (*Y)(i, j0 + k);
+            }
+        }
+    } else if (dA) {
+        for (int i = 0; i < A.rows(); i++) {
+            for (int k = 0; k < n; k++) {
+                (*dA)(i, j0 + k) /= sum[k];
+            }
+        }
+        for (int k = 0; k < n; k++) {
+            (*dA)(labels[j0 + k], j0 + k) -= 1;
         }
     }
 
-    return loss / (2 * m);
+    return loss;
 }
 
-Matrix MeanSquaredError::backward(const Matrix &A, const Matrix &Y) const {
-    Matrix dZ = A;
+double SoftmaxCrossEntropy::evaluate(const Tensor &A, const Tensor *Y, const int *labels,
+                                     Tensor *dA) const {
+    int cols = A.cols();
+
+    if (dA) {
+        dA->ensureShape(A.rows(), cols);
+        if (dA->stride(1) != 1 && cols > 1) {
+            Tensor result = Tensor::allocate(A.rows(), cols);
+            double loss = evaluate(A, Y, labels, &result);
+            dA->copyFrom(result);
+            return loss;
+        }
+    }
+
+    int n_blocks = (cols + SOFTMAX_BLOCK - 1) / SOFTMAX_BLOCK;
+    int n_chunks = std::min(SOFTMAX_CHUNKS, n_blocks);
+    double partial[SOFTMAX_CHUNKS] = {};
 
-    for (int i = 0; i < dZ.size(); ++i) {
-        for (int j = 0; j < dZ[0].size(); ++j) {
-            dZ[i][j] = (A[i][j] - Y[i][j]);
+    #pragma omp parallel for schedule(static) if(A.size() >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (int c = 0; c < n_chunks; c++) {
+        for (int b = c * n_blocks / n_chunks; b < (c + 1) * n_blocks / n_chunks; b++) {
+            int j0 = b * SOFTMAX_BLOCK;
+            partial[c] += softmaxCrossEntropyBlock(A, Y, labels, dA, j0,
+                                                   std::min(SOFTMAX_BLOCK, cols - j0));
         }
     }
 
-    return dZ;
+    double loss = 0.0;
+    for (int c = 0; c < n_chunks; c++) {
+        loss += partial[c];
+    }
+
+    return loss / cols;
+}
+
+double SoftmaxCrossEntropy::compute(const Tensor &A, const Tensor &Y) const {
+    return evaluate(A, &Y, nullptr, nullptr);
+}
+
+void SoftmaxCrossEntropy::backward(const Tensor &A, const Tensor &Y, Tensor &dA) const {
+    evaluate(A, &Y, nullptr, &dA);
+}
+
+double SoftmaxCrossEntropy::compute(const Tensor &A, const vector<int> &labels) const {
+    checkLabels(A, labels);
+    return evaluate(A, nullptr, labels.data(), nullptr);
+}
+
+void SoftmaxCrossEntropy::backward(const Tensor &A, const vector<int> &labels,
+                                   Tensor &dA) const {
+    checkLabels(A, labels);
+    evaluate(A, nullptr, labels.data(), &dA);
+}
+
+double SoftmaxCrossEntropy::computeWithGradient(const Tensor &A, const Tensor &Y,
+                                                Tensor &dA) const {
+    return evaluate(A, &Y, nullptr, &dA);
+}
+
+double SoftmaxCrossEntropy::computeWithGradient(const Tensor &A, const vector<int> &labels,
+                                                Tensor &dA) const {
+    checkLabels(A, labels);
+    return evaluate(A, nullptr, labels.data(), &dA);
+}
+
+double BinaryCrossEntropy::compute(const Tensor &A, const Tensor &Y) const {
+    return evaluateElementwise<BinaryCrossEntropyElement>(A, DenseTargets{Y}, true, nullptr)
+           / A.cols();
+}
+
+void BinaryCrossEntropy::backward(const Tensor &A, const Tensor &Y, Tensor &dZ) const {
+    evaluateElementwise<BinaryCrossEntropyElement>(A, DenseTargets{Y}, false, &dZ);
+}
+
+double BinaryCrossEntropy::computeWithGradient(const Tensor &A, const Tensor &Y,
+                                               Tensor &dZ) const {
+    return evaluateElementwise<BinaryCrossEntropyElement>(A, DenseTargets{Y}, true, &dZ)
+           / A.cols();
+}
+
+double MeanSquaredError::compute(const Tensor &A, const Tensor &Y) const {
+    return evaluateElementwise<SquaredErrorElement>(A, DenseTargets{Y}, true, nullptr)
+           / (2 * A.cols());
+}
+
+void MeanSquaredError::backward(const Tensor &A, const Tensor &Y, Tensor &dZ) const {
+    evaluateElementwise<SquaredErrorElement>(A, DenseTargets{Y}, false, &dZ);
+}
+
+double MeanSquaredError::computeWithGradient(const Tensor &A, const Tensor &Y,
+                                             Tensor &dZ) const {
+    return evaluateElementwise<SquaredErrorElement>(A, DenseTargets{Y}, true, &dZ)
+           / (2 * A.cols());
 }
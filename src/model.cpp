@@ -0,0 +1,327 @@
+/*
+ * File: src/model.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the binary model file format.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "model.h"
+#include "checksum.h"
+
+
+static const char MODEL_MAGIC[8] = {'D', 'C', 'P', 'P', 'M', 'O', 'D', 'L'};
+static const size_t MODEL_ALIGNMENT = 64;
+
+enum class LayerType : uint32_t {
+    Linear = 1,
+    Sigmoid,
+    Tanh,
+    Relu,
+    LeakyRelu,
+    SoftMax,
+    Gelu,
+    Dropout,
+    NormalSampling
+};
+
+struct ModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t scalar_size;
+    uint32_t num_layers;
+    uint32_t layers_checksum;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint32_t data_checksum;
+    uint8_t reserved[16];
+    uint32_t header_checksum;   // Of the bytes above
+};
+
+struct LayerRecord {
+    uint32_t type;
+    uint32_t cache;
+    uint32_t accuracy;
+    uint32_t formula;
+    double parameter;
+    int32_t rows;
+    int32_t cols;
+    uint64_t weights_offset;
+    uint64_t bias_offset;
+    uint8_t reserved[16];
+};
+
+static_assert(sizeof(ModelHeader) == 64, "ModelHeader must take 64 bytes");
+static_assert(sizeof(LayerRecord) == 64, "LayerRecord must take 64 bytes");
+
+
+static size_t alignUp(size_t n) {
+    return (n + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
+
+static LayerRecord describe(const shared_ptr<Layer>& layer) {
+
+    LayerRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.accuracy = (uint32_t)layer->getMathAccuracy();
+
+    if (auto activation = std::dynamic_pointer_cast<Activation>(layer)) {
+        record.cache = (uint32_t)activation->getCache();
+    }
+
+    if (auto linear = std::dynamic_pointer_cast<Linear>(layer)) {
+        record.type = (uint32_t)LayerType::Linear;
+        record.rows = linear->W.rows();
+        record.cols = linear->W.cols();
+    } else if (std::dynamic_pointer_cast<Sigmoid>(layer)) {
+        record.type = (uint32_t)LayerType::Sigmoid;
+    } else if (std::dynamic_pointer_cast<Tanh>(layer)) {
+        record.type = (uint32_t)LayerType::Tanh;
+    } else if (std::dynamic_pointer_cast<Relu>(layer)) {
+        record.type = (uint32_t)LayerType::Relu;
+    } else if (auto leaky_relu = std::dynamic_pointer_cast<LeakyRelu>(layer)) {
+        record.type = (uint32_t)LayerType::LeakyRelu;
+        record.parameter = leaky_relu->alpha;
+    } else if (std::dynamic_pointer_cast<SoftMax>(layer)) {
+        record.type = (uint32_t)LayerType::SoftMax;
+    } else if (auto gelu = std::dynamic_pointer_cast<Gelu>(layer)) {
+        record.type = (uint32_t)LayerType::Gelu;
+        record.formula = (uint32_t)gelu->formula;
+    } else if (auto dropout = std::dynamic_pointer_cast<Dropout>(layer)) {
+        record.type = (uint32_t)LayerType::Dropout;
+        record.parameter = dropout->getKeepProbability();
+    } else if (std::dynamic_pointer_cast<NormalSampling>(layer)) {
+        record.type = (uint32_t)LayerType::NormalSampling;
+    } else {
+        throw std::invalid_argument("saveModel: unsupported layer type");
+    }
+
+    return record;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void saveModel(const vector<shared_ptr<Layer>>& layers, const string& file_name) {
+
+    vector<LayerRecord> records;
+    vector<Tensor> blobs;
+
+    // Offsets of the blobs are assigned in order after the records
+    size_t data_offset = alignUp(sizeof(ModelHeader) + layers.size() * sizeof(LayerRecord));
+    size_t offset = data_offset;
+
+    for (const auto& layer : layers) {
+        LayerRecord record = describe(layer);
+
+        if (auto linear = std::dynamic_pointer_cast<Linear>(layer)) {
+            blobs.push_back(linear->W.isContiguous() ? linear->W : linear->W.clone());
+            blobs.push_back(linear->b.isContiguous() ? linear->b : linear->b.clone());
+            record.weights_offset = offset;
+            offset += alignUp(linear->W.size() * sizeof(Scalar));
+            record.bias_offset = offset;
+            offset += alignUp(linear->b.size() * sizeof(Scalar));
+        }
+
+        records.push_back(record);
+    }
+
+    // The data is checksummed as written, padding included
+    static const char padding[MODEL_ALIGNMENT] = {};
+    uint32_t data_checksum = 0;
+    for (const Tensor& blob : blobs) {
+        size_t bytes = blob.size() * sizeof(Scalar);
+        data_checksum = crc32c(blob.data(), bytes, data_checksum);
+        data_checksum = crc32c(padding, alignUp(bytes) - bytes, data_checksum);
+    }
+
+    ModelHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+    header.version = MODEL_VERSION;
+    header.scalar_size = sizeof(Scalar);
+    header.num_layers = records.size();
+    header.layers_checksum = crc32c(records.data(), records.size() * sizeof(LayerRecord));
+    header.data_offset = data_offset;
+    header.data_size = offset - data_offset;
+    header.data_checksum = data_checksum;
+    header.header_checksum = crc32c(&header, offsetof(ModelHeader, header_checksum));
+
+    ofstream file(file_name, ios::binary);
+    if (!file) {
+        throw std::runtime_error("saveModel: cannot open " + file_name);
+    }
+
+    size_t records_end = sizeof(header) + records.size() * sizeof(LayerRecord);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()),
+               records.size() * sizeof(LayerRecord));
+    file.write(padding, data_offset - records_end);
+
+    for (const Tensor& blob : blobs) {
+        size_t bytes = blob.size() * sizeof(Scalar);
+        file.write(reinterpret_cast<const char*>(blob.data()), bytes);
+        file.write(padding, alignUp(bytes) - bytes);
+    }
+
+    if (!file.flush()) {
+        throw std::runtime_error("saveModel: cannot write " + file_name);
+    }
+}
+
+
+
+void saveModel(const NeuralNetwork& network, const string& file_name) {
+    saveModel(network.layers, file_name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Layer described by record, with W and b taken from the mapping
+static shared_ptr<Layer> build(const LayerRecord& record,
+                               const shared_ptr<char>& mapping, size_t file_size) {
+
+    if (record.cache > (uint32_t)ActivationCache::Mask ||
+        record.accuracy > (uint32_t)MathAccuracy::Fast ||
+        record.formula > (uint32_t)Gelu::Erf) {
+        throw std::runtime_error("mapModel: invalid layer settings");
+    }
+    ActivationCache cache = (ActivationCache)record.cache;
+
+    shared_ptr<Layer> layer;
+    switch ((LayerType)record.type) {
+    case LayerType::Linear: {
+        size_t w_bytes = (size_t)record.rows * record.cols * sizeof(Scalar);
+        size_t b_bytes = (size_t)record.rows * sizeof(Scalar);
+        if (record.rows <= 0 || record.cols <= 0 ||
+            record.weights_offset % MODEL_ALIGNMENT != 0 ||
+            record.bias_offset % MODEL_ALIGNMENT != 0 ||
+            record.weights_offset > file_size || w_bytes > file_size - record.weights_offset ||
+            record.bias_offset > file_size || b_bytes > file_size - record.bias_offset) {
+            throw std::runtime_error("mapModel: invalid Linear layer");
+        }
+        Scalar* w = reinterpret_cast<Scalar*>(mapping.get() + record.weights_offset);
+        Scalar* b = reinterpret_cast<Scalar*>(mapping.get() + record.bias_offset);
+        layer = make_shared<Linear>(Tensor::wrap(shared_ptr<Scalar>(mapping, w), record.rows, record.cols),
+                                    Tensor::wrap(shared_ptr<Scalar>(mapping, b), record.rows, 1));
+        break;
+    }
+    case LayerType::Sigmoid:
+        layer = make_shared<Sigmoid>(cache);
+        break;
+    case LayerType::Tanh:
+        layer = make_shared<Tanh>(cache);
+        break;
+    case LayerType::Relu:
+        layer = make_shared<Relu>(cache);
+        break;
+    case LayerType::LeakyRelu:
+        layer = make_shared<LeakyRelu>(record.parameter, cache);
+        break;
+    case LayerType::SoftMax:
+        layer = make_shared<SoftMax>(cache);
+        break;
+    case LayerType::Gelu:
+        layer = make_shared<Gelu>((Gelu::Formula)record.formula, cache);
+        break;
+    case LayerType::Dropout:
+        layer = make_shared<Dropout>(record.parameter);
+        break;
+    case LayerType::NormalSampling:
+        layer = make_shared<NormalSampling>();
+        break;
+    default:
+        throw std::runtime_error("mapModel: unknown layer type");
+    }
+
+    layer->setMathAccuracy((MathAccuracy)record.accuracy);
+    return layer;
+}
+
+
+
+vector<shared_ptr<Layer>> mapModel(const string& file_name, bool verify_data) {
+
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("mapModel: cannot open " + file_name);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ModelHeader)) {
+        close(fd);
+        throw std::runtime_error("mapModel: not a model file: " + file_name);
+    }
+    size_t file_size = info.st_size;
+
+    // Private and writable, so the layers can be trained without touching
+    // the file. Pages are only copied when written.
+    void* p = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("mapModel: cannot map " + file_name);
+    }
+    shared_ptr<char> mapping(static_cast<char*>(p),
+                             [file_size](char* q) { munmap(q, file_size); });
+
+    ModelHeader header;
+    std::memcpy(&header, mapping.get(), sizeof(header));
+    if (std::memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0 ||
+        header.header_checksum != crc32c(&header, offsetof(ModelHeader, header_checksum))) {
+        throw std::runtime_error("mapModel: not a model file: " + file_name);
+    }
+    if (header.version != MODEL_VERSION) {
+        throw std::runtime_error("mapModel: unsupported model version");
+    }
+    if (header.scalar_size != sizeof(Scalar)) {
+        throw std::runtime_error("mapModel: model written with another precision");
+    }
+
+    size_t records_size = (size_t)header.num_layers * sizeof(LayerRecord);
+    if (records_size > file_size - sizeof(header) ||
+        header.data_offset > file_size || header.data_size > file_size - header.data_offset) {
+        throw std::runtime_error("mapModel: truncated model file");
+    }
+
+    const char* records = mapping.get() + sizeof(header);
+    if (crc32c(records, records_size) != header.layers_checksum) {
+        throw std::runtime_error("mapModel: corrupt layers");
+    }
+    if (verify_data &&
+        crc32c(mapping.get() + header.data_offset, header.data_size) != header.data_checksum) {
+        throw std::runtime_error("mapModel: corrupt parameters");
+    }
+
+    vector<shared_ptr<Layer>> layers;
+    for (uint32_t i = 0; i < header.num_layers; i++) {
+        LayerRecord record;
+        std::memcpy(&record, records + i * sizeof(LayerRecord), sizeof(record));
+        layers.push_back(build(record, mapping, file_size));
+    }
+
+    return layers;
+}
+
+
+
+vector<shared_ptr<Layer>> loadModel(const string& file_name) {
+
+    vector<shared_ptr<Layer>> layers = mapModel(file_name);
+
+    for (auto& layer : layers) {
+        if (auto linear = std::dynamic_pointer_cast<Linear>(layer)) {
+            auto copy = make_shared<Linear>(linear->W.clone(), linear->b.clone());
+            copy->setMathAccuracy(linear->getMathAccuracy());
+            layer = copy;
+        }
+    }
+
+    return layers;
+}
@@ -6,67 +6,487 @@
  */
 
 #include "optimizers.h"
+#include "elementwise.h"
+#include "kernels.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <omp.h>
 
-Adam::Adam(double beta1, double beta2, double epsilon)
-    : beta1(beta1), beta2(beta2), epsilon(epsilon), t(0) {}
+
+// Splits the segments of plan into chunks, unless their sizes are those of
+// the last split
+template <typename S>
+static void splitSegments(SweepPlan<S>& plan) {
+    bool same_sizes = plan.sizes.size() == plan.segments.size();
+    for (size_t s = 0; same_sizes && s < plan.segments.size(); s++) {
+        same_sizes = plan.sizes[s] == plan.segments[s].n;
+    }
+    if (same_sizes) {
+        return;
+    }
+
+    plan.sizes.clear();
+    plan.chunks.clear();
+    plan.total = 0;
+    for (size_t s = 0; s < plan.segments.size(); s++) {
+        size_t n = plan.segments[s].n;
+        for (size_t begin = 0; begin < n; begin += ELEMENTWISE_PARALLEL_THRESHOLD) {
+            plan.chunks.push_back({ s, begin, std::min(n, begin + ELEMENTWISE_PARALLEL_THRESHOLD) });
+        }
+        plan.sizes.push_back(n);
+        plan.total += n;
+    }
+}
+
+// Calls f(segment, begin, end) over every chunk of the segments of plan
+template <typename S, typename F>
+static void sweep(const SweepPlan<S>& plan, F f) {
+    ptrdiff_t n_chunks = plan.chunks.size();
+    #pragma omp parallel for if(plan.total >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (ptrdiff_t c = 0; c < n_chunks; c++) {
+        const Chunk& chunk = plan.chunks[c];
+        f(plan.segments[chunk.segment], chunk.begin, chunk.end);
+    }
+}
+
+// Chunks whose partial sums reduceSegments() keeps at once
+static const int REDUCE_CHUNKS = 64;
+
+// Same for an f that returns a sum over its chunk, and sets sums to the sum
+// of each segment. The chunks are run REDUCE_CHUNKS at a time, so that
+// their partial sums fit on the stack, and added in order, so the sums do
+// not depend on the number of threads.
+template <typename S, typename F>
+static void reduceSegments(const SweepPlan<S>& plan, F f, vector<double>& sums) {
+    sums.assign(plan.segments.size(), 0.0);
+
+    for (size_t first = 0; first < plan.chunks.size(); first += REDUCE_CHUNKS) {
+        ptrdiff_t n_chunks = std::min(plan.chunks.size() - first, (size_t)REDUCE_CHUNKS);
+        double partial[REDUCE_CHUNKS];
+
+        #pragma omp parallel for if(plan.total >= ELEMENTWISE_PARALLEL_THRESHOLD)
+        for (ptrdiff_t c = 0; c < n_chunks; c++) {
+            const Chunk& chunk = plan.chunks[first + c];
+            partial[c] = f(plan.segments[chunk.segment], chunk.begin, chunk.end);
+        }
+
+        for (ptrdiff_t c = 0; c < n_chunks; c++) {
+            sums[plan.chunks[first + c].segment] += partial[c];
+        }
+    }
+}
+
+// The coefficients of step t of Adam, for the biases and for the weights,
+// which also get the decoupled weight decay
+static void adamSteps(double beta1, double beta2, double epsilon, double weight_decay,
+                      uint64_t t, double learn_rate, int batch_size,
+                      AdamStep& bias_step, AdamStep& weight_step) {
+    bias_step.grad_scale = 1.0 / batch_size;
+    bias_step.beta1 = beta1;
+    bias_step.beta2 = beta2;
+    bias_step.step_size = learn_rate / (1.0 - std::pow(beta1, (double)t));
+    bias_step.correction2 = 1.0 / std::sqrt(1.0 - std::pow(beta2, (double)t));
+    bias_step.epsilon = epsilon;
+    bias_step.decay = 1;
+
+    weight_step = bias_step;
+    weight_step.decay = 1.0 - learn_rate * weight_decay;
+}
+
+// Sets result to the layers, reusing its buffer
+static const vector<Linear*>& pointers(const vector<shared_ptr<Linear>>& layers,
+                                       vector<Linear*>& result) {
+    result.clear();
+    for (const auto& layer : layers) {
+        result.push_back(layer.get());
+    }
+    return result;
+}
+
+static const vector<Linear*>& pointers(Linear& layer, vector<Linear*>& result) {
+    result.assign(1, &layer);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Optimizer::update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                       int batch_size) {
+    for (const auto& layer : layers) {
+        update(*layer, learn_rate, batch_size);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Adam::Adam(double beta1, double beta2, double epsilon, double weight_decay)
+    : beta1(beta1), beta2(beta2), epsilon(epsilon), weight_decay(weight_decay), t(0) {}
 
 
 void Adam::initialize(const Linear& layer) {
     OptimizationState state;
-    state.mW = Matrix(layer.W.size(), Vector(layer.W[0].size(), 0.0));
-    state.mb = Vector(layer.b.size(), 0.0);
-    state.vW = Matrix(layer.W.size(), Vector(layer.W[0].size(), 0.0));
-    state.vb = Vector(layer.b.size(), 0.0);
+    state.mW = Tensor(layer.W.rows(), layer.W.cols(), 0.0);
+    state.mb = Tensor(layer.b.rows(), 1, 0.0);
+    state.vW = Tensor(layer.W.rows(), layer.W.cols(), 0.0);
+    state.vb = Tensor(layer.b.rows(), 1, 0.0);
 
     optimization_states[&layer] = state;
 }
 
 
+vector<Tensor> Adam::getState(const Linear& layer) {
+    auto it = optimization_states.find(&layer);
+    if (it == optimization_states.end()) {
+        return vector<Tensor>();
+    }
+
+    const OptimizationState& state = it->second;
+    return { state.mW, state.mb, state.vW, state.vb };
+}
+
+
 void Adam::update(Linear& layer, double learn_rate, int batch_size) {
+    step(pointers(layer, plan.layers), learn_rate, batch_size);
+}
+
+
+void Adam::update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                  int batch_size) {
+    step(pointers(layers, plan.layers), learn_rate, batch_size);
+}
+
+
+Adam::OptimizationState& Adam::stateOf(const Linear& layer) {
+    if (optimization_states.find(&layer) == optimization_states.end()) {
+        initialize(layer);
+    }
+    return optimization_states[&layer];
+}
+
+
+void Adam::step(const vector<Linear*>& layers, double learn_rate, int batch_size) {
     ++t;
 
-    OptimizationState& state = optimization_states[&layer];
+    vector<Segment>& segments = plan.segments;
+    segments.clear();
+    for (Linear* layer : layers) {
+        OptimizationState& state = stateOf(*layer);
+        segments.push_back({ layer->W.data(), layer->dW.data(), state.mW.data(),
+                             state.vW.data(), layer->W.size(), true });
+        segments.push_back({ layer->b.data(), layer->db.data(), state.mb.data(),
+                             state.vb.data(), layer->b.size(), false });
+    }
+    splitSegments(plan);
+
+    // The bias corrections, once for the whole step
+    AdamStep bias_step, weight_step;
+    adamSteps(beta1, beta2, epsilon, weight_decay, t, learn_rate, batch_size,
+              bias_step, weight_step);
+
+    auto kernel = kernels().adam_step;
+    sweep(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        kernel(end - begin, segment.w + begin, segment.g + begin, segment.s1 + begin,
+               segment.s2 + begin, segment.decay ? weight_step : bias_step);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+AdamW::AdamW(double weight_decay, double beta1, double beta2, double epsilon)
+    : Adam(beta1, beta2, epsilon, weight_decay) {}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bytes of the codes of m and v, rounded up to the alignment of the scales
+static size_t codeBytes(size_t n) {
+    return (2 * n + sizeof(float) - 1) / sizeof(float) * sizeof(float);
+}
+
+static size_t numBlocks(size_t n) {
+    return (n + QUANTIZATION_BLOCK - 1) / QUANTIZATION_BLOCK;
+}
+
+Adam8bit::QuantizedMoments::QuantizedMoments(size_t n) : n(n) {
+    size_t bytes = codeBytes(n) + 2 * numBlocks(n) * sizeof(float);
+    storage = Tensor((bytes + sizeof(Scalar) - 1) / sizeof(Scalar), 1, 0.0);
+}
 
-    #pragma omp parallel for
-    for (int i = 0; i < layer.b.size(); i++) {
-        double grad_b = layer.db[i] / batch_size;
-        state.mb[i] = beta1 * state.mb[i] + (1.0 - beta1) * grad_b;
-        state.vb[i] = beta2 * state.vb[i] + (1.0 - beta2) * grad_b * grad_b;
+int8_t* Adam8bit::QuantizedMoments::m() {
+    return reinterpret_cast<int8_t*>(storage.data());
+}
+
+uint8_t* Adam8bit::QuantizedMoments::v() {
+    return reinterpret_cast<uint8_t*>(storage.data()) + n;
+}
+
+float* Adam8bit::QuantizedMoments::m_scales() {
+    return reinterpret_cast<float*>(reinterpret_cast<char*>(storage.data()) + codeBytes(n));
+}
+
+float* Adam8bit::QuantizedMoments::v_scales() {
+    return m_scales() + numBlocks(n);
+}
 
-        double m_hat_b = state.mb[i] / (1.0 - std::pow(beta1, t));
-        double v_hat_b = state.vb[i] / (1.0 - std::pow(beta2, t));
 
-        layer.b[i] -= learn_rate * m_hat_b / (std::sqrt(v_hat_b) + epsilon);
+Adam8bit::Adam8bit(double beta1, double beta2, double epsilon, double weight_decay)
+    : beta1(beta1), beta2(beta2), epsilon(epsilon), weight_decay(weight_decay), t(0) {}
+
+
+void Adam8bit::initialize(const Linear& layer) {
+    OptimizationState state;
+    state.W = QuantizedMoments(layer.W.size());
+    state.b = QuantizedMoments(layer.b.size());
+
+    optimization_states[&layer] = state;
+}
+
+
+vector<Tensor> Adam8bit::getState(const Linear& layer) {
+    auto it = optimization_states.find(&layer);
+    if (it == optimization_states.end()) {
+        return vector<Tensor>();
     }
+    return { it->second.W.storage, it->second.b.storage };
+}
 
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < layer.W.size(); i++) {
-        for (int j = 0; j < layer.W[0].size(); j++) {
-            double grad_W = layer.dW[i][j] / batch_size;
-            state.mW[i][j] = beta1 * state.mW[i][j] + (1.0 - beta1) * grad_W;
-            state.vW[i][j] = beta2 * state.vW[i][j] + (1.0 - beta2) * grad_W * grad_W;
 
-            double m_hat_W = state.mW[i][j] / (1.0 - std::pow(beta1, t));
-            double v_hat_W = state.vW[i][j] / (1.0 - std::pow(beta2, t));
+void Adam8bit::update(Linear& layer, double learn_rate, int batch_size) {
+    step(pointers(layer, plan.layers), learn_rate, batch_size);
+}
+
+
+void Adam8bit::update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                      int batch_size) {
+    step(pointers(layers, plan.layers), learn_rate, batch_size);
+}
+
 
-            layer.W[i][j] -= learn_rate * m_hat_W / (std::sqrt(v_hat_W) + epsilon);
+void Adam8bit::step(const vector<Linear*>& layers, double learn_rate, int batch_size) {
+    ++t;
+
+    // Chunks of sweep() start at multiples of ELEMENTWISE_PARALLEL_THRESHOLD,
+    // and therefore at the first value of a block
+    static_assert(ELEMENTWISE_PARALLEL_THRESHOLD % QUANTIZATION_BLOCK == 0,
+                  "chunks must start at a block");
+    vector<QuantizedSegment>& segments = plan.segments;
+    segments.clear();
+    for (Linear* layer : layers) {
+        if (optimization_states.find(layer) == optimization_states.end()) {
+            initialize(*layer);
         }
+        OptimizationState& state = optimization_states[layer];
+        segments.push_back({ layer->W.data(), layer->dW.data(), &state.W,
+                             layer->W.size(), true });
+        segments.push_back({ layer->b.data(), layer->db.data(), &state.b,
+                             layer->b.size(), false });
     }
+    splitSegments(plan);
+
+    AdamStep bias_step, weight_step;
+    adamSteps(beta1, beta2, epsilon, weight_decay, t, learn_rate, batch_size,
+              bias_step, weight_step);
+
+    auto kernel = kernels().adam_step_8bit;
+    sweep(plan, [&](const QuantizedSegment& segment, size_t begin, size_t end) {
+        QuantizedMoments& moments = *segment.moments;
+        size_t block = begin / QUANTIZATION_BLOCK;
+        kernel(end - begin, segment.w + begin, segment.g + begin,
+               moments.m() + begin, moments.v() + begin,
+               moments.m_scales() + block, moments.v_scales() + block,
+               segment.decay ? weight_step : bias_step);
+    });
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+SGD::SGD(double momentum, bool nesterov) : momentum(momentum), nesterov(nesterov) {}
+
+
+void SGD::initialize(const Linear& layer) {
+    if (momentum != 0) {
+        velocities.erase(&layer);
+        velocityOf(layer);
+    }
+}
+
+
+vector<Tensor> SGD::getState(const Linear& layer) {
+    auto it = velocities.find(&layer);
+    if (it == velocities.end()) {
+        return vector<Tensor>();
+    }
+    return { it->second.vW, it->second.vb };
+}
+
+
 void SGD::update(Linear& layer, double learn_rate, int batch_size) {
-    for (int i = 0; i < layer.b.size(); i++) {
-        layer.b[i] -= layer.db[i] * learn_rate / batch_size;
+    step(pointers(layer, plan.layers), learn_rate, batch_size);
+}
+
+
+void SGD::update(const vector<shared_ptr<Linear>>& layers, double learn_rate,
+                 int batch_size) {
+    step(pointers(layers, plan.layers), learn_rate, batch_size);
+}
+
+
+SGD::Velocity& SGD::velocityOf(const Linear& layer) {
+    auto it = velocities.find(&layer);
+    if (it != velocities.end()) {
+        return it->second;
     }
 
-    for (int i = 0; i < layer.W.size(); i++) {
-        for (int j = 0; j < layer.W[0].size(); j++) {
-            layer.W[i][j] -= layer.dW[i][j] * learn_rate / batch_size;
+    Velocity& velocity = velocities[&layer];
+    velocity.vW = Tensor(layer.W.rows(), layer.W.cols(), 0.0);
+    velocity.vb = Tensor(layer.b.rows(), 1, 0.0);
+    return velocity;
+}
+
+
+void SGD::step(const vector<Linear*>& layers, double learn_rate, int batch_size) {
+    vector<Segment>& segments = plan.segments;
+    segments.clear();
+    for (Linear* layer : layers) {
+        Scalar* vW = nullptr;
+        Scalar* vb = nullptr;
+        if (momentum != 0) {
+            Velocity& velocity = velocityOf(*layer);
+            vW = velocity.vW.data();
+            vb = velocity.vb.data();
+        }
+        segments.push_back({ layer->W.data(), layer->dW.data(), vW, nullptr,
+                             layer->W.size(), true });
+        segments.push_back({ layer->b.data(), layer->db.data(), vb, nullptr,
+                             layer->b.size(), false });
+    }
+    splitSegments(plan);
+
+    SgdStep sgd_step;
+    sgd_step.grad_scale = 1.0 / batch_size;
+    sgd_step.learn_rate = learn_rate;
+    sgd_step.momentum = momentum;
+    sgd_step.nesterov = nesterov;
+
+    auto kernel = kernels().sgd_step;
+    sweep(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        kernel(end - begin, segment.w + begin, segment.g + begin,
+               segment.s1 ? segment.s1 + begin : nullptr, sgd_step);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+LARS::LARS(double momentum, double weight_decay, double trust_coefficient)
+    : SGD(momentum), weight_decay(weight_decay), trust_coefficient(trust_coefficient) {}
+
+
+void LARS::initialize(const Linear& layer) {
+    velocities.erase(&layer);
+    velocityOf(layer);
+}
+
+
+void LARS::step(const vector<Linear*>& layers, double learn_rate, int batch_size) {
+    vector<Segment>& segments = plan.segments;
+    segments.clear();
+    for (Linear* layer : layers) {
+        Velocity& velocity = velocityOf(*layer);
+        segments.push_back({ layer->W.data(), layer->dW.data(), velocity.vW.data(), nullptr,
+                             layer->W.size(), true });
+        segments.push_back({ layer->b.data(), layer->db.data(), velocity.vb.data(), nullptr,
+                             layer->b.size(), false });
+    }
+    splitSegments(plan);
+
+    const KernelTable& kt = kernels();
+    reduceSegments(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        return kt.sum_squares(end - begin, segment.w + begin);
+    }, w_squares);
+    reduceSegments(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        return kt.sum_squares(end - begin, segment.g + begin);
+    }, g_squares);
+
+    // The trust ratio of each weight matrix
+    steps.resize(segments.size());
+    for (size_t s = 0; s < segments.size(); s++) {
+        LarsStep& lars_step = steps[s];
+        lars_step.grad_scale = 1.0 / batch_size;
+        lars_step.momentum = momentum;
+        lars_step.weight_decay = 0;
+        lars_step.local_rate = learn_rate;
+
+        double w_norm = std::sqrt(w_squares[s]);
+        double g_norm = std::sqrt(g_squares[s]) / batch_size;
+        if (segments[s].decay) {
+            lars_step.weight_decay = weight_decay;
+            if (w_norm > 0 && g_norm > 0) {
+                lars_step.local_rate = learn_rate * trust_coefficient * w_norm /
+                                       (g_norm + weight_decay * w_norm);
+            }
         }
     }
-}
\ No newline at end of file
+
+    sweep(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        kt.lars_step(end - begin, segment.w + begin, segment.g + begin, segment.s1 + begin,
+                     steps[&segment - segments.data()]);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+LAMB::LAMB(double beta1, double beta2, double epsilon, double weight_decay)
+    : Adam(beta1, beta2, epsilon, weight_decay) {}
+
+
+void LAMB::step(const vector<Linear*>& layers, double learn_rate, int batch_size) {
+    ++t;
+
+    vector<Segment>& segments = plan.segments;
+    segments.clear();
+    for (Linear* layer : layers) {
+        OptimizationState& state = stateOf(*layer);
+        segments.push_back({ layer->W.data(), layer->dW.data(), state.mW.data(),
+                             state.vW.data(), layer->W.size(), true });
+        segments.push_back({ layer->b.data(), layer->db.data(), state.mb.data(),
+                             state.vb.data(), layer->b.size(), false });
+    }
+    splitSegments(plan);
+
+    LambStep bias_step;
+    bias_step.grad_scale = 1.0 / batch_size;
+    bias_step.beta1 = beta1;
+    bias_step.beta2 = beta2;
+    bias_step.correction1 = 1.0 / (1.0 - std::pow(beta1, (double)t));
+    bias_step.correction2 = 1.0 / std::sqrt(1.0 - std::pow(beta2, (double)t));
+    bias_step.epsilon = epsilon;
+    bias_step.weight_decay = 0;
+
+    LambStep weight_step = bias_step;
+    weight_step.weight_decay = weight_decay;
+
+    // The moments are updated first, which gives the norms of the directions
+    const KernelTable& kt = kernels();
+    reduceSegments(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        return kt.lamb_moments(end - begin, segment.w + begin, segment.g + begin,
+                               segment.s1 + begin, segment.s2 + begin,
+                               segment.decay ? weight_step : bias_step);
+    }, r_squares);
+    reduceSegments(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        return kt.sum_squares(end - begin, segment.w + begin);
+    }, w_squares);
+
+    rates.resize(segments.size());
+    for (size_t s = 0; s < segments.size(); s++) {
+        double w_norm = std::sqrt(w_squares[s]);
+        double r_norm = std::sqrt(r_squares[s]);
+        double trust = segments[s].decay && w_norm > 0 && r_norm > 0 ? w_norm / r_norm : 1;
+        rates[s] = learn_rate * trust;
+    }
+
+    sweep(plan, [&](const Segment& segment, size_t begin, size_t end) {
+        kt.lamb_apply(end - begin, segment.w + begin, segment.s1 + begin, segment.s2 + begin,
+                      segment.decay ? weight_step : bias_step,
+                      rates[&segment - segments.data()]);
+    });
+}
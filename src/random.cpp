@@ -0,0 +1,86 @@
+/*
+ * File: src/random.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the counter-based random number streams used by the stochastic layers.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "random.h"
+#include "elementwise.h"
+#include "kernels.h"
+
+
+// Mask words of bernoulli() generated together, from 16 blocks each
+static const int RANDOM_MASK_WORDS = 4;
+
+// Values of normal() generated together. Even, so pairs are never split.
+static const int RANDOM_NORMAL_BATCH = 256;
+
+static const double TWO_POW_MINUS_32 = 1.0 / 4294967296.0;
+static const double TWO_PI = 6.283185307179586476925286766559;
+
+
+RandomStream::RandomStream(uint64_t seed, uint64_t step, uint32_t layer)
+    : key(seed), stream((uint64_t)(uint32_t)step << 32 | layer) {}
+
+void RandomStream::words(uint64_t first, size_t n_blocks, uint32_t* out) const {
+    kernels().philox(n_blocks, first, stream, key, out);
+}
+
+void RandomStream::bernoulli(size_t n, double p, std::vector<uint64_t>& mask) const {
+    const KernelTable& kt = kernels();
+    ptrdiff_t n_words = (n + 63) / 64;
+    ptrdiff_t n_groups = (n_words + RANDOM_MASK_WORDS - 1) / RANDOM_MASK_WORDS;
+    mask.resize(n_words);
+
+    // A bit is set when its word is below p * 2^32
+    uint64_t threshold = p <= 0 ? 0
+                       : p >= 1 ? (uint64_t)1 << 32
+                       : (uint64_t)(p * 4294967296.0);
+
+    #pragma omp parallel for schedule(static) if(n >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (ptrdiff_t g = 0; g < n_groups; g++) {
+        uint32_t words[64 * RANDOM_MASK_WORDS];
+        kt.philox(16 * RANDOM_MASK_WORDS, (uint64_t)g * 16 * RANDOM_MASK_WORDS,
+                  stream, key, words);
+
+        ptrdiff_t first = g * RANDOM_MASK_WORDS;
+        int count = (int)std::min<ptrdiff_t>(RANDOM_MASK_WORDS, n_words - first);
+        for (int w = 0; w < count; w++) {
+            uint64_t bits = 0;
+            for (int k = 0; k < 64; k++) {
+                bits |= (uint64_t)(words[64 * w + k] < threshold) << k;
+            }
+            mask[first + w] = bits;
+        }
+    }
+}
+
+void RandomStream::normal(size_t n, Scalar* out) const {
+    const KernelTable& kt = kernels();
+    ptrdiff_t n_batches = (n + RANDOM_NORMAL_BATCH - 1) / RANDOM_NORMAL_BATCH;
+
+    #pragma omp parallel for schedule(static) if(n >= ELEMENTWISE_PARALLEL_THRESHOLD)
+    for (ptrdiff_t b = 0; b < n_batches; b++) {
+        uint32_t words[RANDOM_NORMAL_BATCH];
+        kt.philox(RANDOM_NORMAL_BATCH / 4, (uint64_t)b * (RANDOM_NORMAL_BATCH / 4),
+                  stream, key, words);
+
+        size_t first = (size_t)b * RANDOM_NORMAL_BATCH;
+        size_t count = std::min<size_t>(RANDOM_NORMAL_BATCH, n - first);
+        for (size_t i = 0; i < count; i += 2) {
+            // Uniforms in (0, 1), so the logarithm is finite
+            double u1 = (words[i] + 0.5) * TWO_POW_MINUS_32;
+            double u2 = (words[i + 1] + 0.5) * TWO_POW_MINUS_32;
+            double radius = std::sqrt(-2.0 * std::log(u1));
+            double angle = TWO_PI * u2;
+            out[first + i] = radius * std::cos(angle);
+            if (i + 1 < count) {
+                out[first + i + 1] = radius * std::sin(angle);
+            }
+        }
+    }
+}
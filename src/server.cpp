@@ -0,0 +1,279 @@
+/*
+ * File: src/server.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the inference server that serves a network over a Unix domain socket.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+
+// Largest ring a client may attach, to keep its size from overflowing
+static const uint32_t MAX_SLOTS = 1 << 16;
+static const uint32_t MAX_SLOT_COLUMNS = 1 << 16;
+
+
+struct InferenceServer::Connection {
+    int fd;
+
+    // Mapping of the ring of the client, unmapped once no tensor uses it
+    shared_ptr<Scalar> ring;
+    uint32_t slots = 0;
+    uint32_t slot_columns = 0;
+
+    // Requests in order of arrival, answered by respond()
+    struct Pending {
+        RequestMessage request;
+        int32_t status;
+        std::future<Tensor> result;
+    };
+    std::deque<Pending> pending;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable ready;
+
+    std::thread receiver;
+    std::thread responder;
+    std::atomic<int> running;
+
+    explicit Connection(int fd) : fd(fd), running(2) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+InferenceServer::InferenceServer(const shared_ptr<const NeuralNetwork>& network,
+                                 int input_size,
+                                 const std::string& socket_path,
+                                 const BatcherOptions& options)
+    : socket_path(socket_path), listen_fd(-1), stopping(false),
+      batcher(network, input_size, options) {
+
+    hello.magic = IPC_MAGIC;
+    hello.scalar_size = sizeof(Scalar);
+    hello.input_size = input_size;
+    hello.output_size = network->predict(Tensor(input_size, 1, 0)).rows();
+    hello.max_batch_size = options.max_batch_size;
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("InferenceServer: socket path too long");
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error("InferenceServer: cannot create socket");
+    }
+
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        close(listen_fd);
+        throw std::runtime_error("InferenceServer: cannot listen on " + socket_path);
+    }
+}
+
+
+
+InferenceServer::~InferenceServer() {
+    stop();
+
+    // Unblocks the receivers. The responders finish what is pending first.
+    for (auto& connection : connections) {
+        shutdown(connection->fd, SHUT_RD);
+    }
+    for (auto& connection : connections) {
+        connection->receiver.join();
+        connection->responder.join();
+        close(connection->fd);
+    }
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+}
+
+
+
+void InferenceServer::stop() {
+    stopping.store(true);
+}
+
+
+
+void InferenceServer::run() {
+
+    pollfd listener = { listen_fd, POLLIN, 0 };
+
+    while (!stopping.load()) {
+        closeFinished();
+
+        if (poll(&listener, 1, 200) <= 0) {
+            continue;
+        }
+
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+
+        auto connection = make_shared<Connection>(fd);
+        Connection& c = *connection;
+        connection->receiver = std::thread([this, &c] { receive(c); c.running--; });
+        connection->responder = std::thread([this, &c] { respond(c); c.running--; });
+        connections.push_back(connection);
+    }
+}
+
+
+
+void InferenceServer::closeFinished() {
+    for (auto it = connections.begin(); it != connections.end();) {
+        if ((*it)->running.load() == 0) {
+            (*it)->receiver.join();
+            (*it)->responder.join();
+            close((*it)->fd);
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+
+void InferenceServer::handshake(Connection& connection) {
+
+    AttachMessage attach;
+    if (!sendAll(connection.fd, &hello, sizeof(hello)) ||
+        !receiveAll(connection.fd, &attach, sizeof(attach))) {
+        throw std::runtime_error("InferenceServer: handshake failed");
+    }
+
+    attach.name[IPC_NAME_SIZE - 1] = '\0';
+    if (attach.slots == 0 || attach.slots > MAX_SLOTS ||
+        attach.slot_columns == 0 || attach.slot_columns > MAX_SLOT_COLUMNS) {
+        throw std::runtime_error("InferenceServer: invalid ring");
+    }
+
+    size_t bytes = ringBytes(hello, attach.slots, attach.slot_columns);
+
+    int shm_fd = shm_open(attach.name, O_RDWR, 0);
+    if (shm_fd < 0) {
+        throw std::runtime_error("InferenceServer: cannot open shared memory");
+    }
+
+    struct stat info;
+    void* p = MAP_FAILED;
+    if (fstat(shm_fd, &info) == 0 && (size_t)info.st_size >= bytes) {
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    }
+    close(shm_fd);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("InferenceServer: cannot map shared memory");
+    }
+
+    connection.ring = shared_ptr<Scalar>(static_cast<Scalar*>(p),
+                                         [bytes](Scalar* q) { munmap(q, bytes); });
+    connection.slots = attach.slots;
+    connection.slot_columns = attach.slot_columns;
+
+    ResponseMessage ack = { 0, 0, IPC_OK };
+    if (!sendAll(connection.fd, &ack, sizeof(ack))) {
+        throw std::runtime_error("InferenceServer: handshake failed");
+    }
+}
+
+
+
+void InferenceServer::receive(Connection& connection) {
+
+    try {
+        handshake(connection);
+
+        size_t slot_scalars = slotScalars(hello, connection.slot_columns);
+
+        RequestMessage request;
+        while (receiveAll(connection.fd, &request, sizeof(request))) {
+            Connection::Pending pending;
+            pending.request = request;
+            pending.status = IPC_OK;
+
+            if (request.slot >= connection.slots || request.columns == 0 ||
+                request.columns > connection.slot_columns) {
+                pending.status = IPC_BAD_REQUEST;
+            } else {
+                // The samples are the rows of a columns x input_size matrix,
+                // which is transposed in place
+                Scalar* slot = connection.ring.get() + request.slot * slot_scalars;
+                Tensor X = Tensor::wrap(shared_ptr<Scalar>(connection.ring, slot),
+                                        request.columns, hello.input_size).t();
+                pending.result = batcher.submitView(X);
+            }
+
+            std::lock_guard<std::mutex> lock(connection.mutex);
+            connection.pending.push_back(std::move(pending));
+            connection.ready.notify_one();
+        }
+    } catch (const std::exception&) {
+        // The client is dropped
+    }
+
+    std::lock_guard<std::mutex> lock(connection.mutex);
+    connection.closed = true;
+    connection.ready.notify_one();
+}
+
+
+
+void InferenceServer::respond(Connection& connection) {
+
+    bool connected = true;
+
+    for (;;) {
+        Connection::Pending pending;
+        {
+            std::unique_lock<std::mutex> lock(connection.mutex);
+            connection.ready.wait(lock, [&connection] {
+                return connection.closed || !connection.pending.empty();
+            });
+            if (connection.pending.empty()) {
+                break;
+            }
+            pending = std::move(connection.pending.front());
+            connection.pending.pop_front();
+        }
+
+        const RequestMessage& request = pending.request;
+        if (pending.status == IPC_OK) {
+            try {
+                Tensor Y = pending.result.get();
+                size_t slot_scalars = slotScalars(hello, connection.slot_columns);
+                Scalar* outputs = connection.ring.get() + request.slot * slot_scalars +
+                                  (size_t)connection.slot_columns * hello.input_size;
+                Tensor out = Tensor::wrap(shared_ptr<Scalar>(connection.ring, outputs),
+                                          request.columns, hello.output_size).t();
+                out.copyFrom(Y);
+            } catch (const std::exception&) {
+                pending.status = IPC_FAILED;
+            }
+        }
+
+        // Requests still pending are run even if the client is gone, since
+        // the batcher reads their samples
+        ResponseMessage response = { request.ticket, request.slot, pending.status };
+        if (connected) {
+            connected = sendAll(connection.fd, &response, sizeof(response));
+        }
+    }
+}
@@ -0,0 +1,338 @@
+/*
+ * File: src/simd.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains thin wrappers over the SIMD registers of the instruction set a kernel file is compiled for.
+ */
+
+// This header is included by src/kernels_impl.h inside the namespace of one
+// instruction set, so every kernel file gets its own Simd types. The kernel
+// file selects the instruction set by defining DEEPCPP_AVX512, DEEPCPP_AVX2,
+// DEEPCPP_SSE2 or none of them for the scalar reference.
+//
+// Every operation rounds exactly like the matching scalar expression, so a
+// kernel written once over these types gives bitwise identical results on
+// every instruction set. max(a, b) is (a > b) ? a : b, min(a, b) is
+// (a < b) ? a : b and select(m, a, b) is m ? a : b. fmadd is the only
+// exception, and is only used by GEMM.
+//
+// The *Bits operations treat each lane as an unsigned integer of the same
+// width, of type bits, and are used to build and take apart floating point
+// numbers.
+
+
+// One lane, used by the scalar reference and by the tail of vector loops
+template <typename T>
+struct SimdScalar;
+
+template <>
+struct SimdScalar<double> {
+    typedef double type;
+    typedef bool mask;
+    static const int width = 1;
+
+    static type zero() { return 0.0; }
+    static type set1(double x) { return x; }
+    static type load(const double* p) { return *p; }
+    static void store(double* p, type x) { *p = x; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type max(type a, type b) { return a > b ? a : b; }
+    static type fmadd(type a, type b, type c) { return a * b + c; }
+    static mask greater(type a, type b) { return a > b; }
+    static mask greaterEqual(type a, type b) { return a >= b; }
+    static type select(mask m, type a, type b) { return m ? a : b; }
+
+    typedef uint64_t bits;
+    static type fromBits(bits b) { type x; std::memcpy(&x, &b, sizeof(x)); return x; }
+    static bits toBits(type x) { bits b; std::memcpy(&b, &x, sizeof(b)); return b; }
+    static type min(type a, type b) { return a < b ? a : b; }
+    static mask equal(type a, type b) { return a == b; }
+    static type andBits(type a, type b) { return fromBits(toBits(a) & toBits(b)); }
+    static type orBits(type a, type b) { return fromBits(toBits(a) | toBits(b)); }
+    static type addBits(type a, type b) { return fromBits(toBits(a) + toBits(b)); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromBits(toBits(a) << N); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromBits(toBits(a) >> N); }
+};
+
+template <>
+struct SimdScalar<float> {
+    typedef float type;
+    typedef bool mask;
+    static const int width = 1;
+
+    static type zero() { return 0.0f; }
+    static type set1(float x) { return x; }
+    static type load(const float* p) { return *p; }
+    static void store(float* p, type x) { *p = x; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type max(type a, type b) { return a > b ? a : b; }
+    static type fmadd(type a, type b, type c) { return a * b + c; }
+    static mask greater(type a, type b) { return a > b; }
+    static mask greaterEqual(type a, type b) { return a >= b; }
+    static type select(mask m, type a, type b) { return m ? a : b; }
+
+    typedef uint32_t bits;
+    static type fromBits(bits b) { type x; std::memcpy(&x, &b, sizeof(x)); return x; }
+    static bits toBits(type x) { bits b; std::memcpy(&b, &x, sizeof(b)); return b; }
+    static type min(type a, type b) { return a < b ? a : b; }
+    static mask equal(type a, type b) { return a == b; }
+    static type andBits(type a, type b) { return fromBits(toBits(a) & toBits(b)); }
+    static type orBits(type a, type b) { return fromBits(toBits(a) | toBits(b)); }
+    static type addBits(type a, type b) { return fromBits(toBits(a) + toBits(b)); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromBits(toBits(a) << N); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromBits(toBits(a) >> N); }
+};
+
+
+template <typename T>
+struct Simd;
+
+
+#if defined(DEEPCPP_AVX512) && defined(__AVX512F__)
+
+template <>
+struct Simd<double> {
+    typedef __m512d type;
+    typedef __mmask8 mask;
+    static const int width = 8;
+
+    static type zero() { return _mm512_setzero_pd(); }
+    static type set1(double x) { return _mm512_set1_pd(x); }
+    static type load(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, type x) { _mm512_storeu_pd(p, x); }
+    static type add(type a, type b) { return _mm512_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm512_div_pd(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_pd(a); }
+    static type max(type a, type b) { return _mm512_max_pd(a, b); }
+    // a * b + c
+    static type fmadd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+    static mask greater(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static mask greaterEqual(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_pd(m, b, a); }
+
+    typedef uint64_t bits;
+    static __m512i asInt(type a) { return _mm512_castpd_si512(a); }
+    static type fromInt(__m512i a) { return _mm512_castsi512_pd(a); }
+    static type fromBits(bits b) { return fromInt(_mm512_set1_epi64((long long)b)); }
+    static type min(type a, type b) { return _mm512_min_pd(a, b); }
+    static mask equal(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    static type andBits(type a, type b) { return fromInt(_mm512_and_si512(asInt(a), asInt(b))); }
+    static type orBits(type a, type b) { return fromInt(_mm512_or_si512(asInt(a), asInt(b))); }
+    static type addBits(type a, type b) { return fromInt(_mm512_add_epi64(asInt(a), asInt(b))); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromInt(_mm512_slli_epi64(asInt(a), N)); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromInt(_mm512_srli_epi64(asInt(a), N)); }
+};
+
+template <>
+struct Simd<float> {
+    typedef __m512 type;
+    typedef __mmask16 mask;
+    static const int width = 16;
+
+    static type zero() { return _mm512_setzero_ps(); }
+    static type set1(float x) { return _mm512_set1_ps(x); }
+    static type load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, type x) { _mm512_storeu_ps(p, x); }
+    static type add(type a, type b) { return _mm512_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm512_div_ps(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_ps(a); }
+    static type max(type a, type b) { return _mm512_max_ps(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+    static mask greater(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static mask greaterEqual(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_ps(m, b, a); }
+
+    typedef uint32_t bits;
+    static __m512i asInt(type a) { return _mm512_castps_si512(a); }
+    static type fromInt(__m512i a) { return _mm512_castsi512_ps(a); }
+    static type fromBits(bits b) { return fromInt(_mm512_set1_epi32((int)b)); }
+    static type min(type a, type b) { return _mm512_min_ps(a, b); }
+    static mask equal(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static type andBits(type a, type b) { return fromInt(_mm512_and_si512(asInt(a), asInt(b))); }
+    static type orBits(type a, type b) { return fromInt(_mm512_or_si512(asInt(a), asInt(b))); }
+    static type addBits(type a, type b) { return fromInt(_mm512_add_epi32(asInt(a), asInt(b))); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromInt(_mm512_slli_epi32(asInt(a), N)); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromInt(_mm512_srli_epi32(asInt(a), N)); }
+};
+
+#elif defined(DEEPCPP_AVX2) && defined(__AVX2__)
+
+template <>
+struct Simd<double> {
+    typedef __m256d type;
+    typedef __m256d mask;
+    static const int width = 4;
+
+    static type zero() { return _mm256_setzero_pd(); }
+    static type set1(double x) { return _mm256_set1_pd(x); }
+    static type load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, type x) { _mm256_storeu_pd(p, x); }
+    static type add(type a, type b) { return _mm256_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm256_div_pd(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+    static type max(type a, type b) { return _mm256_max_pd(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+    static mask greater(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static mask greaterEqual(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_pd(b, a, m); }
+
+    typedef uint64_t bits;
+    static __m256i asInt(type a) { return _mm256_castpd_si256(a); }
+    static type fromInt(__m256i a) { return _mm256_castsi256_pd(a); }
+    static type fromBits(bits b) { return fromInt(_mm256_set1_epi64x((long long)b)); }
+    static type min(type a, type b) { return _mm256_min_pd(a, b); }
+    static mask equal(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static type andBits(type a, type b) { return _mm256_and_pd(a, b); }
+    static type orBits(type a, type b) { return _mm256_or_pd(a, b); }
+    static type addBits(type a, type b) { return fromInt(_mm256_add_epi64(asInt(a), asInt(b))); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromInt(_mm256_slli_epi64(asInt(a), N)); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromInt(_mm256_srli_epi64(asInt(a), N)); }
+};
+
+template <>
+struct Simd<float> {
+    typedef __m256 type;
+    typedef __m256 mask;
+    static const int width = 8;
+
+    static type zero() { return _mm256_setzero_ps(); }
+    static type set1(float x) { return _mm256_set1_ps(x); }
+    static type load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, type x) { _mm256_storeu_ps(p, x); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+    static mask greater(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static mask greaterEqual(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_ps(b, a, m); }
+
+    typedef uint32_t bits;
+    static __m256i asInt(type a) { return _mm256_castps_si256(a); }
+    static type fromInt(__m256i a) { return _mm256_castsi256_ps(a); }
+    static type fromBits(bits b) { return fromInt(_mm256_set1_epi32((int)b)); }
+    static type min(type a, type b) { return _mm256_min_ps(a, b); }
+    static mask equal(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static type andBits(type a, type b) { return _mm256_and_ps(a, b); }
+    static type orBits(type a, type b) { return _mm256_or_ps(a, b); }
+    static type addBits(type a, type b) { return fromInt(_mm256_add_epi32(asInt(a), asInt(b))); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromInt(_mm256_slli_epi32(asInt(a), N)); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromInt(_mm256_srli_epi32(asInt(a), N)); }
+};
+
+#elif defined(DEEPCPP_SSE2) && defined(__SSE2__)
+
+template <>
+struct Simd<double> {
+    typedef __m128d type;
+    typedef __m128d mask;
+    static const int width = 2;
+
+    static type zero() { return _mm_setzero_pd(); }
+    static type set1(double x) { return _mm_set1_pd(x); }
+    static type load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, type x) { _mm_storeu_pd(p, x); }
+    static type add(type a, type b) { return _mm_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm_div_pd(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_pd(a); }
+    static type max(type a, type b) { return _mm_max_pd(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static mask greater(type a, type b) { return _mm_cmpgt_pd(a, b); }
+    static mask greaterEqual(type a, type b) { return _mm_cmpge_pd(a, b); }
+    static type select(mask m, type a, type b) {
+        return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b));
+    }
+
+    typedef uint64_t bits;
+    static __m128i asInt(type a) { return _mm_castpd_si128(a); }
+    static type fromInt(__m128i a) { return _mm_castsi128_pd(a); }
+    static type fromBits(bits b) { return fromInt(_mm_set1_epi64x((long long)b)); }
+    static type min(type a, type b) { return _mm_min_pd(a, b); }
+    static mask equal(type a, type b) { return _mm_cmpeq_pd(a, b); }
+    static type andBits(type a, type b) { return _mm_and_pd(a, b); }
+    static type orBits(type a, type b) { return _mm_or_pd(a, b); }
+    static type addBits(type a, type b) { return fromInt(_mm_add_epi64(asInt(a), asInt(b))); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromInt(_mm_slli_epi64(asInt(a), N)); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromInt(_mm_srli_epi64(asInt(a), N)); }
+};
+
+template <>
+struct Simd<float> {
+    typedef __m128 type;
+    typedef __m128 mask;
+    static const int width = 4;
+
+    static type zero() { return _mm_setzero_ps(); }
+    static type set1(float x) { return _mm_set1_ps(x); }
+    static type load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, type x) { _mm_storeu_ps(p, x); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_ps(a); }
+    static type max(type a, type b) { return _mm_max_ps(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static mask greater(type a, type b) { return _mm_cmpgt_ps(a, b); }
+    static mask greaterEqual(type a, type b) { return _mm_cmpge_ps(a, b); }
+    static type select(mask m, type a, type b) {
+        return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+    }
+
+    typedef uint32_t bits;
+    static __m128i asInt(type a) { return _mm_castps_si128(a); }
+    static type fromInt(__m128i a) { return _mm_castsi128_ps(a); }
+    static type fromBits(bits b) { return fromInt(_mm_set1_epi32((int)b)); }
+    static type min(type a, type b) { return _mm_min_ps(a, b); }
+    static mask equal(type a, type b) { return _mm_cmpeq_ps(a, b); }
+    static type andBits(type a, type b) { return _mm_and_ps(a, b); }
+    static type orBits(type a, type b) { return _mm_or_ps(a, b); }
+    static type addBits(type a, type b) { return fromInt(_mm_add_epi32(asInt(a), asInt(b))); }
+    template <int N>
+    static type shiftLeftBits(type a) { return fromInt(_mm_slli_epi32(asInt(a), N)); }
+    template <int N>
+    static type shiftRightBits(type a) { return fromInt(_mm_srli_epi32(asInt(a), N)); }
+};
+
+#else
+
+template <>
+struct Simd<double> : SimdScalar<double> {};
+
+template <>
+struct Simd<float> : SimdScalar<float> {};
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * File: src/simd_math.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains polynomial approximations of exp, log, tanh and erf written over the Simd wrappers.
+ */
+
+// Included by src/kernels_impl.h after src/simd.h, inside the namespace of one
+// instruction set. Every function is written once over the Simd interface, so
+// like the other kernels it rounds the same on every instruction set and in
+// the scalar tail of the loops.
+//
+// The Tier parameter picks the length of the polynomials:
+//
+//   HighAccuracy   relative error around 1e-7
+//   FastAccuracy   relative error around 1e-4
+//
+// NaN is propagated. exp overflows to infinity above EXP_MAX, a little before
+// libm does, and flushes to zero below EXP_MIN instead of going subnormal.
+
+
+// Tiers
+//////////////////////////////////////////////////////////////////////////////
+
+struct HighAccuracy {
+    static const int EXP_TERMS = 7;        // Taylor terms of expm1 on [-ln2/2, ln2/2]
+    static const int LOG_TERMS = 5;        // Terms of the atanh series of log
+    static const int ERF_TERMS = 6;        // Taylor terms of erf below ERF_SERIES_LIMIT
+    static const bool RATIONAL_ERFC = true;   // Numerical Recipes erfc, 1.2e-7
+};
+
+struct FastAccuracy {
+    static const int EXP_TERMS = 5;
+    static const int LOG_TERMS = 3;
+    static const int ERF_TERMS = 4;
+    static const bool RATIONAL_ERFC = false;  // Abramowitz and Stegun 7.1.26, 1.5e-7 absolute
+};
+
+
+// Floating point formats
+//////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+struct FloatFormat;
+
+template <>
+struct FloatFormat<double> {
+    typedef uint64_t bits;
+    static const int MANTISSA_BITS = 52;
+    static const bits EXPONENT_BIAS = 1023;
+    static const bits MANTISSA_MASK = 0x000FFFFFFFFFFFFFull;
+    static const bits SIGN_MASK = 0x8000000000000000ull;
+    static const bits ONE = 0x3FF0000000000000ull;
+
+    // 1.5 * 2^52: adding it rounds to an integer kept in the low bits
+    static constexpr double ROUND_MAGIC = 6755399441055744.0;
+    // 2^52: or-ing an integer below it into its low bits gives 2^52 + integer
+    static constexpr double INTEGER_MAGIC = 4503599627370496.0;
+
+    static constexpr double EXP_MAX = 709.0;
+    static constexpr double EXP_MIN = -708.0;
+    static constexpr double LN2_HI = 0.693145751953125;
+    static constexpr double LN2_LO = 1.42860682030941723212e-6;
+    static constexpr double MIN_NORMAL = 2.2250738585072014e-308;
+    static constexpr double SUBNORMAL_SCALE = 18014398509481984.0;  // 2^54
+    static constexpr double SUBNORMAL_BITS = 54.0;
+    // tanh rounds to 1 from here on
+    static constexpr double TANH_SATURATION = 22.0;
+};
+
+template <>
+struct FloatFormat<float> {
+    typedef uint32_t bits;
+    static const int MANTISSA_BITS = 23;
+    static const bits EXPONENT_BIAS = 127;
+    static const bits MANTISSA_MASK = 0x007FFFFFu;
+    static const bits SIGN_MASK = 0x80000000u;
+    static const bits ONE = 0x3F800000u;
+
+    static constexpr float ROUND_MAGIC = 12582912.0f;
+    static constexpr float INTEGER_MAGIC = 8388608.0f;
+
+    static constexpr float EXP_MAX = 88.0f;
+    static constexpr float EXP_MIN = -87.0f;
+    static constexpr float LN2_HI = 0.693359375f;
+    static constexpr float LN2_LO = -2.12194440e-4f;
+    static constexpr float MIN_NORMAL = 1.17549435e-38f;
+    static constexpr float SUBNORMAL_SCALE = 33554432.0f;  // 2^25
+    static constexpr float SUBNORMAL_BITS = 25.0f;
+    static constexpr float TANH_SATURATION = 9.0f;
+};
+
+
+// Helpers
+//////////////////////////////////////////////////////////////////////////////
+
+// c[0] + x * (c[1] + x * (... + x * c[n - 1])), by default over all of c
+template <typename S, int N>
+typename S::type polynomial(typename S::type x, const double (&c)[N], int n = N) {
+    typename S::type p = S::set1(Scalar(c[n - 1]));
+    for (int k = n - 2; k >= 0; k--) {
+        p = S::add(S::set1(Scalar(c[k])), S::mul(x, p));
+    }
+    return p;
+}
+
+template <typename S>
+typename S::type absolute(typename S::type x) {
+    typedef FloatFormat<Scalar> F;
+    return S::andBits(x, S::fromBits(~F::SIGN_MASK));
+}
+
+// x with the sign of s, for x >= 0
+template <typename S>
+typename S::type withSign(typename S::type x, typename S::type s) {
+    typedef FloatFormat<Scalar> F;
+    return S::orBits(x, S::andBits(s, S::fromBits(F::SIGN_MASK)));
+}
+
+
+// exp
+//////////////////////////////////////////////////////////////////////////////
+
+// Splits x into n * ln2 + r with |r| <= ln2 / 2. Returns expm1(r) and sets
+// scale to 2^n. x must lie within [EXP_MIN, EXP_MAX].
+template <typename S, typename Tier>
+typename S::type expReduced(typename S::type x, typename S::type& scale) {
+    typedef FloatFormat<Scalar> F;
+    static const double EXPM1_COEFFICIENTS[] = {
+        1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320
+    };
+
+    typename S::type magic = S::set1(F::ROUND_MAGIC);
+    typename S::type t = S::add(S::mul(x, S::set1(Scalar(M_LOG2E))), magic);
+    typename S::type n = S::sub(t, magic);
+
+    // Cody and Waite reduction: n * LN2_HI is exact
+    typename S::type r = S::sub(S::sub(x, S::mul(n, S::set1(F::LN2_HI))),
+                                S::mul(n, S::set1(F::LN2_LO)));
+
+    // The low bits of t hold n, which biased and shifted is the exponent of 2^n
+    scale = S::template shiftLeftBits<F::MANTISSA_BITS>(
+        S::addBits(t, S::fromBits(F::EXPONENT_BIAS)));
+
+    return S::mul(r, polynomial<S>(r, EXPM1_COEFFICIENTS, Tier::EXP_TERMS));
+}
+
+template <typename S, typename Tier>
+typename S::type simdExp(typename S::type x) {
+    typedef FloatFormat<Scalar> F;
+    typename S::type x_max = S::set1(F::EXP_MAX);
+    typename S::type x_min = S::set1(F::EXP_MIN);
+
+    // Operands ordered so that NaN goes through
+    typename S::type scale;
+    typename S::type q = expReduced<S, Tier>(S::min(x_max, S::max(x_min, x)), scale);
+    typename S::type result = S::mul(S::add(S::set1(1), q), scale);
+
+    result = S::select(S::greater(x, x_max),
+                       S::set1(std::numeric_limits<Scalar>::infinity()), result);
+    return S::select(S::greater(x_min, x), S::zero(), result);
+}
+
+// exp(x) - 1 without cancellation near 0, for 0 <= x <= EXP_MAX
+template <typename S, typename Tier>
+typename S::type simdExpm1(typename S::type x) {
+    typename S::type scale;
+    typename S::type q = expReduced<S, Tier>(x, scale);
+    return S::add(S::mul(scale, q), S::sub(scale, S::set1(1)));
+}
+
+
+// log
+//////////////////////////////////////////////////////////////////////////////
+
+template <typename S, typename Tier>
+typename S::type simdLog(typename S::type x) {
+    typedef FloatFormat<Scalar> F;
+    // log((1 + s) / (1 - s)) = 2 * (s + s^3 / 3 + s^5 / 5 + ...)
+    static const double ATANH_COEFFICIENTS[] = {
+        1.0, 1.0 / 3, 1.0 / 5, 1.0 / 7, 1.0 / 9, 1.0 / 11
+    };
+
+    // Subnormals are scaled into the normal range first
+    typename S::mask subnormal = S::greater(S::set1(F::MIN_NORMAL), x);
+    typename S::type xs = S::select(subnormal, S::mul(x, S::set1(F::SUBNORMAL_SCALE)), x);
+    typename S::type bias = S::select(subnormal,
+                                      S::set1(Scalar(F::EXPONENT_BIAS) + F::SUBNORMAL_BITS),
+                                      S::set1(Scalar(F::EXPONENT_BIAS)));
+
+    // x = 2^e * m with m in [1, 2)
+    typename S::type integer_magic = S::set1(F::INTEGER_MAGIC);
+    typename S::type biased = S::sub(
+        S::orBits(S::template shiftRightBits<F::MANTISSA_BITS>(xs), integer_magic),
+        integer_magic);
+    typename S::type e = S::sub(biased, bias);
+    typename S::type m = S::orBits(S::andBits(xs, S::fromBits(F::MANTISSA_MASK)),
+                                   S::fromBits(F::ONE));
+
+    // Then m in [sqrt(2) / 2, sqrt(2))
+    typename S::mask high = S::greater(m, S::set1(Scalar(M_SQRT2)));
+    m = S::select(high, S::mul(m, S::set1(Scalar(0.5))), m);
+    e = S::select(high, S::add(e, S::set1(1)), e);
+
+    typename S::type f = S::sub(m, S::set1(1));
+    typename S::type s = S::div(f, S::add(f, S::set1(2)));
+    typename S::type log_m = S::mul(S::add(s, s),
+                                    polynomial<S>(S::mul(s, s), ATANH_COEFFICIENTS,
+                                                  Tier::LOG_TERMS));
+
+    typename S::type result = S::add(S::mul(e, S::set1(F::LN2_HI)),
+                                     S::add(log_m, S::mul(e, S::set1(F::LN2_LO))));
+
+    const Scalar inf = std::numeric_limits<Scalar>::infinity();
+    result = S::select(S::greater(x, S::zero()), result,
+                       S::set1(std::numeric_limits<Scalar>::quiet_NaN()));
+    result = S::select(S::equal(x, S::zero()), S::set1(-inf), result);
+    return S::select(S::equal(x, S::set1(inf)), x, result);
+}
+
+
+// tanh
+//////////////////////////////////////////////////////////////////////////////
+
+// tanh(|x|) = expm1(2|x|) / (expm1(2|x|) + 2)
+template <typename S, typename Tier>
+typename S::type simdTanh(typename S::type x) {
+    typedef FloatFormat<Scalar> F;
+    typename S::type a = S::min(S::set1(F::TANH_SATURATION), absolute<S>(x));
+    typename S::type e = simdExpm1<S, Tier>(S::add(a, a));
+    return withSign<S>(S::div(e, S::add(e, S::set1(2))), x);
+}
+
+
+// erf
+//////////////////////////////////////////////////////////////////////////////
+
+const double ERF_SERIES_LIMIT = 0.5;
+
+template <typename S, typename Tier>
+typename S::type simdErf(typename S::type x) {
+    // 2 / sqrt(pi) * (-1)^k / (k! * (2k + 1))
+    static const double SERIES_COEFFICIENTS[] = {
+        1.1283791670955126, -0.37612638903183754, 0.11283791670955126,
+        -0.026866170645131252, 0.0052239776254421878, -0.00085483270234508528,
+        0.00012055332981789664
+    };
+    static const double RATIONAL_COEFFICIENTS[] = {
+        -1.26551223, 1.00002368, 0.37409196, 0.09678418, -0.18628806,
+        0.27886807, -1.13520398, 1.48851587, -0.82215223, 0.17087277
+    };
+    static const double AS_COEFFICIENTS[] = {
+        0.0, 0.254829592, -0.284496736, 1.421413741, -1.453152027, 1.061405429
+    };
+
+    // Near 0, where 1 - erfc(x) would lose the relative accuracy
+    typename S::type series = S::mul(x, polynomial<S>(S::mul(x, x), SERIES_COEFFICIENTS,
+                                                      Tier::ERF_TERMS));
+
+    typename S::type a = absolute<S>(x);
+    typename S::type minus_a2 = S::sub(S::zero(), S::mul(a, a));
+    typename S::type erfc;
+    if (Tier::RATIONAL_ERFC) {
+        typename S::type t = S::div(S::set1(1),
+                                    S::add(S::set1(1), S::mul(S::set1(Scalar(0.5)), a)));
+        erfc = S::mul(t, simdExp<S, Tier>(S::add(minus_a2,
+                                                 polynomial<S>(t, RATIONAL_COEFFICIENTS))));
+    } else {
+        typename S::type t = S::div(S::set1(1),
+                                    S::add(S::set1(1), S::mul(S::set1(Scalar(0.3275911)), a)));
+        erfc = S::mul(polynomial<S>(t, AS_COEFFICIENTS), simdExp<S, Tier>(minus_a2));
+    }
+    typename S::type tail = withSign<S>(S::sub(S::set1(1), erfc), x);
+
+    return S::select(S::greater(S::set1(Scalar(ERF_SERIES_LIMIT)), a), series, tail);
+}
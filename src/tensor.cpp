@@ -0,0 +1,212 @@
+/*
+ * File: src/tensor.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the definitions of the Tensor class.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include "tensor.h"
+
+
+static shared_ptr<Scalar> alignedBuffer(size_t n) {
+    if (n == 0) {
+        return shared_ptr<Scalar>();
+    }
+
+    void* p = nullptr;
+    if (posix_memalign(&p, Tensor::ALIGNMENT, n * sizeof(Scalar)) != 0) {
+        throw std::bad_alloc();
+    }
+
+    return shared_ptr<Scalar>(static_cast<Scalar*>(p), free);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Tensor::Tensor()
+    : ptr(nullptr), n_rows(0), n_cols(0), row_stride(0), col_stride(1),
+      grows(false), capacity(0) {}
+
+Tensor::Tensor(int rows, int cols, Scalar value) {
+    *this = allocate(rows, cols);
+    fill(value);
+}
+
+Tensor Tensor::allocate(int rows, int cols) {
+    Tensor tensor;
+    tensor.storage = alignedBuffer((size_t)rows * cols);
+    tensor.ptr = tensor.storage.get();
+    tensor.n_rows = rows;
+    tensor.n_cols = cols;
+    tensor.row_stride = cols;
+    tensor.col_stride = 1;
+    return tensor;
+}
+
+Tensor Tensor::wrap(const shared_ptr<Scalar>& storage, int rows, int cols) {
+    Tensor tensor;
+    tensor.storage = storage;
+    tensor.ptr = storage.get();
+    tensor.n_rows = rows;
+    tensor.n_cols = cols;
+    tensor.row_stride = cols;
+    tensor.col_stride = 1;
+    return tensor;
+}
+
+Tensor Tensor::growable() {
+    Tensor tensor;
+    tensor.grows = true;
+    return tensor;
+}
+
+void Tensor::ensureShape(int rows, int cols) {
+    if (rows == n_rows && cols == n_cols) {
+        return;
+    }
+    if (!grows) {
+        *this = allocate(rows, cols);
+        return;
+    }
+
+    if ((size_t)rows * cols > capacity) {
+        capacity = (size_t)rows * cols;
+        storage = alignedBuffer(capacity);
+    }
+    ptr = storage.get();
+    n_rows = rows;
+    n_cols = cols;
+    row_stride = cols;
+    col_stride = 1;
+}
+
+Tensor::Tensor(const Matrix& M) {
+    int rows = M.size();
+    int cols = rows > 0 ? M[0].size() : 0;
+    for (const Vector& row : M) {
+        if ((int)row.size() != cols) {
+            throw std::invalid_argument("Tensor: rows of different lengths");
+        }
+    }
+    *this = allocate(rows, cols);
+
+    for (int i = 0; i < rows; i++) {
+        std::memcpy(ptr + (size_t)i * cols, M[i].data(), cols * sizeof(Scalar));
+    }
+}
+
+Tensor::Tensor(const Vector& v) {
+    *this = allocate(v.size(), 1);
+    std::memcpy(ptr, v.data(), v.size() * sizeof(Scalar));
+}
+
+Tensor::operator Matrix() const {
+    return toMatrix();
+}
+
+Matrix Tensor::toMatrix() const {
+    Matrix M(n_rows, Vector(n_cols));
+
+    for (int i = 0; i < n_rows; i++) {
+        for (int j = 0; j < n_cols; j++) {
+            M[i][j] = (*this)(i, j);
+        }
+    }
+
+    return M;
+}
+
+Vector Tensor::toVector() const {
+    Vector v;
+    v.reserve(size());
+
+    for (int i = 0; i < n_rows; i++) {
+        for (int j = 0; j < n_cols; j++) {
+            v.push_back((*this)(i, j));
+        }
+    }
+
+    return v;
+}
+
+bool Tensor::isContiguous() const {
+    return col_stride == 1 && (row_stride == n_cols || n_rows <= 1);
+}
+
+bool Tensor::sameShape(const Tensor& other) const {
+    return n_rows == other.n_rows && n_cols == other.n_cols;
+}
+
+Tensor Tensor::t() const {
+    Tensor view = *this;
+    view.grows = false;
+    view.n_rows = n_cols;
+    view.n_cols = n_rows;
+    view.row_stride = col_stride;
+    view.col_stride = row_stride;
+    return view;
+}
+
+Tensor Tensor::rowSlice(int begin, int end) const {
+    Tensor view = *this;
+    view.grows = false;
+    view.ptr = ptr + (ptrdiff_t)begin * row_stride;
+    view.n_rows = end - begin;
+    return view;
+}
+
+Tensor Tensor::colSlice(int begin, int end) const {
+    Tensor view = *this;
+    view.grows = false;
+    view.ptr = ptr + (ptrdiff_t)begin * col_stride;
+    view.n_cols = end - begin;
+    return view;
+}
+
+Tensor Tensor::view(size_t offset, int rows, int cols) const {
+    Tensor view = *this;
+    view.grows = false;
+    view.ptr = ptr + offset;
+    view.n_rows = rows;
+    view.n_cols = cols;
+    view.row_stride = cols;
+    view.col_stride = 1;
+    return view;
+}
+
+Tensor Tensor::clone() const {
+    Tensor copy = allocate(n_rows, n_cols);
+    copy.copyFrom(*this);
+    return copy;
+}
+
+void Tensor::fill(Scalar value) {
+    if (isContiguous()) {
+        std::fill(ptr, ptr + size(), value);
+        return;
+    }
+
+    for (int i = 0; i < n_rows; i++) {
+        for (int j = 0; j < n_cols; j++) {
+            (*this)(i, j) = value;
+        }
+    }
+}
+
+void Tensor::copyFrom(const Tensor& other) {
+    if (isContiguous() && other.isContiguous()) {
+        std::memcpy(ptr, other.ptr, size() * sizeof(Scalar));
+        return;
+    }
+
+    for (int i = 0; i < n_rows; i++) {
+        for (int j = 0; j < n_cols; j++) {
+            (*this)(i, j) = other(i, j);
+        }
+    }
+}
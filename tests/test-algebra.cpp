@@ -0,0 +1,44 @@
+/*
+ * File: tests/test-algebra.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the test of the algebra on the nested vector representation.
+ */
+
+#include "algebra.h"
+#include "test.h"
+
+using namespace std;
+
+// The operations take Matrix and Vector arguments, converted to tensors, and
+// their results can be assigned to a Matrix, as before they returned
+// expressions. Most of this test is that it compiles.
+
+int main() {
+    Matrix A = { { 1, 2, 3 }, { 4, 5, 6 } };
+    Matrix B = { { 6, 5, 4 }, { 3, 2, 1 } };
+    Vector b = { 10, 20 };
+
+    Matrix h = hadamard(A, B);
+    Matrix d = minusM(A, B);
+    Matrix s = sum(A, b);
+    Matrix p = product(A, 2.0);
+    Vector v = product(b, 0.5);
+    Tensor mixed = hadamard(Tensor(A), minusM(A, B));
+    Matrix from_vector = sum(hadamard(b, b), b);
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 3; j++) {
+            CHECK(h[i][j] == A[i][j] * B[i][j], "hadamard(" << i << ", " << j << ")");
+            CHECK(d[i][j] == A[i][j] - B[i][j], "minusM(" << i << ", " << j << ")");
+            CHECK(s[i][j] == A[i][j] + b[i], "sum(" << i << ", " << j << ")");
+            CHECK(p[i][j] == A[i][j] * 2, "product(" << i << ", " << j << ")");
+            CHECK(mixed(i, j) == A[i][j] * (A[i][j] - B[i][j]),
+                  "hadamard of an expression(" << i << ", " << j << ")");
+        }
+        CHECK(v[i] == b[i] / 2, "product of a Vector(" << i << ")");
+        CHECK(from_vector[i][0] == b[i] * b[i] + b[i], "sum of Vectors(" << i << ")");
+    }
+
+    return testResult("test-algebra");
+}
@@ -0,0 +1,143 @@
+/*
+ * File: tests/test-inference.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the test of the buffers reused by inference.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "NNUtils.h"
+#include "test.h"
+
+using namespace std;
+
+
+// Networks
+//////////////////////////////////////////////////////////////////////////////
+
+// Outputs of different sizes, so that each buffer of a context holds
+// several shapes in one pass
+static NeuralNetwork buildNetwork() {
+    srand(11);
+    vector<shared_ptr<Layer>> layers = {
+        make_shared<Linear>(12, 32),
+        make_shared<Relu>(),
+        make_shared<Linear>(32, 8),
+        make_shared<Tanh>(),
+        make_shared<Linear>(8, 24),
+        make_shared<Dropout>(0.8),
+        make_shared<Linear>(24, 10),
+        make_shared<SoftMax>()
+    };
+    return NeuralNetwork(layers, make_shared<CrossEntropy>(), make_shared<Adam>());
+}
+
+static Tensor randomInput(int cols) {
+    Tensor X = Tensor::allocate(12, cols);
+    for (int i = 0; i < X.rows(); i++) {
+        for (int j = 0; j < X.cols(); j++) {
+            X(i, j) = Scalar(rand()) / RAND_MAX - Scalar(0.5);
+        }
+    }
+    return X;
+}
+
+static bool bitwiseEqual(const Tensor& a, const Tensor& b) {
+    if (a.rows() != b.rows() || a.cols() != b.cols()) {
+        return false;
+    }
+    for (int i = 0; i < a.rows(); i++) {
+        for (int j = 0; j < a.cols(); j++) {
+            if (memcmp(&a(i, j), &b(i, j), sizeof(Scalar)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// Tests
+//////////////////////////////////////////////////////////////////////////////
+
+static void testGrowable() {
+    Tensor buffer = Tensor::growable();
+    buffer.ensureShape(8, 16);
+    const Scalar* data = buffer.data();
+
+    buffer.ensureShape(16, 4);
+    CHECK(buffer.data() == data && buffer.isContiguous(), "growable: smaller shape reallocated");
+    buffer.ensureShape(8, 16);
+    CHECK(buffer.data() == data, "growable: same size reallocated");
+    buffer.ensureShape(8, 17);
+    CHECK(buffer.data() != data && buffer.size() == 8 * 17, "growable: larger shape not grown");
+
+    // Views and plain tensors allocate a buffer of their own
+    Tensor view = buffer.view(0, 2, 4);
+    view.ensureShape(1, 4);
+    CHECK(view.data() != buffer.data(), "growable: a view reshaped the buffer");
+    Tensor plain = Tensor::allocate(8, 16);
+    data = plain.data();
+    plain.ensureShape(4, 4);
+    CHECK(plain.data() != data, "allocate: a plain tensor reused its buffer");
+}
+
+// The output of a second predict() with the same context is written to the
+// same buffer, whatever the width of the inputs in between
+static void testPredict() {
+    NeuralNetwork network = buildNetwork();
+    Tensor X = randomInput(33);
+    Tensor narrow = randomInput(5);
+    Tensor wide = randomInput(40);
+
+    InferenceContext context;
+    Tensor first = network.predict(X, context);
+    Tensor expected = first.clone();
+    const Scalar* data = first.data();
+
+    Tensor second = network.predict(X, context);
+    CHECK(second.data() == data, "predict: second call moved the output");
+    CHECK(bitwiseEqual(second, expected), "predict: second call differs");
+
+    CHECK(bitwiseEqual(network.predict(narrow, context), network.predict(narrow)),
+          "predict: narrower input differs from a new context");
+    CHECK(network.predict(X, context).data() == data,
+          "predict: call after a narrower input moved the output");
+
+    CHECK(bitwiseEqual(network.predict(wide, context), network.predict(wide)),
+          "predict: wider input differs from a new context");
+    data = context.getOutput().data();
+    CHECK(network.predict(wide, context).data() == data, "predict: wider call moved the output");
+    CHECK(bitwiseEqual(network.predict(X, context), expected),
+          "predict: call after a wider input differs");
+}
+
+// forward in eval mode, as in a loop over the batches under NoGrad, is
+// predict() with the context of the network
+static void testEvalForward() {
+    NeuralNetwork network = buildNetwork();
+    Tensor X = randomInput(33);
+    Tensor narrow = randomInput(5);
+
+    NoGrad no_grad(network);
+    Tensor first = network.forward(X);
+    Tensor expected = first.clone();
+    const Scalar* data = first.data();
+    CHECK(bitwiseEqual(expected, network.predict(X)), "forward: eval mode differs from predict");
+
+    for (int batch = 0; batch < 3; batch++) {
+        network.forward(narrow);
+        Tensor output = network.forward(X);
+        CHECK(output.data() == data, "forward: batch " << batch << " moved the output");
+        CHECK(bitwiseEqual(output, expected), "forward: batch " << batch << " differs");
+    }
+}
+
+int main() {
+    testGrowable();
+    testPredict();
+    testEvalForward();
+    return testResult("test-inference");
+}
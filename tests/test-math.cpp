@@ -0,0 +1,252 @@
+/*
+ * File: tests/test-math.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the test of the error of the exp, log, tanh, erf, sigmoid and GELU kernels.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <vector>
+
+#include "kernels.h"
+#include "test.h"
+
+using namespace std;
+
+typedef numeric_limits<Scalar> Limits;
+
+
+// Bounds
+//////////////////////////////////////////////////////////////////////////////
+
+// Largest error allowed for each accuracy, as documented in
+// include/kernels.h, relative to the exact value, see error().
+// MathAccuracy::Exact is libm, which is within an ulp or two of the exact
+// value, or a few for the formulas of sigmoid and GELU built on it.
+static double maxError(MathAccuracy accuracy) {
+    switch (accuracy) {
+        case MathAccuracy::Exact: return 4 * Limits::epsilon();
+        case MathAccuracy::High:  return sizeof(Scalar) == sizeof(double) ? 1e-7 : 4e-7;
+        default:                  return 1e-4;
+    }
+}
+
+// Saturation of the approximations, see src/simd_math.h: exp overflows to
+// infinity above EXP_MAX and flushes to 0 below EXP_MIN.
+static const Scalar EXP_MAX = sizeof(Scalar) == sizeof(double) ? 709.0 : 88.0;
+static const Scalar EXP_MIN = sizeof(Scalar) == sizeof(double) ? -708.0 : -87.0;
+
+// Smallest value exp and sigmoid return without flushing it to 0
+static const long double EXP_TINY = std::exp((long double)EXP_MIN);
+
+
+// Functions
+//////////////////////////////////////////////////////////////////////////////
+
+const long double SQRT2_OVER_PI = std::sqrt(2.0L / M_PIl);
+const long double GELU_CONSTANT = 0.044715L;
+
+static long double sigmoid(long double x) {
+    return 1 / (1 + std::exp(-x));
+}
+
+static long double gelu(long double x) {
+    return x / 2 * (1 + std::tanh(SQRT2_OVER_PI * (x + GELU_CONSTANT * x * x * x)));
+}
+
+static long double geluErf(long double x) {
+    return x / 2 * std::erfc(-x / std::sqrt(2.0L));
+}
+
+static long double exponential(long double x) { return std::exp(x); }
+static long double logarithm(long double x) { return std::log(x); }
+static long double hyperbolicTangent(long double x) { return std::tanh(x); }
+static long double errorFunction(long double x) { return std::erf(x); }
+
+struct Function {
+    const char* name;
+    UnaryKernel KernelTable::*kernel;
+    long double (*exact)(long double);
+
+    // Values of GELU are x times a cdf, whose error is absolute near its
+    // lower tail, so they are compared relative to x
+    bool relative_to_input;
+
+    // exp and sigmoid flush results below EXP_TINY to 0
+    bool flushes;
+
+    // Inputs of the dense sweep
+    double low;
+    double high;
+};
+
+static const Function FUNCTIONS[] = {
+    { "exp",      &KernelTable::exp,      exponential,       false, true,  -800, 800 },
+    { "log",      &KernelTable::log,      logarithm,         false, false, 0,    10 },
+    { "tanh",     &KernelTable::tanh,     hyperbolicTangent, false, false, -25,  25 },
+    { "erf",      &KernelTable::erf,      errorFunction,     false, false, -7,   7 },
+    { "sigmoid",  &KernelTable::sigmoid,  sigmoid,           false, true,  -800, 800 },
+    { "gelu",     &KernelTable::gelu,     gelu,              true,  false, -12,  12 },
+    { "gelu_erf", &KernelTable::gelu_erf, geluErf,           true,  false, -12,  12 },
+};
+
+
+// Inputs
+//////////////////////////////////////////////////////////////////////////////
+
+// A dense sweep over [low, high], every binade of both signs from the
+// smallest subnormal to the largest finite value, and the special values
+static vector<Scalar> inputs(const Function& function) {
+    vector<Scalar> x;
+
+    const int DENSE_POINTS = 200001;
+    for (int i = 0; i < DENSE_POINTS; i++) {
+        x.push_back(Scalar(function.low + (function.high - function.low) * i / (DENSE_POINTS - 1)));
+    }
+
+    const int BINADE_POINTS = 32;
+    for (int e = Limits::min_exponent - Limits::digits; e < Limits::max_exponent; e++) {
+        for (int k = 0; k < BINADE_POINTS; k++) {
+            Scalar value = std::ldexp(Scalar(1) + Scalar(k) / BINADE_POINTS, e - 1);
+            if (std::isfinite(value) && value > 0) {
+                x.push_back(value);
+                x.push_back(-value);
+            }
+        }
+    }
+
+    const Scalar special[] = {
+        0, Limits::denorm_min(), Limits::min(), Limits::max(), Limits::infinity(),
+        EXP_MAX, std::nextafter(EXP_MAX, Scalar(0)), std::nextafter(EXP_MAX, Limits::max()),
+        -EXP_MIN, std::nextafter(-EXP_MIN, Scalar(0)), std::nextafter(-EXP_MIN, Limits::max()),
+        Scalar(0.5), std::nextafter(Scalar(0.5), Scalar(0)),  // where erf changes formula
+    };
+    for (Scalar value : special) {
+        x.push_back(value);
+        x.push_back(-value);
+    }
+    x.push_back(Limits::quiet_NaN());
+
+    return x;
+}
+
+
+// Errors
+//////////////////////////////////////////////////////////////////////////////
+
+// Error of y = f(x) against the exact value, relative to it or to x, and
+// with the magnitude of the reference floored at the smallest normal value,
+// below which results are subnormal and lose relative precision. Special
+// cases return 0 if y is what they must be and infinity otherwise:
+//
+//   - NaN where the exact value is NaN, as for x = NaN, log of negatives
+//     and gelu(-inf), which is -inf * 0 like its formula
+//   - The infinity of the exact value, and for exp and sigmoid infinity
+//     above EXP_MAX, before libm overflows
+//   - For exp and sigmoid, results below EXP_TINY may be flushed to 0
+static double error(const Function& function, Scalar x, Scalar y, long double exact) {
+    const double FAIL = numeric_limits<double>::infinity();
+
+    if (std::isnan(exact)) {
+        return std::isnan(y) ? 0 : FAIL;
+    }
+    if (std::isnan(y)) {
+        return FAIL;
+    }
+    if (std::isinf(y) || std::fabs(exact) > Limits::max()) {
+        bool same_infinity = std::isinf(y) && (y > 0) == (exact > 0);
+        bool early_overflow = function.flushes && y > 0 && exact >= std::exp((long double)EXP_MAX);
+        return same_infinity && (std::fabs(exact) > Limits::max() || early_overflow) ? 0 : FAIL;
+    }
+    if (function.flushes && std::fabs(exact) < EXP_TINY && y == 0) {
+        return 0;
+    }
+
+    long double scale = function.relative_to_input ? std::fabs((long double)x) : std::fabs(exact);
+    return (double)(std::fabs(y - exact) / std::max(scale, (long double)Limits::min()));
+}
+
+
+// Test
+//////////////////////////////////////////////////////////////////////////////
+
+static const char* accuracyName(MathAccuracy accuracy) {
+    switch (accuracy) {
+        case MathAccuracy::Exact: return "exact";
+        case MathAccuracy::High:  return "high";
+        default:                  return "fast";
+    }
+}
+
+static const KernelTable& table(Isa isa, MathAccuracy accuracy) {
+    switch (isa) {
+        case Isa::AVX512: return avx512KernelTable(accuracy);
+        case Isa::AVX2:   return avx2KernelTable(accuracy);
+        case Isa::SSE2:   return sse2KernelTable(accuracy);
+        default:          return scalarKernelTable(accuracy);
+    }
+}
+
+int main() {
+    const Isa ISAS[] = { Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512 };
+    const MathAccuracy ACCURACIES[] = {
+        MathAccuracy::Exact, MathAccuracy::High, MathAccuracy::Fast
+    };
+
+    for (const Function& function : FUNCTIONS) {
+        vector<Scalar> x = inputs(function);
+        vector<long double> exact(x.size());
+        for (size_t i = 0; i < x.size(); i++) {
+            exact[i] = function.exact(x[i]);
+        }
+
+        for (MathAccuracy accuracy : ACCURACIES) {
+            // The scalar results, which every instruction set must match
+            // bitwise for the approximations
+            vector<Scalar> reference(x.size());
+            (table(Isa::Scalar, accuracy).*function.kernel)(x.size(), x.data(), 0,
+                                                            reference.data());
+
+            for (Isa isa : ISAS) {
+                if (isa > detectIsa()) {
+                    continue;
+                }
+
+                vector<Scalar> y(x.size());
+                (table(isa, accuracy).*function.kernel)(x.size(), x.data(), 0, y.data());
+
+                double max_error = 0;
+                size_t worst = 0;
+                size_t mismatches = 0;
+                for (size_t i = 0; i < x.size(); i++) {
+                    double e = error(function, x[i], y[i], exact[i]);
+                    if (!(e <= max_error)) {
+                        max_error = e;
+                        worst = i;
+                    }
+                    if (memcmp(&y[i], &reference[i], sizeof(Scalar)) != 0) {
+                        mismatches++;
+                    }
+                }
+
+                cout << setw(8) << function.name << "  " << setw(5) << accuracyName(accuracy)
+                     << "  " << setw(6) << isaName(isa) << "  max error "
+                     << setprecision(3) << max_error << endl;
+
+                CHECK(max_error <= maxError(accuracy),
+                      function.name << " " << accuracyName(accuracy) << " " << isaName(isa)
+                      << ": error " << max_error << " above " << maxError(accuracy)
+                      << setprecision(17) << " at x = " << x[worst] << ", got " << y[worst]
+                      << ", exact " << (double)exact[worst]);
+                CHECK(accuracy == MathAccuracy::Exact || mismatches == 0,
+                      function.name << " " << accuracyName(accuracy) << " " << isaName(isa)
+                      << ": " << mismatches << " results differ from the scalar kernel");
+            }
+        }
+    }
+
+    return testResult("test-math");
+}
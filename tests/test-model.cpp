@@ -0,0 +1,216 @@
+/*
+ * File: tests/test-model.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the round trip and corruption test of the binary model file format.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "model.h"
+#include "checksum.h"
+#include "test.h"
+
+using namespace std;
+
+// Runs in the precision of the build: run make test once in each of them.
+
+// Offsets of the header fields, see ModelHeader in src/model.cpp
+static const size_t HEADER_SIZE = 64;
+static const size_t VERSION_OFFSET = 8;
+static const size_t SCALAR_SIZE_OFFSET = 12;
+static const size_t DATA_OFFSET_OFFSET = 24;
+static const size_t HEADER_CHECKSUM_OFFSET = 60;
+
+static const size_t RECORD_SIZE = 64;
+
+
+// Files
+//////////////////////////////////////////////////////////////////////////////
+
+static vector<char> readFile(const string& file_name) {
+    ifstream file(file_name, ios::binary);
+    return vector<char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static void writeFile(const string& file_name, const vector<char>& bytes) {
+    ofstream file(file_name, ios::binary | ios::trunc);
+    file.write(bytes.data(), bytes.size());
+}
+
+template <typename T>
+static T field(const vector<char>& bytes, size_t offset) {
+    T value;
+    memcpy(&value, bytes.data() + offset, sizeof(value));
+    return value;
+}
+
+// Sets a header field and the header checksum, so that only the field is
+// wrong
+template <typename T>
+static vector<char> withField(vector<char> bytes, size_t offset, T value) {
+    memcpy(bytes.data() + offset, &value, sizeof(value));
+    uint32_t checksum = crc32c(bytes.data(), HEADER_CHECKSUM_OFFSET);
+    memcpy(bytes.data() + HEADER_CHECKSUM_OFFSET, &checksum, sizeof(checksum));
+    return bytes;
+}
+
+
+// Networks
+//////////////////////////////////////////////////////////////////////////////
+
+// One layer of every type the format stores, with settings other than the
+// defaults
+static vector<shared_ptr<Layer>> buildLayers() {
+    srand(7);
+    vector<shared_ptr<Layer>> layers = {
+        make_shared<Linear>(12, 16),
+        make_shared<LeakyRelu>(0.1, ActivationCache::Mask),
+        make_shared<Linear>(16, 16),
+        make_shared<Gelu>(Gelu::Erf),
+        make_shared<Dropout>(0.8),
+        make_shared<Linear>(16, 16),
+        make_shared<Tanh>(ActivationCache::Input),
+        make_shared<Linear>(16, 16),
+        make_shared<Sigmoid>(),
+        make_shared<Linear>(16, 16),
+        make_shared<Relu>(),
+        make_shared<Linear>(16, 10),
+        make_shared<SoftMax>()
+    };
+    layers[3]->setMathAccuracy(MathAccuracy::High);
+    layers[6]->setMathAccuracy(MathAccuracy::Fast);
+    return layers;
+}
+
+static NeuralNetwork network(const vector<shared_ptr<Layer>>& layers) {
+    return NeuralNetwork(layers, make_shared<CrossEntropy>(), make_shared<Adam>());
+}
+
+static bool bitwiseEqual(const Tensor& a, const Tensor& b) {
+    if (a.rows() != b.rows() || a.cols() != b.cols()) {
+        return false;
+    }
+    for (int i = 0; i < a.rows(); i++) {
+        for (int j = 0; j < a.cols(); j++) {
+            if (memcmp(&a(i, j), &b(i, j), sizeof(Scalar)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// Tests
+//////////////////////////////////////////////////////////////////////////////
+
+static void testRoundTrip(const string& file_name) {
+    vector<shared_ptr<Layer>> layers = buildLayers();
+    saveModel(network(layers), file_name);
+
+    Tensor X = Tensor::allocate(12, 33);
+    for (int i = 0; i < X.rows(); i++) {
+        for (int j = 0; j < X.cols(); j++) {
+            X(i, j) = Scalar(rand()) / RAND_MAX - Scalar(0.5);
+        }
+    }
+    Tensor expected = network(layers).predict(X).clone();
+
+    vector<shared_ptr<Layer>> mapped = mapModel(file_name);
+    vector<shared_ptr<Layer>> loaded = loadModel(file_name);
+    CHECK(mapped.size() == layers.size(), "mapModel: " << mapped.size() << " layers");
+    CHECK(loaded.size() == layers.size(), "loadModel: " << loaded.size() << " layers");
+    CHECK(bitwiseEqual(network(mapped).predict(X), expected), "mapModel: outputs differ");
+    CHECK(bitwiseEqual(network(loaded).predict(X), expected), "loadModel: outputs differ");
+
+    for (size_t i = 0; i < layers.size() && i < loaded.size(); i++) {
+        CHECK(mapped[i]->getMathAccuracy() == layers[i]->getMathAccuracy(),
+              "mapModel: math accuracy of layer " << i << " differs");
+        auto linear = dynamic_pointer_cast<Linear>(layers[i]);
+        auto loaded_linear = dynamic_pointer_cast<Linear>(loaded[i]);
+        if (linear) {
+            CHECK(loaded_linear && bitwiseEqual(loaded_linear->W, linear->W) &&
+                  bitwiseEqual(loaded_linear->b, linear->b),
+                  "loadModel: parameters of layer " << i << " differ");
+        }
+    }
+
+    // Saving what was loaded writes the same file again
+    string copy_name = file_name + ".copy";
+    saveModel(loaded, copy_name);
+    CHECK(readFile(copy_name) == readFile(file_name), "saveModel: second file differs");
+    remove(copy_name.c_str());
+}
+
+// Checks that mapModel and loadModel reject bytes with std::runtime_error
+static void checkRejected(const string& file_name, const vector<char>& bytes,
+                          const string& what) {
+    writeFile(file_name, bytes);
+    CHECK_THROWS(mapModel(file_name), std::runtime_error, "mapModel: " << what);
+    CHECK_THROWS(loadModel(file_name), std::runtime_error, "loadModel: " << what);
+}
+
+static void testCorruption(const string& file_name) {
+    saveModel(buildLayers(), file_name);
+    const vector<char> original = readFile(file_name);
+
+    size_t records_end = HEADER_SIZE + buildLayers().size() * RECORD_SIZE;
+    size_t data_offset = field<uint64_t>(original, DATA_OFFSET_OFFSET);
+    CHECK(original.size() > data_offset && data_offset >= records_end,
+          "saveModel: unexpected layout");
+
+    // One flipped bit in each byte of the header and of the records, and in
+    // a spread of bytes of the data, padding included, up to its last byte
+    vector<size_t> flipped;
+    for (size_t i = 0; i < records_end; i++) {
+        flipped.push_back(i);
+    }
+    for (size_t i = data_offset; i < original.size(); i += 61) {
+        flipped.push_back(i);
+    }
+    flipped.push_back(original.size() - 1);
+
+    for (size_t i : flipped) {
+        vector<char> bytes = original;
+        bytes[i] ^= 0x10;
+        const char* region = i < HEADER_SIZE ? "header" : i < records_end ? "records" : "data";
+        checkRejected(file_name, bytes, "flipped byte " + to_string(i) + " in the " + region);
+    }
+
+    // Truncated in the header, the records, the data, and by one byte
+    const size_t lengths[] = { 0, HEADER_SIZE / 2, HEADER_SIZE + RECORD_SIZE / 2,
+                               data_offset + 8, original.size() - 1 };
+    for (size_t length : lengths) {
+        checkRejected(file_name, vector<char>(original.begin(), original.begin() + length),
+                      "truncated to " + to_string(length) + " bytes");
+    }
+
+    checkRejected(file_name, withField<uint32_t>(original, VERSION_OFFSET, MODEL_VERSION + 1),
+                  "wrong version");
+    uint32_t other_size = sizeof(Scalar) == sizeof(double) ? sizeof(float) : sizeof(double);
+    checkRejected(file_name, withField<uint32_t>(original, SCALAR_SIZE_OFFSET, other_size),
+                  "wrong scalar_size");
+
+    // The untouched file still loads
+    writeFile(file_name, original);
+    CHECK(mapModel(file_name).size() == buildLayers().size(), "mapModel: original rejected");
+}
+
+int main() {
+    string file_name = "/tmp/deepcpp-test-model-" + to_string(getpid()) + ".model";
+
+    testRoundTrip(file_name);
+    testCorruption(file_name);
+
+    CHECK_THROWS(mapModel(file_name + ".missing"), std::runtime_error, "mapModel: missing file");
+
+    remove(file_name.c_str());
+    return testResult("test-model");
+}
@@ -0,0 +1,51 @@
+/*
+ * File: tests/test.h
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the checks shared by the tests.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <iostream>
+#include <stdexcept>
+
+// Each test is a program run by make test. A failed check prints where and
+// why and the test goes on, so that one run reports every failure; main then
+// returns testResult(), which is 1 if any check failed.
+
+static int test_failures = 0;
+
+#define CHECK(condition, message)                                           \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            test_failures++;                                                \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << message     \
+                      << std::endl;                                         \
+        }                                                                   \
+    } while (0)
+
+// Checks that statement throws exception_type
+#define CHECK_THROWS(statement, exception_type, message)                    \
+    do {                                                                    \
+        bool thrown = false;                                                \
+        try {                                                               \
+            statement;                                                      \
+        } catch (const exception_type&) {                                   \
+            thrown = true;                                                  \
+        } catch (...) {                                                     \
+        }                                                                   \
+        CHECK(thrown, message << ": " #exception_type " expected");        \
+    } while (0)
+
+static int testResult(const char* name) {
+    if (test_failures > 0) {
+        std::cerr << name << ": " << test_failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << name << ": passed" << std::endl;
+    return 0;
+}
+
+#endif // TEST_H
@@ -0,0 +1,110 @@
+/*
+ * File: tools/inference-server.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the standalone server that serves a trained network to local processes.
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "NNUtils.h"
+#include "model.h"
+#include "server.h"
+
+using namespace std;
+
+static InferenceServer* running_server = nullptr;
+
+static void handleSignal(int) {
+    if (running_server) {
+        running_server->stop();
+    }
+}
+
+static void usage();
+
+int main(int argc, char* argv[]) {
+
+    string model_path;
+    string socket_path = "/tmp/deepcpp.sock";
+    BatcherOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--socket" && has_value) {
+            socket_path = argv[++i];
+        } else if (arg == "--max-batch" && has_value) {
+            options.max_batch_size = atoi(argv[++i]);
+        } else if (arg == "--max-delay" && has_value) {
+            options.max_delay = chrono::microseconds(atoi(argv[++i]));
+        } else if (arg == "--workers" && has_value) {
+            options.num_workers = atoi(argv[++i]);
+        } else if (arg[0] != '-' && model_path.empty()) {
+            model_path = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (model_path.empty()) {
+        usage();
+        return 1;
+    }
+
+    try {
+        // Weights are used in place from the page cache
+        vector<shared_ptr<Layer>> layers = mapModel(model_path);
+        auto first = layers.empty() ? nullptr : dynamic_pointer_cast<Linear>(layers[0]);
+        if (!first) {
+            throw invalid_argument("The first layer of the model must be linear");
+        }
+
+        auto network = make_shared<NeuralNetwork>(layers, make_shared<MeanSquaredError>(),
+                                                  make_shared<SGD>());
+        int input_size = first->W.cols();
+        InferenceServer server(network, input_size, socket_path, options);
+
+        running_server = &server;
+        signal(SIGINT, handleSignal);
+        signal(SIGTERM, handleSignal);
+
+        cout << "Serving " << model_path << " on " << socket_path
+             << "\n\n\tMax batch size:\t" << options.max_batch_size
+             << "\n\tMax delay:\t" << options.max_delay.count() << "us"
+             << "\n\tWorkers:\t" << options.num_workers << "\n" << endl;
+
+        server.run();
+        running_server = nullptr;
+
+        BatcherStats stats = server.getStats();
+        cout << "\nRequests:\t" << stats.requests
+             << "\nBatches:\t" << stats.batches
+             << "\np50 latency:\t" << stats.p50_latency << "us"
+             << "\np99 latency:\t" << stats.p99_latency << "us"
+             << "\n\nBatch sizes:" << endl;
+        for (size_t size = 0; size < stats.batch_sizes.size(); size++) {
+            if (stats.batch_sizes[size] > 0) {
+                cout << "\t" << size << ":\t" << stats.batch_sizes[size] << endl;
+            }
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+static void usage() {
+    cerr << "Usage: inference-server MODEL [--socket PATH] [--max-batch N]\n"
+         << "                        [--max-delay US] [--workers N]\n\n"
+         << "MODEL is a file written by saveModel()." << endl;
+}
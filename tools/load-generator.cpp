@@ -0,0 +1,139 @@
+/*
+ * File: tools/load-generator.cpp
+ * Author: Antonio Manuel Escudero Vargas <antoniomanuelescuderovargas@gmail.com>
+ * License: MIT
+ * Description: Contains the load generator that measures the throughput and latency of the inference server.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "client.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static void usage();
+
+int main(int argc, char* argv[]) {
+
+    string socket_path = "/tmp/deepcpp.sock";
+    int num_clients = 4;
+    int num_requests = 10000;
+    int samples = 1;
+    int in_flight = 1;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--socket" && has_value) {
+            socket_path = argv[++i];
+        } else if (arg == "--clients" && has_value) {
+            num_clients = atoi(argv[++i]);
+        } else if (arg == "--requests" && has_value) {
+            num_requests = atoi(argv[++i]);
+        } else if (arg == "--samples" && has_value) {
+            samples = atoi(argv[++i]);
+        } else if (arg == "--in-flight" && has_value) {
+            in_flight = atoi(argv[++i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (num_clients <= 0 || num_requests <= 0 || samples <= 0 || in_flight <= 0) {
+        usage();
+        return 1;
+    }
+
+    // Latency of every request of every client, in microseconds
+    vector<vector<double>> latencies(num_clients);
+    vector<string> errors(num_clients);
+
+    Clock::time_point start = Clock::now();
+
+    vector<thread> clients;
+    for (int c = 0; c < num_clients; c++) {
+        clients.emplace_back([&, c] {
+            try {
+                InferenceClient client(socket_path, in_flight, samples);
+                mt19937 generator(c);
+                uniform_real_distribution<double> pixel(0, 1);
+
+                // Tickets in flight and when they were sent
+                deque<pair<uint64_t, Clock::time_point>> sent;
+                latencies[c].reserve(num_requests);
+
+                for (int r = 0; r < num_requests || !sent.empty(); r++) {
+                    if ((int)sent.size() == in_flight || r >= num_requests) {
+                        client.wait(sent.front().first);
+                        chrono::duration<double, micro> latency = Clock::now() - sent.front().second;
+                        latencies[c].push_back(latency.count());
+                        sent.pop_front();
+                    }
+                    if (r < num_requests) {
+                        Scalar* inputs = client.reserve(samples);
+                        for (int i = 0; i < samples * client.inputSize(); i++) {
+                            inputs[i] = pixel(generator);
+                        }
+                        Clock::time_point now = Clock::now();
+                        sent.push_back(make_pair(client.send(), now));
+                    }
+                }
+            } catch (const exception& e) {
+                errors[c] = e.what();
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    vector<double> all;
+    for (int c = 0; c < num_clients; c++) {
+        if (!errors[c].empty()) {
+            cerr << "Client " << c << ": " << errors[c] << endl;
+        }
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+    }
+    if (all.empty()) {
+        return 1;
+    }
+    sort(all.begin(), all.end());
+
+    auto percentile = [&all](double fraction) {
+        size_t rank = min(all.size() - 1, (size_t)(fraction * all.size()));
+        return all[rank];
+    };
+
+    cout << fixed << setprecision(1)
+         << "Requests:\t" << all.size()
+         << "\nThroughput:\t" << all.size() / seconds << " requests/s, "
+         << all.size() * samples / seconds << " samples/s"
+         << "\np50 latency:\t" << percentile(0.5) << "us"
+         << "\np99 latency:\t" << percentile(0.99) << "us"
+         << "\np99.9 latency:\t" << percentile(0.999) << "us"
+         << "\nMax latency:\t" << all.back() << "us" << endl;
+
+    return 0;
+}
+
+
+
+static void usage() {
+    cerr << "Usage: load-generator [--socket PATH] [--clients N] [--requests N]\n"
+         << "                      [--samples N] [--in-flight N]\n\n"
+         << "Each client sends its requests of random samples over its own\n"
+         << "connection, keeping up to in-flight of them waiting for a response." << endl;
+}